@@ -0,0 +1,354 @@
+// dspic-bench: update time of the boot loader for given image sizes, modes,
+// baud rates and link latencies. Every scenario runs the complete
+// dspic-flash update against a fresh dspic-sim, the boot loader sources
+// built for the PC with datasheet flash timing and a baud rate limited
+// link, and reports where the time went.
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <getopt.h>
+#include <map>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+#include "Flasher.h"
+#include "Image.h"
+#include "SerialPort.h"
+#include "Simulator.h"
+#include "Workload.h"
+
+namespace
+{
+
+struct Options
+{
+    std::string hex;
+    std::string sim;
+    std::vector<unsigned> sizes = {48, 144};        // KiB
+    std::vector<std::string> modes = {"hex", "packed", "lz"};
+    std::vector<unsigned> bauds = {460800};
+    std::vector<double> latencies = {0};            // ms
+    std::vector<std::string> batch = {"on"};
+    bool gaps = false;
+    double jitter = 0;                              // ms
+    double timeScale = 1;
+    unsigned boards = 1;
+    bool csv = false;
+};
+
+struct Scenario
+{
+    unsigned size;
+    std::string mode;
+    unsigned baud;
+    double latency;
+    bool batch;
+};
+
+void Usage()
+{
+    fprintf(stderr,
+            "usage: dspic-bench [options] [IMAGE.hex]\n"
+            "  -k, --size KIB,...       sizes of the synthesized image without IMAGE.hex\n"
+            "                           (48,144)\n"
+            "  -m, --mode MODE,...      dspic-flash modes to compare (hex,packed,lz), the\n"
+            "                           first one is the baseline; patch updates an image\n"
+            "                           with 8 instructions inserted at 3/4 of its size\n"
+            "  -b, --baud N,...         transfer baud rates, CHANGE_BAUD above 460800\n"
+            "  -l, --latency-ms X,...   link latency per frame and direction (0)\n"
+            "  -B, --batch on,off       READ_CRC in BATCH frames or one per frame (on)\n"
+            "  -g, --gaps               leave out every other page of the image, for\n"
+            "                           one READ_CRC range per page\n"
+            "  -j, --jitter-ms X        random extra latency, up to X (0)\n"
+            "  -n, --boards N           update N simulated boards at once, as dspic-flash\n"
+            "                           does with N ports (1)\n"
+            "  -T, --time-scale X       dspic-sim --time-scale (1)\n"
+            "  -S, --sim PATH           dspic-sim to run (next to dspic-bench)\n"
+            "  -c, --csv                comma separated output\n");
+}
+
+template <typename T>
+bool ParseList(const char *arg, std::vector<T> *out)
+{
+    std::stringstream in(arg);
+    std::string item;
+
+    out->clear();
+    while (std::getline(in, item, ','))
+    {
+        std::stringstream field(item);
+        T value;
+        if (!(field >> value))
+            return false;
+        out->push_back(value);
+    }
+    return !out->empty();
+}
+
+bool ParseOptions(int argc, char **argv, Options *opt)
+{
+    static const struct option longOptions[] = {
+        {"size", required_argument, nullptr, 'k'},
+        {"mode", required_argument, nullptr, 'm'},
+        {"baud", required_argument, nullptr, 'b'},
+        {"latency-ms", required_argument, nullptr, 'l'},
+        {"batch", required_argument, nullptr, 'B'},
+        {"gaps", no_argument, nullptr, 'g'},
+        {"jitter-ms", required_argument, nullptr, 'j'},
+        {"boards", required_argument, nullptr, 'n'},
+        {"time-scale", required_argument, nullptr, 'T'},
+        {"sim", required_argument, nullptr, 'S'},
+        {"csv", no_argument, nullptr, 'c'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+    int c;
+    bool ok = true;
+
+    while ((c = getopt_long(argc, argv, "k:m:b:l:B:gj:n:T:S:ch", longOptions, nullptr)) != -1)
+    {
+        switch (c)
+        {
+        case 'k': ok = ParseList(optarg, &opt->sizes); break;
+        case 'm': ok = ParseList(optarg, &opt->modes); break;
+        case 'b': ok = ParseList(optarg, &opt->bauds); break;
+        case 'l': ok = ParseList(optarg, &opt->latencies); break;
+        case 'B':
+            ok = ParseList(optarg, &opt->batch);
+            for (const std::string &b : opt->batch)
+                ok &= b == "on" || b == "off";
+            break;
+        case 'g': opt->gaps = true; break;
+        case 'j': opt->jitter = atof(optarg); break;
+        case 'n': opt->boards = std::max(1, atoi(optarg)); break;
+        case 'T': opt->timeScale = atof(optarg); break;
+        case 'S': opt->sim = optarg; break;
+        case 'c': opt->csv = true; break;
+        default: return false;
+        }
+        if (!ok)
+            return false;
+    }
+    if (optind < argc)
+        opt->hex = argv[optind++];
+    if (optind != argc)
+        return false;
+    if (opt->sim.empty())
+    {
+        char self[4096];
+        ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+        std::string dir = ".";
+        if (len > 0)
+        {
+            self[len] = 0;
+            dir = self;
+            dir.erase(dir.rfind('/'));
+        }
+        opt->sim = dir + "/dspic-sim";
+    }
+    return true;
+}
+
+struct Result
+{
+    Scenario scenario;
+    FlashReport report;
+    std::map<std::string, double> sim;
+    std::string error;
+};
+
+void PrintHeader(bool csv)
+{
+    if (csv)
+    {
+        printf("size_kib,mode,batch,baud,latency_ms,boards,ok,wall_s,kib_per_s,vs_baseline,to_device_bytes,from_device_bytes,"
+               "frames,round_trips,retransmits,page_erases,bulk_erases,double_word_writes,link_busy_s,"
+               "flash_busy_s\n");
+        return;
+    }
+    printf("%6s %-6s %-5s %7s %7s %3s %8s %8s %6s %9s %8s %6s %6s %6s %7s %7s %7s\n", "KiB", "mode", "batch", "baud",
+           "lat ms",
+           "N", "wall s", "KiB/s", "vs 1st", "to dev B", "from B", "frames", "trips", "retx", "erases", "dwords",
+           "link s");
+}
+
+// Counts are per board, KiB/s is over all boards.
+void PrintResult(const Result &r, unsigned boards, double baseline, bool csv)
+{
+    const Scenario &s = r.scenario;
+    const FlashReport &f = r.report;
+    auto sim = [&r](const char *key) {
+        auto it = r.sim.find(key);
+        return it == r.sim.end() ? 0.0 : it->second;
+    };
+    double kib = f.instructions * 3 / 1024.0;
+    double rate = kib * boards / f.totalTime;
+    double link = (sim("link_rx_busy_ms") + sim("link_tx_busy_ms")) / 1000;
+    double flash = sim("flash_busy_ms") / 1000;
+    double vs = baseline > 0 ? baseline / f.totalTime : 0;
+
+    if (csv)
+    {
+        printf("%u,%s,%s,%u,%g,%u,%d,%.3f,%.1f,%.2f,%.0f,%.0f,%zu,%u,%u,%.0f,%.0f,%.0f,%.3f,%.3f\n", s.size,
+               s.mode.c_str(), s.batch ? "on" : "off", s.baud, s.latency, boards, f.ok, f.totalTime, rate, vs,
+               sim("link_rx_bytes"), sim("link_tx_bytes"), f.frames, f.wire.roundTrips, f.wire.retransmits,
+               sim("page_erases"), sim("bulk_erases"), sim("double_word_writes"), link, flash);
+        return;
+    }
+    if (!f.ok)
+    {
+        printf("%6u %-6s %-5s %7u %7g %3u FAILED: %s\n", s.size, s.mode.c_str(), s.batch ? "on" : "off", s.baud,
+               s.latency, boards,
+               r.error.empty() ? "CRC mismatch" : r.error.c_str());
+        return;
+    }
+    printf("%6u %-6s %-5s %7u %7g %3u %8.2f %8.1f %5.2fx %9.0f %8.0f %6zu %6u %6u %7.0f %7.0f %7.2f  flash %.2f s\n",
+           s.size, s.mode.c_str(), s.batch ? "on" : "off", s.baud, s.latency, boards, f.totalTime, rate, vs, sim("link_rx_bytes"),
+           sim("link_tx_bytes"), f.frames, f.wire.roundTrips, f.wire.retransmits,
+           sim("page_erases") + sim("bulk_erases"), sim("double_word_writes"), link, flash);
+}
+
+Result RunScenario(const Options &opt, const Scenario &s, const Image &image, const Image &base,
+                   const std::string &dir)
+{
+    Result r;
+    std::string err;
+    std::vector<Simulator> sims(opt.boards);
+    std::vector<SerialPort> ports(opt.boards);
+    std::vector<FlashReport> reports(opt.boards);
+    FlashOptions flash;
+    const Image none;
+    bool patch = s.mode == "patch";
+
+    r.scenario = s;
+    flash.mode = s.mode;
+    flash.switchBaud = s.baud;
+    flash.batch = s.batch;
+    flash.run = true;                   // ends dspic-sim
+
+    for (unsigned i = 0; i < opt.boards; i++)
+    {
+        // Patches start from the previous image, the others from blank
+        // flash. dspic-sim saves what it programmed, so the file is
+        // written every time.
+        std::string file = dir + "/flash" + std::to_string(i) + ".bin";
+        if (patch && !WriteFlashFile(file, base))
+        {
+            r.error = file + ": " + strerror(errno);
+            return r;
+        }
+        if (!sims[i].Start(opt.sim, opt.timeScale, s.latency, opt.jitter, patch ? file : "", &err) ||
+            !ports[i].Open(sims[i].Pty(), flash.baud, &err))
+        {
+            r.error = err;
+            return r;
+        }
+    }
+
+    // All boards at once, as dspic-flash does with several ports.
+    Flasher flasher(image, patch ? base : none, flash);
+    std::vector<std::thread> threads;
+    auto start = std::chrono::steady_clock::now();
+    for (unsigned i = 0; i < opt.boards; i++)
+        threads.emplace_back([&flasher, &ports, &reports, i]() { flasher.Flash(ports[i], &reports[i]); });
+    for (std::thread &t : threads)
+        t.join();
+    double wall = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    // Counts per board from the first one, the simulator's averaged.
+    r.report = reports[0];
+    r.report.totalTime = wall;
+    for (unsigned i = 0; i < opt.boards; i++)
+    {
+        std::map<std::string, double> stats;
+        ports[i].Close();
+        if (!reports[i].ok)
+        {
+            r.report.ok = false;
+            if (r.error.empty())
+                r.error = reports[i].error;
+            continue;
+        }
+        if (!sims[i].Finish(&stats, &err))
+        {
+            r.report.ok = false;
+            r.error = err;
+            continue;
+        }
+        for (const auto &kv : stats)
+            r.sim[kv.first] += kv.second / opt.boards;
+    }
+    return r;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    Options opt;
+    std::string err;
+    Image loaded;
+
+    if (!ParseOptions(argc, argv, &opt))
+    {
+        Usage();
+        return 2;
+    }
+    if (!opt.hex.empty())
+    {
+        if (!loaded.LoadHex(opt.hex, &err))
+        {
+            fprintf(stderr, "%s\n", err.c_str());
+            return 1;
+        }
+        opt.sizes = {(unsigned)(loaded.Size() * 3 / 1024)};
+    }
+
+    char dir[] = "/tmp/dspic-bench.XXXXXX";
+    if (!mkdtemp(dir))
+    {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    PrintHeader(opt.csv);
+    bool allOk = true;
+    for (unsigned size : opt.sizes)
+    {
+        Image image = opt.hex.empty() ? Synthesize(size) : loaded;
+        if (opt.gaps)
+            image = Gaps(image, 0x800);
+        Image base = Previous(image);
+
+        double baseline = 0;
+        for (const std::string &mode : opt.modes)
+        {
+            for (unsigned baud : opt.bauds)
+            {
+                for (double latency : opt.latencies)
+                {
+                    for (const std::string &batch : opt.batch)
+                    {
+                        Scenario scenario{size, mode, baud, latency, batch == "on"};
+                        Result r = RunScenario(opt, scenario, image, base, dir);
+                        if (baseline == 0 && r.report.ok)
+                            baseline = r.report.totalTime;
+                        allOk &= r.report.ok;
+                        PrintResult(r, opt.boards, baseline, opt.csv);
+                        fflush(stdout);
+                    }
+                }
+            }
+        }
+    }
+    for (unsigned i = 0; i < opt.boards; i++)
+        unlink((std::string(dir) + "/flash" + std::to_string(i) + ".bin").c_str());
+    rmdir(dir);
+    return allOk ? 0 : 1;
+}
@@ -0,0 +1,125 @@
+// crc-bench: time per byte of the boot loader's table driven CRC, built
+// for the PC, on its three paths: the CRC of every received byte
+// (BuildRxFrame()), of a response frame (CalculateCrc()) and READ_CRC over
+// program memory (CalculateCrcProgMem()). "make bench-crc" runs it for the
+// byte table and the nibble table (CRC_NIBBLE_TABLE). The numbers are host
+// ns and, on x86, TSC cycles: they compare the two tables, they are not
+// dsPIC cycles.
+#include <chrono>
+#include <cstdio>
+#include <vector>
+
+#include "Crc16.h"
+#include "Frame.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define HAVE_TSC 1
+#endif
+
+#include "Loopback.h"
+
+extern "C"
+{
+UINT16 CalculateCrc(UINT8 *data, UINT32 len);
+UINT16 CalculateCrcProgMem(UINT32 progAdrs, UINT32 len);
+}
+
+namespace
+{
+
+#ifdef CRC_BYTE_TABLE
+const char TABLE[] = "byte table";
+#else
+const char TABLE[] = "nibble table";
+#endif
+
+const unsigned FRAME_BYTES = FRAMEWORK_BUFF_SIZE - 5;
+
+struct Timing
+{
+    double ns = 0;
+    double cycles = 0;                  // 0 without a TSC.
+};
+
+// Best of a few runs of fn over bytes bytes, per byte.
+template <typename F>
+Timing Measure(size_t bytes, F fn)
+{
+    Timing best;
+
+    for (int run = 0; run < 5; run++)
+    {
+        auto start = std::chrono::steady_clock::now();
+#ifdef HAVE_TSC
+        uint64_t tsc = __rdtsc();
+#endif
+        fn();
+#ifdef HAVE_TSC
+        double cycles = (double)(__rdtsc() - tsc) / bytes;
+#else
+        double cycles = 0;
+#endif
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count() / bytes;
+        if (run == 0 || ns < best.ns)
+            best = Timing{ns, cycles};
+    }
+    return best;
+}
+
+void Print(const char *path, const Timing &t)
+{
+    if (t.cycles > 0)
+        printf("%-12s %-28s %7.2f ns/B %7.2f cycles/B\n", TABLE, path, t.ns, t.cycles);
+    else
+        printf("%-12s %-28s %7.2f ns/B\n", TABLE, path, t.ns);
+}
+
+}
+
+int main()
+{
+    const unsigned rounds = 2000;
+    std::vector<uint8_t> data(FRAME_BYTES);
+    std::vector<uint8_t> wire;
+    volatile uint16_t sink = 0;
+    uint32_t state = 1;
+
+    Loopback device;
+    for (uint8_t &b : data)
+    {
+        state = state * 1103515245 + 12345;
+        b = state >> 16;
+    }
+    // A frame the boot loader has no use for (command 0): parsed, checked
+    // and dropped, nothing else runs.
+    data[0] = 0;
+    frame::Encode(data.data(), data.size(), wire);
+    if (CalculateCrc(data.data(), data.size()) != Crc16(data.data(), data.size()))
+    {
+        fprintf(stderr, "%s: CRC differs from the host's\n", TABLE);
+        return 1;
+    }
+
+    Print("receive (BuildRxFrame)", Measure((size_t)rounds * FRAME_BYTES, [&]() {
+              for (unsigned i = 0; i < rounds; i++)
+              {
+                  BuildRxFrame(wire.data(), (INT16)wire.size());
+                  FrameWorkTask();
+              }
+          }));
+
+    Print("response (CalculateCrc)", Measure((size_t)rounds * FRAME_BYTES, [&]() {
+              for (unsigned i = 0; i < rounds; i++)
+                  sink = sink + CalculateCrc(data.data(), data.size());
+          }));
+
+    // A whole page per call, 4 bytes per instruction.
+    for (uint32_t a = 0; a < 0x800; a += 2)
+        *simProgWord(0x010000 + a) = (state = state * 1103515245 + 12345) >> 8;
+    Print("READ_CRC (ProgMem)", Measure((size_t)rounds / 4 * 0x1000, [&]() {
+              for (unsigned i = 0; i < rounds / 4; i++)
+                  sink = sink + CalculateCrcProgMem(0x010000, 0x1000);
+          }));
+    return 0;
+}
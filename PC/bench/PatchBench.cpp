@@ -0,0 +1,118 @@
+// patch-bench: PROGRAM_PATCH size for typical edits between two builds,
+// against PROGRAM_COMPRESSED and PROGRAM_PACKED of the whole new image.
+// The patch is applied to the simulator build of the boot loader on top
+// of the old image, the same way the tests drive it, and checked against
+// the new one; erases are the pages it rewrote.
+//
+//   patch-bench [KIB,...]       (48,144)
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "Encoder.h"
+#include "Image.h"
+#include "Workload.h"
+#include "Loopback.h"
+
+namespace
+{
+
+size_t PayloadBytes(const std::vector<Payload> &payloads)
+{
+    size_t bytes = 0;
+
+    for (const Payload &p : payloads)
+        bytes += p.data.size();
+    return bytes;
+}
+
+size_t ChangedPages(const Image &base, const Image &image, const BootInfo &info)
+{
+    size_t pages = 0;
+
+    for (uint32_t page = info.appFirst; page < info.appLast; page += info.pageSize)
+    {
+        for (uint32_t a = page; a < page + info.pageSize; a += 2)
+        {
+            if (image.Word(a) != base.Word(a))
+            {
+                pages++;
+                break;
+            }
+        }
+    }
+    return pages;
+}
+
+// The old image as the boot loader would hold it, the patch applied on
+// top. False if flash doesn't hold the new image afterwards.
+bool Apply(const Image &base, const Image &image, const std::vector<Payload> &payloads, unsigned *erases)
+{
+    Loopback device;
+    std::vector<uint8_t> resp;
+
+    for (const auto &w : base.Words())
+        *simProgWord(w.first) = w.second;
+    if (!device.Program(payloads) || !device.Command(READ_BOOT_INFO, {}, &resp))
+        return false;
+    *erases = SimFlashStats.PageErases;
+    return Loopback::FlashHolds(image) && SimFlashStats.ProgramErrors == 0;
+}
+
+bool Compare(unsigned kib)
+{
+    BootInfo info = Loopback().Info();
+    size_t maxPayload = info.MaxPayload();
+    Image base = Synthesize(kib);
+    bool ok = true;
+
+    base.Restrict(info);
+    for (const std::string &kind : EditKinds())
+    {
+        Image image = Edited(base, kind);
+        image.Restrict(info);
+
+        std::vector<Payload> patch = EncodePatch(base, image, info, maxPayload);
+        Image stripped = image;
+        stripped.StripBlank(info.pageSize, true);
+        size_t lz = PayloadBytes(EncodeCompressed(stripped, maxPayload));
+        size_t packed = PayloadBytes(EncodeBlocks(stripped, maxPayload, true));
+        size_t bytes = PayloadBytes(patch);
+        unsigned erases = 0;
+        bool applied = Apply(base, image, patch, &erases);
+
+        printf("%6u %-7s %6zu %7zu %7zu %7.2f%% %8zu %7.2f%% %9zu %6u %s\n", kib, kind.c_str(),
+               ChangedPages(base, image, info), patch.size(), bytes, 100.0 * bytes / lz, lz, 100.0 * bytes / packed,
+               packed, erases, applied ? "ok" : "FAILED");
+        ok &= applied;
+    }
+    return ok;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    std::vector<unsigned> sizes = {48, 144};
+    bool ok = true;
+
+    if (argc > 2)
+    {
+        fprintf(stderr, "usage: patch-bench [KIB,...]\n");
+        return 2;
+    }
+    if (argc == 2)
+    {
+        std::stringstream in(argv[1]);
+        std::string item;
+        sizes.clear();
+        while (std::getline(in, item, ','))
+            sizes.push_back((unsigned)std::stoul(item));
+    }
+
+    printf("   KiB edit     pages  frames patch B   vs lz     lz B vs packed  packed B erases\n");
+    for (unsigned kib : sizes)
+        ok &= Compare(kib);
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,143 @@
+#include "Simulator.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <poll.h>
+#include <sstream>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+namespace
+{
+
+const uint32_t MAIN_FLASH_END = 0x055800;
+
+}
+
+bool WriteFlashFile(const std::string &path, const Image &image)
+{
+    std::vector<uint8_t> raw(MAIN_FLASH_END * 2, 0xFF);
+    for (size_t i = 3; i < raw.size(); i += 4)
+        raw[i] = 0;
+    for (const auto &w : image.Words())
+    {
+        if (w.first >= MAIN_FLASH_END)
+            continue;
+        uint8_t *p = &raw[w.first * 2];
+        p[0] = (uint8_t)w.second;
+        p[1] = (uint8_t)(w.second >> 8);
+        p[2] = (uint8_t)(w.second >> 16);
+    }
+    FILE *f = fopen(path.c_str(), "wb");
+    if (!f)
+        return false;
+    bool ok = fwrite(raw.data(), 1, raw.size(), f) == raw.size();
+    return fclose(f) == 0 && ok;
+}
+
+
+bool Simulator::Start(const std::string &path, double timeScale, double latencyMs, double jitterMs,
+                      const std::string &flash, std::string *err)
+{
+    int out[2], errPipe[2];
+    std::vector<std::string> args = {path, "--time-scale", std::to_string(timeScale),
+                                     "--latency-us", std::to_string(latencyMs * 1000),
+                                     "--jitter-us", std::to_string(jitterMs * 1000)};
+    if (!flash.empty())
+    {
+        args.push_back("--flash");
+        args.push_back(flash);
+    }
+
+    if (pipe(out) < 0 || pipe(errPipe) < 0)
+    {
+        *err = strerror(errno);
+        return false;
+    }
+    pid_ = fork();
+    if (pid_ == 0)
+    {
+        std::vector<char *> argv;
+        for (std::string &a : args)
+            argv.push_back(&a[0]);
+        argv.push_back(nullptr);
+        dup2(out[1], 1);
+        dup2(errPipe[1], 2);
+        close(out[0]);
+        close(errPipe[0]);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+    close(out[1]);
+    close(errPipe[1]);
+    out_ = out[0];
+    errFd_ = errPipe[0];
+    if (pid_ < 0)
+    {
+        *err = strerror(errno);
+        return false;
+    }
+
+    // First line: the pty.
+    char c;
+    struct pollfd p = {out_, POLLIN, 0};
+    while (poll(&p, 1, 5000) > 0 && read(out_, &c, 1) == 1 && c != '\n')
+        pty_ += c;
+    if (pty_.empty())
+    {
+        *err = "cannot start " + path;
+        return false;
+    }
+    return true;
+}
+
+bool Simulator::Finish(std::map<std::string, double> *stats, std::string *err)
+{
+    std::string text;
+    char buf[1024];
+    ssize_t len;
+    struct pollfd p = {errFd_, POLLIN, 0};
+
+    // It exits on JMP_TO_APP, closing stderr.
+    while (poll(&p, 1, 10000) > 0 && (len = read(errFd_, buf, sizeof(buf))) > 0)
+        text.append(buf, len);
+    Stop();
+
+    std::stringstream in(text);
+    std::string item;
+    while (in >> item)
+    {
+        size_t eq = item.find('=');
+        if (eq != std::string::npos)
+            (*stats)[item.substr(0, eq)] = atof(item.c_str() + eq + 1);
+    }
+    if (!stats->count("page_erases"))
+    {
+        *err = "no report from dspic-sim";
+        return false;
+    }
+    return true;
+}
+
+void Simulator::Stop()
+{
+    if (pid_ > 0)
+    {
+        int status;
+        if (waitpid(pid_, &status, WNOHANG) == 0)
+        {
+            kill(pid_, SIGTERM);
+            waitpid(pid_, &status, 0);
+        }
+        pid_ = -1;
+    }
+    if (out_ >= 0)
+        close(out_);
+    if (errFd_ >= 0)
+        close(errFd_);
+    out_ = errFd_ = -1;
+}
@@ -0,0 +1,37 @@
+// dspic-sim as a child process, for dspic-bench and the tests: started on
+// a pty of its own, stopped by JMP_TO_APP, its statistics read back.
+#ifndef SIMULATOR_H
+#define SIMULATOR_H
+
+#include <map>
+#include <string>
+#include <sys/types.h>
+
+#include "Image.h"
+
+class Simulator
+{
+public:
+    ~Simulator() { Stop(); }
+
+    // dspic-sim at path with --time-scale, --latency-us and --jitter-us,
+    // and --flash unless flash is empty. Pty() is its port then.
+    bool Start(const std::string &path, double timeScale, double latencyMs, double jitterMs,
+               const std::string &flash, std::string *err);
+    // Waits for the simulator to exit and collects its key=value report.
+    bool Finish(std::map<std::string, double> *stats, std::string *err);
+    void Stop();
+
+    const std::string &Pty() const { return pty_; }
+
+private:
+    pid_t pid_ = -1;
+    int out_ = -1;
+    int errFd_ = -1;
+    std::string pty_;
+};
+
+// Main flash contents for dspic-sim --flash, 4 bytes per instruction.
+bool WriteFlashFile(const std::string &path, const Image &image);
+
+#endif
@@ -0,0 +1,143 @@
+#include "Workload.h"
+
+#include <algorithm>
+
+namespace
+{
+
+const uint32_t MAIN_FLASH_END = 0x055800;
+
+// Instructions new in an edit, unlike the vocabulary of Synthesize().
+void Insert(std::vector<uint32_t> &words, size_t at, size_t count, uint32_t seed)
+{
+    std::vector<uint32_t> added(count);
+
+    for (uint32_t &w : added)
+    {
+        seed = seed * 1103515245 + 12345;
+        w = (seed >> 8) & BLANK;
+    }
+    words.insert(words.begin() + std::min(at, words.size()), added.begin(), added.end());
+}
+
+}
+
+// Program code like instructions: a few hundred distinct ones, the
+// frequent ones much more frequent, and now and then a repeated sequence,
+// so that it compresses about as well as compiled code.
+Image Synthesize(unsigned kib)
+{
+    Image image;
+    uint32_t count = std::min<uint32_t>(kib * 1024 / 3, MAIN_FLASH_END / 2);
+    uint32_t state = 12345;
+    std::vector<uint32_t> vocabulary(512);
+
+    auto next = [&state]() {
+        state = state * 1103515245 + 12345;
+        return state >> 8;
+    };
+    for (uint32_t &w : vocabulary)
+        w = next() & BLANK;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t r = next();
+        if ((r & 0x1F) == 0 && i > 64)
+        {
+            // Repeat a short sequence from a little while ago.
+            uint32_t back = 8 + (r >> 5) % 56;
+            uint32_t len = 4 + (r >> 11) % 12;
+            for (uint32_t j = 0; j < len && i < count; j++, i++)
+                image.Set(2 * i, image.Word(2 * (i - back)));
+            i--;
+            continue;
+        }
+        // Square of a uniform number: small indices dominate.
+        uint32_t u = r & 0x1FF;
+        image.Set(2 * i, vocabulary[(u * u) >> 9]);
+    }
+    return image;
+}
+
+Image Previous(const Image &image)
+{
+    Image base;
+    uint32_t cut = (image.Size() * 3 / 4) * 2;
+    const uint32_t shift = 8 * 2;
+
+    for (const auto &w : image.Words())
+    {
+        if (w.first < cut)
+            base.Set(w.first, w.second);
+        else if (w.first >= cut + shift)
+            base.Set(w.first - shift, w.second);
+    }
+    return base;
+}
+
+Image Gaps(const Image &image, unsigned pageSize)
+{
+    Image out;
+
+    for (const auto &w : image.Words())
+    {
+        if ((w.first / pageSize) % 2 == 0)
+            out.Set(w.first, w.second);
+    }
+    return out;
+}
+
+const std::vector<std::string> &EditKinds()
+{
+    static const std::vector<std::string> kinds = {"insert", "modify", "delete", "append", "shift"};
+    return kinds;
+}
+
+// insert   8 instructions at 3/4, the rest moves up (Previous() undone)
+// modify   the low byte of 16 instructions spread over the image, as
+//          changed constants
+// delete   8 instructions at 1/2, the rest moves down
+// append   256 instructions after the end
+// shift    64 instructions at 1/16, nearly every page moves
+Image Edited(const Image &base, const std::string &kind)
+{
+    Image image;
+    std::vector<uint32_t> words;
+
+    if (base.Empty())
+        return image;
+    for (const auto &w : base.Words())
+        words.push_back(w.second);
+    size_t n = words.size();
+
+    if (kind == "insert")
+    {
+        Insert(words, n * 3 / 4, 8, 1);
+    }
+    else if (kind == "modify")
+    {
+        for (size_t i = 0; i < 16; i++)
+            words[n / 32 + i * (n / 16)] ^= 0x00005A;
+    }
+    else if (kind == "delete")
+    {
+        words.erase(words.begin() + n / 2, words.begin() + std::min(n, n / 2 + 8));
+    }
+    else if (kind == "append")
+    {
+        Insert(words, n, 256, 2);
+    }
+    else if (kind == "shift")
+    {
+        Insert(words, n / 16, 64, 3);
+    }
+    else
+    {
+        return image;
+    }
+
+    uint32_t address = base.Words().begin()->first;
+    for (size_t i = 0; i < words.size() && address + 2 * i < MAIN_FLASH_END; i++)
+        image.Set(address + 2 * (uint32_t)i, words[i]);
+    return image;
+}
@@ -0,0 +1,30 @@
+// Synthetic images for dspic-bench, patch-bench and the tests: code like
+// instructions, and the changes a new build makes to them.
+#ifndef WORKLOAD_H
+#define WORKLOAD_H
+
+#include <string>
+#include <vector>
+
+#include "Image.h"
+
+// kib KiB of hex data (3 bytes per instruction, phantom bytes dropped) from
+// program address 0, at most all of main flash.
+Image Synthesize(unsigned kib);
+
+// The image as it was before a change: the 8 instructions at 3/4 of it
+// did not exist and everything after them sat 8 instructions lower.
+Image Previous(const Image &image);
+
+// image without every other page (the odd ones), for images in many
+// separate pieces.
+Image Gaps(const Image &image, unsigned pageSize);
+
+// insert, modify, delete, append and shift, see Edited().
+const std::vector<std::string> &EditKinds();
+
+// base, contiguous, after one edit of the given kind. Empty for an unknown
+// kind.
+Image Edited(const Image &base, const std::string &kind);
+
+#endif
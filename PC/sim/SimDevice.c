@@ -0,0 +1,473 @@
+/* SimDevice.c
+ * Description:
+ *
+ * Program memory, NVM controller, UART1, Timer2 and interrupt model of
+ * the simulator, see SimDevice.h.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "system.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+// Latches of a double-word write (TBLPAG 0xFA).
+#define SIM_LATCH_PAGE          0xFA
+
+// NVMCON accesses after the unlock sequence that still read WR set.
+#define SIM_WR_POLLS            3
+
+// UART1 receive FIFO of the model. Holds what the host sent and the
+// interrupt did not take yet, larger than the 4 levels of the hardware.
+#define SIM_UART_FIFO_SIZE      65536
+#define SIM_UART_TX_SIZE        16384
+
+volatile UINT16 NVMADR, NVMADRU, TBLPAG;
+volatile UINT16 INTCON2, IFS0, IEC0, INTTREG;
+volatile UINT16 U1STA, U1BRG, TMR2;
+
+// Datasheet program memory characteristics: page erase TPE and
+// double-word write TWW. Bulk erase is not specified, taken as a page erase.
+T_SIM_TIMING SimTiming = {20100000, 47400, 20100000, 1.0};
+T_SIM_FLASH_STATS SimFlashStats;
+
+static UINT32 MainFlash[SIM_MAIN_FLASH_END / 2];
+static UINT32 AuxFlash[(SIM_AUX_FLASH_END - SIM_AUX_FLASH_BASE) / 2];
+static UINT32 ConfigMem[(SIM_CONFIG_END - SIM_CONFIG_BASE) / 2];
+static UINT32 DevId[(SIM_DEV_ID_END - SIM_DEV_ID_BASE) / 2];
+static UINT32 Latch[2];
+static volatile UINT16 nvmcon;
+static UINT wr_polls;
+
+// The model's own accesses, which do not count as polls.
+#define NVMCON_REG              (*(volatile NVMCONBITS *)&nvmcon)
+
+static UINT8 RxFifo[SIM_UART_FIFO_SIZE];
+static UINT rx_head, rx_tail;
+static UINT8 TxCapture[SIM_UART_TX_SIZE];
+static UINT tx_len;
+
+static struct timespec timer_last;
+
+static void simBusy(UINT32 ns);
+
+/********************************************************************
+* Function:     simReset()
+*
+* Input:        Instruction main flash is filled with, SIM_BLANK for an
+*               erased part.
+*
+* Overview:     Power on state: aux flash and configuration words
+*               erased, UART idle and interrupts enabled.
+********************************************************************/
+void simReset(UINT32 fill)
+{
+    UINT i;
+
+    for(i = 0; i < sizeof(MainFlash)/sizeof(MainFlash[0]); i++)
+        MainFlash[i] = fill & SIM_BLANK;
+    for(i = 0; i < sizeof(AuxFlash)/sizeof(AuxFlash[0]); i++)
+        AuxFlash[i] = SIM_BLANK;
+    for(i = 0; i < sizeof(ConfigMem)/sizeof(ConfigMem[0]); i++)
+        ConfigMem[i] = SIM_BLANK;
+    // No real device ID, the boot loader only passes it on.
+    DevId[0] = 0;
+    DevId[1] = 0;
+
+    memset(&SimFlashStats, 0, sizeof(SimFlashStats));
+    nvmcon = 0;
+    wr_polls = 0;
+    INTCON2 = 0;
+    INTCON2bits.GIE = 1;
+    IFS0 = 0;
+    IEC0 = 0;
+    U1STA = 0;
+    U1STAbits.TRMT = 1;
+    rx_head = rx_tail = 0;
+    tx_len = 0;
+    clock_gettime(CLOCK_MONOTONIC, &timer_last);
+}
+
+/********************************************************************
+* Function:     simProgWord()
+*
+* Output:       Instruction at progAddress (even), NULL where nothing is
+*               implemented.
+********************************************************************/
+UINT32 *simProgWord(UINT32 progAddress)
+{
+    UINT32 i = progAddress / 2;
+
+    if(progAddress < SIM_MAIN_FLASH_END)
+        return &MainFlash[i];
+    if((progAddress >= SIM_AUX_FLASH_BASE) && (progAddress < SIM_AUX_FLASH_END))
+        return &AuxFlash[i - SIM_AUX_FLASH_BASE/2];
+    if((progAddress >= SIM_CONFIG_BASE) && (progAddress < SIM_CONFIG_END))
+        return &ConfigMem[i - SIM_CONFIG_BASE/2];
+    if((progAddress >= SIM_DEV_ID_BASE) && (progAddress < SIM_DEV_ID_END))
+        return &DevId[i - SIM_DEV_ID_BASE/2];
+    return NULL;
+}
+
+/********************************************************************
+* Function:     simLoadFlash(), simSaveFlash()
+*
+* Overview:     Main flash to/from a file, 4 bytes per instruction
+*               (LSB first), so it survives from one run to the next.
+********************************************************************/
+BOOL simLoadFlash(const char *path)
+{
+    FILE *f = fopen(path, "rb");
+    UINT8 b[4];
+    UINT i;
+
+    if(f == NULL)
+        return FALSE;
+    for(i = 0; i < sizeof(MainFlash)/sizeof(MainFlash[0]); i++)
+    {
+        if(fread(b, 1, 4, f) != 4)
+            break;
+        MainFlash[i] = b[0] | ((UINT32)b[1] << 8) | ((UINT32)b[2] << 16);
+    }
+    fclose(f);
+    return TRUE;
+}
+
+BOOL simSaveFlash(const char *path)
+{
+    FILE *f = fopen(path, "wb");
+    UINT8 b[4];
+    UINT i;
+
+    if(f == NULL)
+        return FALSE;
+    for(i = 0; i < sizeof(MainFlash)/sizeof(MainFlash[0]); i++)
+    {
+        b[0] = (UINT8)MainFlash[i];
+        b[1] = (UINT8)(MainFlash[i] >> 8);
+        b[2] = (UINT8)(MainFlash[i] >> 16);
+        b[3] = 0;
+        fwrite(b, 1, 4, f);
+    }
+    return fclose(f) == 0;
+}
+
+/********************************************************************
+* Function:     simTblRead...(), simTblWrite...()
+*
+* Overview:     TBLRDL/TBLRDH read program memory at TBLPAG:offset,
+*               unimplemented memory reads 0. TBLWTL/TBLWTH only reach
+*               the write latches.
+********************************************************************/
+UINT16 simTblReadLow(UINT16 offset)
+{
+    UINT32 *w = simProgWord(((UINT32)TBLPAG << 16) | (offset & 0xFFFE));
+
+    return w ? (UINT16)*w : 0;
+}
+
+UINT16 simTblReadHigh(UINT16 offset)
+{
+    UINT32 *w = simProgWord(((UINT32)TBLPAG << 16) | (offset & 0xFFFE));
+
+    return w ? (UINT16)((*w >> 16) & 0xFF) : 0;
+}
+
+void simTblWriteLow(UINT16 offset, UINT16 data)
+{
+    UINT i = (offset >> 1) & 1;
+
+    if(TBLPAG == SIM_LATCH_PAGE)
+        Latch[i] = (Latch[i] & 0xFF0000) | data;
+}
+
+void simTblWriteHigh(UINT16 offset, UINT16 data)
+{
+    UINT i = (offset >> 1) & 1;
+
+    if(TBLPAG == SIM_LATCH_PAGE)
+        Latch[i] = (Latch[i] & 0x00FFFF) | ((UINT32)(data & 0xFF) << 16);
+}
+
+/********************************************************************
+* Function:     simWriteNVM()
+*
+* Overview:     Unlock sequence and WR: executes the operation NVMCON
+*               selects at NVMADRU:NVMADR. WRERR tells whether the
+*               operation was valid, WR stays set for the next
+*               SIM_WR_POLLS accesses to NVMCON. The sequence must run
+*               with interrupts disabled and after the previous
+*               operation completed, the model counts where it did not.
+********************************************************************/
+void simWriteNVM(void)
+{
+    UINT32 address = ((UINT32)NVMADRU << 16) | NVMADR;
+    UINT32 *w;
+    UINT i;
+
+    if(INTCON2bits.GIE)
+        SimFlashStats.InterruptUnlocks++;
+    if(wr_polls)
+        SimFlashStats.BusyStarts++;
+
+    NVMCON_REG.WRERR = 0;
+    if(!NVMCON_REG.WREN)
+        return;
+
+    switch(NVMCON_REG.NVMOP)
+    {
+        case 0x1:   // Double-word program.
+            address &= ~3ul;
+            for(i = 0; i < 2; i++)
+            {
+                w = simProgWord(address + 2*i);
+                if((w == NULL) || (address >= SIM_MAIN_FLASH_END))
+                {
+                    // Only main flash is writable, the boot loader lives in aux flash.
+                    SimFlashStats.ProgramErrors++;
+                    NVMCON_REG.WRERR = 1;
+                    continue;
+                }
+                if((*w != SIM_BLANK) && (Latch[i] != SIM_BLANK))
+                    SimFlashStats.ProgramErrors++;
+                *w &= Latch[i];
+            }
+            SimFlashStats.DoubleWordWrites++;
+            simBusy(SimTiming.DoubleWordNs);
+            break;
+
+        case 0x3:   // Page erase.
+            address &= ~(UINT32)(SIM_PAGE_SIZE - 1);
+            if(address >= SIM_MAIN_FLASH_END)
+            {
+                SimFlashStats.ProgramErrors++;
+                NVMCON_REG.WRERR = 1;
+                break;
+            }
+            for(i = 0; i < SIM_PAGE_SIZE/2; i++)
+                MainFlash[address/2 + i] = SIM_BLANK;
+            SimFlashStats.PageErases++;
+            simBusy(SimTiming.PageEraseNs);
+            break;
+
+        case 0xD:   // Bulk erase of main flash.
+            for(i = 0; i < sizeof(MainFlash)/sizeof(MainFlash[0]); i++)
+                MainFlash[i] = SIM_BLANK;
+            SimFlashStats.BulkErases++;
+            simBusy(SimTiming.BulkEraseNs);
+            break;
+
+        default:
+            NVMCON_REG.WRERR = 1;
+            break;
+    }
+    NVMCON_REG.WR = 1;
+    wr_polls = SIM_WR_POLLS;
+}
+
+/********************************************************************
+* Function:     simNvmcon()
+*
+* Output:       Where an access to NVMCON goes. WR clears on the last
+*               of the accesses simWriteNVM() allows for the operation.
+********************************************************************/
+volatile UINT16 *simNvmcon(void)
+{
+    if(wr_polls && (--wr_polls == 0))
+        NVMCON_REG.WR = 0;
+    return &nvmcon;
+}
+
+/********************************************************************
+* Function:     simBusy()
+*
+* Overview:     Flash is busy for ns of modeled time. The waits run
+*               against a deadline carried from one operation to the
+*               next, a sleep per 47us double word would overshoot each
+*               time by the timer slack.
+********************************************************************/
+static void simBusy(UINT32 ns)
+{
+    static UINT64 busy_until;
+    struct timespec t;
+    UINT64 now;
+
+    SimFlashStats.BusyNs += ns;
+    if(SimTiming.Scale <= 0)
+        return;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    now = (UINT64)t.tv_sec * 1000000000ull + t.tv_nsec;
+    if(busy_until < now)
+        busy_until = now;
+    busy_until += (UINT64)(ns * SimTiming.Scale);
+    if(busy_until - now < 1000000)
+        return;                         // sleep once the debt is worth it
+
+    // Programming runs from aux flash, so the UART interrupt goes on
+    // meanwhile and responses still go out.
+    t.tv_sec = (time_t)(busy_until / 1000000000ull);
+    t.tv_nsec = (long)(busy_until % 1000000000ull);
+    while(clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) != 0)
+        simService();
+}
+
+/********************************************************************
+* Function:     simUartReceive()
+*
+* Overview:     Bytes from the host arrive at the UART1 receiver.
+********************************************************************/
+void simUartReceive(const UINT8 *data, UINT len)
+{
+    while(len--)
+    {
+        if(((rx_head + 1) % SIM_UART_FIFO_SIZE) == rx_tail)
+        {
+            U1STAbits.OERR = 1;
+            break;
+        }
+        RxFifo[rx_head] = *data++;
+        rx_head = (rx_head + 1) % SIM_UART_FIFO_SIZE;
+    }
+    if(rx_head != rx_tail)
+    {
+        U1STAbits.URXDA = 1;
+        IFS0bits.U1RXIF = 1;
+    }
+}
+
+UINT simUartRxRoom(void)
+{
+    return SIM_UART_FIFO_SIZE - 1 - (rx_head - rx_tail + SIM_UART_FIFO_SIZE) % SIM_UART_FIFO_SIZE;
+}
+
+UINT8 simUartRead(void)
+{
+    UINT8 b = 0;
+
+    if(rx_head != rx_tail)
+    {
+        b = RxFifo[rx_tail];
+        rx_tail = (rx_tail + 1) % SIM_UART_FIFO_SIZE;
+    }
+    U1STAbits.URXDA = (rx_head != rx_tail);
+    return b;
+}
+
+/********************************************************************
+* Function:     simUartWrite()
+*
+* Overview:     Where a write to U1TXREG goes: the next byte of the
+*               transmit capture. The transmitter never fills up.
+********************************************************************/
+volatile UINT8 *simUartWrite(void)
+{
+    static volatile UINT8 overflow;
+
+    if(tx_len < SIM_UART_TX_SIZE)
+        return &TxCapture[tx_len++];
+    return &overflow;
+}
+
+/********************************************************************
+* Function:     simUartTransmit()
+*
+* Output:       Number of bytes transmitted since the last call, copied
+*               to data.
+********************************************************************/
+UINT simUartTransmit(UINT8 *data, UINT maxLen)
+{
+    UINT len = (tx_len < maxLen) ? tx_len : maxLen;
+
+    memcpy(data, TxCapture, len);
+    memmove(TxCapture, TxCapture + len, tx_len - len);
+    tx_len -= len;
+    return len;
+}
+
+/********************************************************************
+* Function:     simUartBaud()
+*
+* Output:       Baud rate U1BRG selects, BRGH = 1.
+********************************************************************/
+UINT32 simUartBaud(void)
+{
+    return (UINT32)(SYS_FCY / (4ul * (U1BRG + 1)));
+}
+
+/********************************************************************
+* Function:     simTimerTick()
+*
+* Overview:     Timer2 runs from Fcy/256 and wraps at 0xFFFF (PR2),
+*               setting T2IF, as init.c sets it up.
+********************************************************************/
+void simTimerTick(void)
+{
+    struct timespec now;
+    UINT64 ns;
+    UINT64 ticks;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    ns = (UINT64)(now.tv_sec - timer_last.tv_sec) * 1000000000ull + now.tv_nsec - timer_last.tv_nsec;
+    ticks = ns * (SYS_FCY / 256) / 1000000000ull;
+    if(ticks == 0)
+        return;
+
+    // Keep the remainder for the next tick.
+    ns = ticks * 1000000000ull / (SYS_FCY / 256);
+    timer_last.tv_sec += ns / 1000000000ull;
+    timer_last.tv_nsec += ns % 1000000000ull;
+    if(timer_last.tv_nsec >= 1000000000l)
+    {
+        timer_last.tv_sec++;
+        timer_last.tv_nsec -= 1000000000l;
+    }
+
+    ticks += TMR2;
+    if(ticks > 0xFFFF)
+        IFS0bits.T2IF = 1;
+    TMR2 = (UINT16)ticks;
+}
+
+/********************************************************************
+* Function:     simInterrupts()
+*
+* Overview:     The single interrupt vector of the aux flash, taken
+*               while an enabled UART1 interrupt is pending. Called from
+*               the tick signal, so it preempts the firmware anywhere
+*               outside disableInterrupts() as the hardware would.
+********************************************************************/
+void simInterrupts(void)
+{
+    // The transmitter always has room. Flags the firmware cleared with
+    // a read-modify-write around a tick are raised again here.
+    IFS0bits.U1TXIF = 1;
+    if(rx_head != rx_tail)
+        IFS0bits.U1RXIF = 1;
+
+    while(INTCON2bits.GIE &&
+          ((IFS0bits.U1RXIF && IEC0bits.U1RXIE) || (IFS0bits.U1TXIF && IEC0bits.U1TXIE)))
+    {
+        // Vector number, IRQ + 8, of the one taken: receive goes first.
+        INTTREGbits.VECNUM = (IFS0bits.U1RXIF && IEC0bits.U1RXIE) ? 8 + 11 : 8 + 12;
+        _DefaultInterrupt();
+        if(rx_head != rx_tail)
+            IFS0bits.U1RXIF = 1;
+    }
+}
+
+/********************************************************************
+* Function:     simDeviceReset()
+*
+* Overview:     The firmware gave up, as after an unexpected interrupt.
+*               A real device would restart the boot loader, the
+*               simulator reports it and exits.
+********************************************************************/
+void simDeviceReset(void)
+{
+    fprintf(stderr, "dspic-sim: reset instruction executed\n");
+    exit(1);
+}
@@ -0,0 +1,163 @@
+/* SimDevice.h
+ * Description:
+ *
+ * Model of the dsPIC33EP512MC806 as far as the boot loader sources use it,
+ * so that Framework.c, NVMem.c, Uart.c and Patch.c build and run on the PC.
+ * system.h includes it instead of the device header when SIMULATOR is
+ * defined, and maps the table and NVM built-ins to the sim...() functions
+ * below.
+ *
+ *  - SFRs are plain variables. Those with side effects on access are
+ *    macros calling into the model (NVMCON, U1RXREG and U1TXREG).
+ *  - Program memory holds 24-bit instructions: main flash, aux flash,
+ *    configuration words and the device ID. Erase sets a page to
+ *    0xFFFFFF, programming can only clear bits, and programming a word
+ *    that is not erased is counted as an error.
+ *  - Every NVM operation costs its configured time. The model waits for
+ *    it (scaled, or not at all) and adds it up. WR reads back set for a
+ *    few NVMCON accesses after the unlock sequence, so code that does not
+ *    poll it before the next operation is caught.
+ */
+
+#ifndef __SIM_DEVICE_H__
+#define __SIM_DEVICE_H__
+
+#include "GenericTypeDefs.h"
+
+/** SFRs ***********************************************************/
+typedef struct
+{
+    unsigned short NVMOP:4;
+    unsigned short :8;
+    unsigned short NVMSIDL:1;
+    unsigned short WRERR:1;
+    unsigned short WREN:1;
+    unsigned short WR:1;
+} NVMCONBITS;
+
+typedef struct
+{
+    unsigned short :15;
+    unsigned short GIE:1;
+} INTCON2BITS;
+
+typedef struct
+{
+    unsigned short :7;
+    unsigned short T2IF:1;
+    unsigned short :3;
+    unsigned short U1RXIF:1;
+    unsigned short U1TXIF:1;
+    unsigned short :3;
+} IFS0BITS;
+
+typedef struct
+{
+    unsigned short :11;
+    unsigned short U1RXIE:1;
+    unsigned short U1TXIE:1;
+    unsigned short :3;
+} IEC0BITS;
+
+typedef struct
+{
+    unsigned short VECNUM:8;
+    unsigned short ILR:4;
+    unsigned short :4;
+} INTTREGBITS;
+
+typedef struct
+{
+    unsigned short URXDA:1;
+    unsigned short OERR:1;
+    unsigned short :6;
+    unsigned short TRMT:1;
+    unsigned short UTXBF:1;
+    unsigned short :6;
+} U1STABITS;
+
+extern volatile UINT16 NVMADR, NVMADRU, TBLPAG;
+extern volatile UINT16 INTCON2, IFS0, IEC0, INTTREG;
+extern volatile UINT16 U1STA, U1BRG, TMR2;
+
+// Each access to NVMCON counts as a poll of WR, see simNvmcon().
+#define NVMCON          (*simNvmcon())
+#define NVMCONbits      (*(volatile NVMCONBITS *)simNvmcon())
+#define INTCON2bits     (*(volatile INTCON2BITS *)&INTCON2)
+#define IFS0bits        (*(volatile IFS0BITS *)&IFS0)
+#define IEC0bits        (*(volatile IEC0BITS *)&IEC0)
+#define INTTREGbits     (*(volatile INTTREGBITS *)&INTTREG)
+#define U1STAbits       (*(volatile U1STABITS *)&U1STA)
+
+// Reading U1RXREG takes a byte out of the receive FIFO, writing U1TXREG
+// puts one into the transmit capture.
+#define U1RXREG         simUartRead()
+#define U1TXREG         (*simUartWrite())
+
+/** Program memory *************************************************/
+#define SIM_MAIN_FLASH_END      0x055800
+#define SIM_PAGE_SIZE           0x800       // Program addresses.
+#define SIM_AUX_FLASH_BASE      0x7FC000
+#define SIM_AUX_FLASH_END       0x800000
+#define SIM_CONFIG_BASE         0xF80000
+#define SIM_CONFIG_END          0xF80014
+#define SIM_DEV_ID_BASE         0xFF0000
+#define SIM_DEV_ID_END          0xFF0004
+#define SIM_BLANK               0xFFFFFFul
+
+// Duration of the NVM operations in ns.
+typedef struct
+{
+    UINT32 PageEraseNs;
+    UINT32 DoubleWordNs;
+    UINT32 BulkEraseNs;
+    double Scale;               // Wall time per modeled time, 0: no waiting.
+}T_SIM_TIMING;
+
+typedef struct
+{
+    UINT32 PageErases;
+    UINT32 BulkErases;
+    UINT32 DoubleWordWrites;
+    UINT32 ProgramErrors;       // Programmed without erase, or out of range.
+    UINT32 InterruptUnlocks;    // Unlock sequences run with GIE set.
+    UINT32 BusyStarts;          // Operations started while WR was still set.
+    UINT64 BusyNs;              // Modeled time flash was busy.
+}T_SIM_FLASH_STATS;
+
+extern T_SIM_TIMING SimTiming;
+extern T_SIM_FLASH_STATS SimFlashStats;
+
+void simReset(UINT32 fill);
+UINT32 *simProgWord(UINT32 progAddress);
+BOOL simLoadFlash(const char *path);
+BOOL simSaveFlash(const char *path);
+
+UINT16 simTblReadLow(UINT16 offset);
+UINT16 simTblReadHigh(UINT16 offset);
+void simTblWriteLow(UINT16 offset, UINT16 data);
+void simTblWriteHigh(UINT16 offset, UINT16 data);
+void simWriteNVM(void);
+volatile UINT16 *simNvmcon(void);
+
+/** UART1, Timer2 and the interrupt ******************************/
+void simUartReceive(const UINT8 *data, UINT len);
+UINT simUartRxRoom(void);
+UINT8 simUartRead(void);
+volatile UINT8 *simUartWrite(void);
+UINT simUartTransmit(UINT8 *data, UINT maxLen);
+UINT32 simUartBaud(void);
+
+void simTimerTick(void);
+void simInterrupts(void);
+// The reset instruction: ends the simulator with an error.
+void simDeviceReset(void);
+
+// SimMain.c: moves bytes between the pty and the UART.
+void simService(void);
+
+// Boot loader functions the simulator calls or stands in for.
+void _DefaultInterrupt(void);
+void blinkLEDs(void);
+
+#endif
@@ -0,0 +1,211 @@
+/* SimLink.c
+ * Description:
+ *
+ * Baud rate, latency and jitter of the simulated serial link, see
+ * SimLink.h. Each direction is a byte ring plus the chunks in it, a chunk
+ * being what one read() from the host or one pass of the main loop
+ * brought in, with the time it reaches the other end.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "system.h"
+#include "SimLink.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#define SIM_LINK_SIZE           65536       // Bytes, power of 2.
+#define SIM_LINK_CHUNKS         1024        // Power of 2.
+#define SIM_LINK_BITS           10          // Start, 8 data, stop.
+
+typedef struct
+{
+    UINT64 End;                 // Byte count after the chunk.
+    UINT64 Due;                 // Arrival at the other end, ns.
+}T_CHUNK;
+
+typedef struct
+{
+    UINT8 Data[SIM_LINK_SIZE];
+    T_CHUNK Chunk[SIM_LINK_CHUNKS];
+    UINT64 In, Out;             // Byte counts.
+    UINT ChunkIn, ChunkOut;
+    UINT64 LastDue;
+    UINT64 Wire;                // Time the wire is free again, ns.
+    unsigned int Seed;
+}T_LINK;
+
+T_SIM_LINK_CONFIG SimLinkConfig = {0, 0, 1};
+T_SIM_LINK_STATS SimLinkStats;
+
+// Host to boot loader is only touched by the tick, the other direction
+// only by the main loop.
+static T_LINK RxLink, TxLink;
+
+static UINT64 linkNow(void)
+{
+    struct timespec t;
+
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (UINT64)t.tv_sec * 1000000000ull + t.tv_nsec;
+}
+
+static UINT64 linkByteNs(void)
+{
+    return SIM_LINK_BITS * 1000000000ull / simUartBaud();
+}
+
+/********************************************************************
+* Function:     linkPush()
+*
+* Overview:     Queues len bytes leaving at time sent, they arrive after
+*               the latency and jitter, never before those queued earlier.
+********************************************************************/
+static void linkPush(T_LINK *link, const UINT8 *data, UINT len, UINT64 sent)
+{
+    T_CHUNK *c;
+    UINT64 due;
+
+    if(link->Seed == 0)
+        link->Seed = SimLinkConfig.Seed + (link == &TxLink);
+
+    due = sent + SimLinkConfig.LatencyNs;
+    if(SimLinkConfig.JitterNs)
+        due += ((UINT64)rand_r(&link->Seed) * (SimLinkConfig.JitterNs + 1ull)) / ((UINT64)RAND_MAX + 1);
+    if(due < link->LastDue)
+        due = link->LastDue;
+    link->LastDue = due;
+
+    while(len--)
+        link->Data[link->In++ & (SIM_LINK_SIZE - 1)] = *data++;
+    c = &link->Chunk[link->ChunkIn++ & (SIM_LINK_CHUNKS - 1)];
+    c->End = link->In;
+    c->Due = due;
+}
+
+// Room for another chunk of up to max bytes.
+static UINT linkRoom(const T_LINK *link, UINT max)
+{
+    UINT room = SIM_LINK_SIZE - (UINT)(link->In - link->Out);
+
+    if(link->ChunkIn - link->ChunkOut >= SIM_LINK_CHUNKS)
+        return 0;
+    return (room < max) ? room : max;
+}
+
+// First chunk not completely taken out, NULL when empty.
+static T_CHUNK *linkHead(T_LINK *link)
+{
+    T_CHUNK *c;
+
+    while(link->ChunkOut != link->ChunkIn)
+    {
+        c = &link->Chunk[link->ChunkOut & (SIM_LINK_CHUNKS - 1)];
+        if(c->End > link->Out)
+            return c;
+        link->ChunkOut++;
+    }
+    return NULL;
+}
+
+/********************************************************************
+* Function:     simLinkFromHost()
+*
+* Overview:     The host side of the link is the pty, the latency runs
+*               from the time the chunk is read, then the bytes come in
+*               one by one at the baud rate.
+********************************************************************/
+void simLinkFromHost(int fd)
+{
+    UINT8 buf[1024];
+    UINT64 now = linkNow();
+    UINT64 byteNs = linkByteNs();
+    UINT64 start;
+    T_CHUNK *c;
+    UINT room, n, i;
+    ssize_t len;
+
+    room = linkRoom(&RxLink, sizeof(buf));
+    if(room && (len = read(fd, buf, room)) > 0)
+    {
+        linkPush(&RxLink, buf, (UINT)len, now);
+        SimLinkStats.RxChunks++;
+    }
+
+    while((c = linkHead(&RxLink)) != NULL && (c->Due <= now))
+    {
+        start = (RxLink.Wire > c->Due) ? RxLink.Wire : c->Due;
+        if(start + byteNs > now)
+            break;
+        n = (UINT)((now - start) / byteNs);
+        if(n > c->End - RxLink.Out)
+            n = (UINT)(c->End - RxLink.Out);
+        room = simUartRxRoom();
+        if(n > room)
+            n = room;
+        if(n > sizeof(buf))
+            n = sizeof(buf);
+        if(n == 0)
+            break;
+
+        for(i = 0; i < n; i++)
+            buf[i] = RxLink.Data[RxLink.Out++ & (SIM_LINK_SIZE - 1)];
+        simUartReceive(buf, n);
+        RxLink.Wire = start + n * byteNs;
+        SimLinkStats.RxBytes += n;
+        SimLinkStats.RxBusyNs += n * byteNs;
+    }
+}
+
+/********************************************************************
+* Function:     simLinkToHost()
+*
+* Overview:     What the UART transmitted since the last call leaves at
+*               the baud rate, after the bytes still on the wire. The
+*               tick is blocked while taking it, it could be in the
+*               middle of transmitting.
+********************************************************************/
+BOOL simLinkToHost(int fd)
+{
+    UINT8 buf[4096];
+    UINT64 now = linkNow();
+    sigset_t set, old;
+    T_CHUNK *c;
+    UINT room, len;
+    ssize_t n;
+
+    room = linkRoom(&TxLink, sizeof(buf));
+    sigemptyset(&set);
+    sigaddset(&set, SIGALRM);
+    sigprocmask(SIG_BLOCK, &set, &old);
+    len = room ? simUartTransmit(buf, room) : 0;
+    sigprocmask(SIG_SETMASK, &old, NULL);
+
+    if(len)
+    {
+        if(TxLink.Wire < now)
+            TxLink.Wire = now;
+        TxLink.Wire += len * linkByteNs();
+        SimLinkStats.TxBytes += len;
+        SimLinkStats.TxBusyNs += len * linkByteNs();
+        SimLinkStats.TxChunks++;
+        // A chunk arrives once its last byte is out.
+        linkPush(&TxLink, buf, len, TxLink.Wire);
+    }
+
+    while((c = linkHead(&TxLink)) != NULL && (c->Due <= now))
+    {
+        for(len = 0; (TxLink.Out + len < c->End) && (len < sizeof(buf)); len++)
+            buf[len] = TxLink.Data[(TxLink.Out + len) & (SIM_LINK_SIZE - 1)];
+        n = write(fd, buf, len);
+        if(n <= 0)
+            break;                      // host not reading, try again later
+        TxLink.Out += n;
+    }
+
+    return TxLink.Out != TxLink.In;
+}
@@ -0,0 +1,45 @@
+/* SimLink.h
+ * Description:
+ *
+ * The serial link between the host and UART1 of the simulator. Bytes go
+ * over it at the baud rate U1BRG selects, 10 bits each, so CHANGE_BAUD
+ * speeds the transfer up as on a board. Every chunk the host writes (a
+ * frame, as dspic-flash writes them) and every burst of responses is
+ * delayed by a fixed latency plus a random jitter, like a Bluetooth SPP
+ * or USB adapter in the path would. The link never reorders bytes.
+ */
+
+#ifndef __SIM_LINK_H__
+#define __SIM_LINK_H__
+
+#include "GenericTypeDefs.h"
+
+typedef struct
+{
+    UINT32 LatencyNs;           // Per chunk, each direction.
+    UINT32 JitterNs;            // Uniform 0..JitterNs on top.
+    UINT32 Seed;
+}T_SIM_LINK_CONFIG;
+
+typedef struct
+{
+    UINT64 RxBytes;             // Host to boot loader.
+    UINT64 TxBytes;
+    UINT64 RxBusyNs;            // Time the wire was busy with them.
+    UINT64 TxBusyNs;
+    UINT32 RxChunks;
+    UINT32 TxChunks;
+}T_SIM_LINK_STATS;
+
+extern T_SIM_LINK_CONFIG SimLinkConfig;
+extern T_SIM_LINK_STATS SimLinkStats;
+
+// Tick: reads what the host wrote from fd and feeds the UART what has
+// arrived by now.
+void simLinkFromHost(int fd);
+
+// Main loop: takes what the UART transmitted and writes what has
+// arrived by now to fd. Returns TRUE while bytes are still on the way.
+BOOL simLinkToHost(int fd);
+
+#endif
@@ -0,0 +1,217 @@
+/* SimMain.c
+ * Description:
+ *
+ * dspic-sim: runs the boot loader (Framework.c, NVMem.c, Uart.c and
+ * Patch.c, built for the PC) against the device model of SimDevice.c, on
+ * a pseudo terminal. The host tools connect to the pty path it prints as
+ * if it was the serial port of a board.
+ *
+ * A periodic signal stands in for the hardware: it moves received bytes
+ * over the link (SimLink.c) into the UART, advances Timer2 and takes the
+ * UART interrupt. The main loop is the one of BootLoader.c.
+ */
+
+#define _GNU_SOURCE
+
+#include "system.h"
+#include "Framework.h"
+#include "Uart.h"
+#include "SimLink.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <pty.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+// Interrupt tick, us.
+#define SIM_TICK_US             100
+
+static int master_fd = -1;
+static volatile sig_atomic_t stop;
+
+/********************************************************************
+* Function:     tick()
+*
+* Overview:     SIGALRM handler: what the peripherals do between two
+*               ticks, then the interrupt.
+********************************************************************/
+static void tick(int sig)
+{
+    int saved = errno;
+
+    (void)sig;
+    simLinkFromHost(master_fd);
+    simTimerTick();
+    simInterrupts();
+    errno = saved;
+}
+
+static void quit(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+/********************************************************************
+* Function:     simService()
+*
+* Overview:     Sends what the UART transmitted over the link. Runs in
+*               the main loop and while flash is busy, never from the
+*               tick, which could preempt the firmware in the middle of
+*               a U1TXREG write.
+********************************************************************/
+void simService(void)
+{
+    (void)simLinkToHost(master_fd);
+}
+
+/********************************************************************
+* Function:     blinkLEDs()
+*
+* Overview:     BootLoader.c is not part of the simulator, no LEDs.
+********************************************************************/
+void blinkLEDs(void)
+{
+}
+
+static void usage(void)
+{
+    fprintf(stderr,
+            "usage: dspic-sim [options]\n"
+            "  -f, --flash FILE         main flash contents, loaded at start and saved\n"
+            "                           at exit (4 bytes per instruction)\n"
+            "  -F, --fill HEX           main flash at start without --flash (FFFFFF)\n"
+            "  -E, --page-erase-us N    page erase time (%u)\n"
+            "  -W, --word-write-us N    double-word write time (%.1f)\n"
+            "  -R, --bulk-erase-us N    bulk erase time (%u)\n"
+            "  -s, --time-scale X       wall time per modeled flash time, 0 to not\n"
+            "                           wait at all (1)\n"
+            "  -l, --latency-us N       link latency per chunk and direction (0)\n"
+            "  -j, --jitter-us N        random extra latency, up to N (0)\n"
+            "  -S, --seed N             jitter seed (1)\n"
+            "The link runs at the baud rate the boot loader sets in U1BRG.\n",
+            SimTiming.PageEraseNs / 1000, SimTiming.DoubleWordNs / 1000.0,
+            SimTiming.BulkEraseNs / 1000);
+}
+
+/********************************************************************
+* Function:     main()
+********************************************************************/
+int main(int argc, char **argv)
+{
+    static const struct option longOptions[] = {
+        {"flash", required_argument, NULL, 'f'},
+        {"fill", required_argument, NULL, 'F'},
+        {"page-erase-us", required_argument, NULL, 'E'},
+        {"word-write-us", required_argument, NULL, 'W'},
+        {"bulk-erase-us", required_argument, NULL, 'R'},
+        {"time-scale", required_argument, NULL, 's'},
+        {"latency-us", required_argument, NULL, 'l'},
+        {"jitter-us", required_argument, NULL, 'j'},
+        {"seed", required_argument, NULL, 'S'},
+        {"help", no_argument, NULL, 'h'},
+        {NULL, 0, NULL, 0},
+    };
+    const char *flash = NULL;
+    UINT32 fill = SIM_BLANK;
+    struct termios tio;
+    struct itimerval timer;
+    struct sigaction sa;
+    struct timespec idle = {0, 1000000};
+    int slave_fd;
+    char name[256];
+    int c;
+
+    while((c = getopt_long(argc, argv, "f:F:E:W:R:s:l:j:S:h", longOptions, NULL)) != -1)
+    {
+        switch(c)
+        {
+            case 'f': flash = optarg; break;
+            case 'F': fill = strtoul(optarg, NULL, 16); break;
+            case 'E': SimTiming.PageEraseNs = (UINT32)(atof(optarg) * 1000); break;
+            case 'W': SimTiming.DoubleWordNs = (UINT32)(atof(optarg) * 1000); break;
+            case 'R': SimTiming.BulkEraseNs = (UINT32)(atof(optarg) * 1000); break;
+            case 's': SimTiming.Scale = atof(optarg); break;
+            case 'l': SimLinkConfig.LatencyNs = (UINT32)(atof(optarg) * 1000); break;
+            case 'j': SimLinkConfig.JitterNs = (UINT32)(atof(optarg) * 1000); break;
+            case 'S': SimLinkConfig.Seed = strtoul(optarg, NULL, 0); break;
+            default: usage(); return 2;
+        }
+    }
+
+    simReset(fill);
+    if(flash && !simLoadFlash(flash))
+        fprintf(stderr, "%s not found, starting with blank flash\n", flash);
+
+    if(openpty(&master_fd, &slave_fd, name, NULL, NULL) < 0)
+    {
+        perror("openpty");
+        return 1;
+    }
+    // The slave stays open here too, the master would read EIO whenever
+    // no host has it open.
+    tcgetattr(slave_fd, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(slave_fd, TCSANOW, &tio);
+    fcntl(master_fd, F_SETFL, fcntl(master_fd, F_GETFL) | O_NONBLOCK);
+    printf("%s\n", name);
+    fflush(stdout);
+
+    // What initIO() does for the UART.
+    U1BRG = UART_BOOT_BRG;
+    IEC0bits.U1RXIE = 1;
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = quit;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    sa.sa_handler = tick;
+    sa.sa_flags = SA_RESTART;
+    sigaction(SIGALRM, &sa, NULL);
+    timer.it_interval.tv_sec = 0;
+    timer.it_interval.tv_usec = SIM_TICK_US;
+    timer.it_value = timer.it_interval;
+    setitimer(ITIMER_REAL, &timer, NULL);
+
+    // No application to start and no switches, straight into the loop
+    // of BootLoader.c.
+    while(!stop && !ExitFirmwareUpgradeMode())
+    {
+        uartTask();
+        if(!FrameWorkTask())
+            nanosleep(&idle, NULL);     // the next tick ends it
+        simService();
+    }
+    if(!stop)
+        uartClose();
+    // Let the last responses arrive.
+    while(!stop && simLinkToHost(master_fd))
+        nanosleep(&idle, NULL);
+
+    timer.it_value.tv_usec = 0;
+    timer.it_interval.tv_usec = 0;
+    setitimer(ITIMER_REAL, &timer, NULL);
+
+    fprintf(stderr, "page_erases=%u bulk_erases=%u double_word_writes=%u program_errors=%u "
+            "interrupt_unlocks=%u busy_starts=%u flash_busy_ms=%.1f uart_overruns=%u link_rx_bytes=%llu link_tx_bytes=%llu "
+            "link_rx_busy_ms=%.1f link_tx_busy_ms=%.1f link_rx_chunks=%u link_tx_chunks=%u\n",
+            SimFlashStats.PageErases, SimFlashStats.BulkErases, SimFlashStats.DoubleWordWrites,
+            SimFlashStats.ProgramErrors, SimFlashStats.InterruptUnlocks, SimFlashStats.BusyStarts,
+            SimFlashStats.BusyNs / 1e6, uart_rx_overruns,
+            SimLinkStats.RxBytes, SimLinkStats.TxBytes, SimLinkStats.RxBusyNs / 1e6,
+            SimLinkStats.TxBusyNs / 1e6, SimLinkStats.RxChunks, SimLinkStats.TxChunks);
+    if(flash && !simSaveFlash(flash))
+    {
+        perror(flash);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,31 @@
+#include "Crc16.h"
+
+namespace
+{
+
+struct Table
+{
+    uint16_t v[256];
+
+    Table()
+    {
+        for (unsigned i = 0; i < 256; i++)
+        {
+            uint16_t crc = (uint16_t)(i << 8);
+            for (int bit = 0; bit < 8; bit++)
+                crc = (crc & 0x8000) ? (uint16_t)((crc << 1) ^ 0x1021) : (uint16_t)(crc << 1);
+            v[i] = crc;
+        }
+    }
+};
+
+const Table table;
+
+}
+
+uint16_t Crc16Update(uint16_t crc, const uint8_t *data, size_t len)
+{
+    while (len--)
+        crc = (uint16_t)(table.v[((crc >> 8) ^ *data++) & 0xFF] ^ (crc << 8));
+    return crc;
+}
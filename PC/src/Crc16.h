@@ -0,0 +1,16 @@
+// CRC-CCITT (polynomial 0x1021, initial value 0, MSB first), the CRC the
+// boot loader's CalculateCrc() puts on every frame and READ_CRC returns.
+#ifndef CRC16_H
+#define CRC16_H
+
+#include <cstddef>
+#include <cstdint>
+
+uint16_t Crc16Update(uint16_t crc, const uint8_t *data, size_t len);
+
+inline uint16_t Crc16(const uint8_t *data, size_t len)
+{
+    return Crc16Update(0, data, len);
+}
+
+#endif
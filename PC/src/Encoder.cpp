@@ -0,0 +1,321 @@
+#include "Encoder.h"
+
+#include <algorithm>
+
+#include "Protocol.h"
+
+extern "C"
+{
+#include "GenericTypeDefs.h"
+#include "Patch.h"
+}
+
+namespace
+{
+
+// PROGRAM_COMPRESSED limits, LZ_WINDOW_SIZE and LZ_MIN_MATCH in Framework.c.
+const size_t LZ_WINDOW = 1024;
+const size_t LZ_MIN_MATCH = 4;
+const size_t LZ_MAX_MATCH = 0x7F + LZ_MIN_MATCH;
+const size_t LZ_MAX_LITERAL = 0x80;
+// The decoder counts the bytes of a frame in 16 bits.
+const size_t LZ_MAX_WORDS = 8192;
+
+// Instructions per hex record, 4 bytes each.
+const size_t HEX_RECORD_WORDS = 63;
+
+void Put24(std::vector<uint8_t> &out, uint32_t v)
+{
+    out.push_back((uint8_t)v);
+    out.push_back((uint8_t)(v >> 8));
+    out.push_back((uint8_t)(v >> 16));
+}
+
+void PutHexRecord(std::vector<uint8_t> &out, uint8_t type, uint16_t offset, const std::vector<uint8_t> &data)
+{
+    size_t start = out.size();
+    uint8_t sum = 0;
+
+    out.push_back((uint8_t)data.size());
+    out.push_back((uint8_t)(offset >> 8));
+    out.push_back((uint8_t)offset);
+    out.push_back(type);
+    out.insert(out.end(), data.begin(), data.end());
+    for (size_t i = start; i < out.size(); i++)
+        sum += out[i];
+    out.push_back((uint8_t)-sum);
+}
+
+void Packed(const uint32_t *words, size_t count, std::vector<uint8_t> &out)
+{
+    out.clear();
+    for (size_t i = 0; i < count; i++)
+        Put24(out, words[i]);
+}
+
+}
+
+std::vector<Payload> EncodeHex(const Image &image, size_t maxPayload)
+{
+    std::vector<Payload> payloads;
+    std::vector<uint8_t> record;
+    uint32_t segment = 0xFFFFFFFF;
+
+    payloads.push_back(Payload{PROGRAM_FLASH, {}});
+
+    // Records never cross a 64K hex address segment (0x8000 program addresses).
+    for (const Run &run : image.Runs(0x8000))
+    {
+        for (size_t i = 0; i < run.words.size(); i += HEX_RECORD_WORDS)
+        {
+            size_t n = std::min(HEX_RECORD_WORDS, run.words.size() - i);
+            uint32_t hexAddress = 2 * (run.address + 2 * (uint32_t)i);
+            std::vector<uint8_t> data;
+
+            for (size_t k = 0; k < n; k++)
+            {
+                uint32_t w = run.words[i + k];
+                data.insert(data.end(), {(uint8_t)w, (uint8_t)(w >> 8), (uint8_t)(w >> 16), 0});
+            }
+
+            record.clear();
+            if ((hexAddress >> 16) != segment)
+            {
+                segment = hexAddress >> 16;
+                PutHexRecord(record, 4, 0, {(uint8_t)(segment >> 8), (uint8_t)segment});
+            }
+            PutHexRecord(record, 0, (uint16_t)hexAddress, data);
+
+            if (payloads.back().data.size() + record.size() > maxPayload)
+                payloads.push_back(Payload{PROGRAM_FLASH, {}});
+            payloads.back().data.insert(payloads.back().data.end(), record.begin(), record.end());
+        }
+    }
+
+    record.clear();
+    PutHexRecord(record, 1, 0, {});
+    if (payloads.back().data.size() + record.size() > maxPayload)
+        payloads.push_back(Payload{PROGRAM_FLASH, {}});
+    payloads.back().data.insert(payloads.back().data.end(), record.begin(), record.end());
+
+    return payloads;
+}
+
+std::vector<Payload> EncodeBlocks(const Image &image, size_t maxPayload, bool packed)
+{
+    std::vector<Payload> payloads;
+    size_t wordSize = packed ? 3 : 4;
+    size_t perFrame = (maxPayload - 3) / wordSize;
+
+    for (const Run &run : image.Runs())
+    {
+        for (size_t i = 0; i < run.words.size(); i += perFrame)
+        {
+            size_t n = std::min(perFrame, run.words.size() - i);
+            Payload p{(uint8_t)(packed ? PROGRAM_PACKED : PROGRAM_BLOCK), {}};
+
+            Put24(p.data, run.address + 2 * (uint32_t)i);
+            for (size_t k = 0; k < n; k++)
+            {
+                Put24(p.data, run.words[i + k]);
+                if (!packed)
+                    p.data.push_back(0);
+            }
+            payloads.push_back(std::move(p));
+        }
+    }
+    return payloads;
+}
+
+std::vector<Payload> EncodeCompressed(const Image &image, size_t maxPayload)
+{
+    std::vector<Payload> payloads;
+    std::vector<uint8_t> raw;
+    size_t limit = maxPayload - 3;
+
+    for (const Run &run : image.Runs())
+    {
+        size_t i = 0;
+        size_t n = LZ_MAX_WORDS;
+
+        while (i < run.words.size())
+        {
+            std::vector<uint8_t> packed;
+
+            n = std::min(n, run.words.size() - i);
+            for (;;)
+            {
+                Packed(&run.words[i], n, raw);
+                packed = LzCompress(raw.data(), raw.size());
+                if (packed.size() <= limit || n == 1)
+                    break;
+                // Shrink in proportion, a bit more to converge quickly.
+                n = std::max<size_t>(1, n * limit / packed.size() * 15 / 16);
+            }
+
+            Payload p{PROGRAM_COMPRESSED, {}};
+            Put24(p.data, run.address + 2 * (uint32_t)i);
+            p.data.insert(p.data.end(), packed.begin(), packed.end());
+            payloads.push_back(std::move(p));
+
+            i += n;
+            // Next frame likely compresses alike, start a bit above.
+            n = std::min(LZ_MAX_WORDS, n + n / 8 + 1);
+        }
+    }
+    return payloads;
+}
+
+std::vector<Payload> EncodePatch(const Image &base, const Image &image, const BootInfo &info, size_t maxPayload)
+{
+    std::vector<Payload> payloads;
+    uint32_t end = info.appLast + 2;
+    std::vector<UINT32> oldImage(end / 2);
+    std::vector<UINT32> newImage;
+    std::vector<uint8_t> out(maxPayload);
+
+    for (uint32_t i = 0; i < end / 2; i++)
+        oldImage[i] = base.Word(2 * i);
+
+    for (uint32_t page = info.appFirst; page < end;)
+    {
+        // Next run of changed pages.
+        uint32_t first = page;
+        newImage.clear();
+        for (; page < end; page += info.pageSize)
+        {
+            bool changed = false;
+            for (uint32_t a = page; a < page + info.pageSize; a += 2)
+            {
+                if (image.Word(a) != base.Word(a))
+                    changed = true;
+            }
+            if (!changed)
+                break;
+            for (uint32_t a = page; a < page + info.pageSize; a += 2)
+                newImage.push_back(image.Word(a));
+        }
+
+        for (size_t i = 0; i < newImage.size();)
+        {
+            UINT used = 0;
+            UINT len = PatchEncode(first + 2 * (UINT32)i, &newImage[i], (UINT)(newImage.size() - i),
+                                   oldImage.data(), (UINT32)oldImage.size(), out.data(), (UINT)out.size(), &used);
+            if (used == 0)
+                break;
+            payloads.push_back(Payload{PROGRAM_PATCH, std::vector<uint8_t>(out.begin(), out.begin() + len)});
+            i += used;
+        }
+
+        if (newImage.empty())
+            page += info.pageSize;
+    }
+    return payloads;
+}
+
+std::vector<Payload> EncodeBatches(const std::vector<Payload> &cmds, size_t maxPayload, size_t respLen,
+                                   std::vector<size_t> *counts)
+{
+    std::vector<Payload> batches;
+    size_t resp = 0;
+    size_t count = 0;
+
+    if (counts)
+        counts->clear();
+    for (const Payload &c : cmds)
+    {
+        // HandleBatch() stops unless BATCH_MAX_SUB_RESP bytes are free.
+        if (batches.empty() || batches.back().data.size() + 3 + c.data.size() > maxPayload ||
+            resp + 2 + BATCH_MAX_SUB_RESP > BATCH_RESP_SIZE || count == BATCH_MAX_COUNT)
+        {
+            batches.push_back(Payload{BATCH, {}});
+            if (counts)
+                counts->push_back(0);
+            resp = 2;                   // Count and status.
+            count = 0;
+        }
+        std::vector<uint8_t> &data = batches.back().data;
+        data.push_back(c.cmd);
+        data.push_back((uint8_t)c.data.size());
+        data.push_back((uint8_t)(c.data.size() >> 8));
+        data.insert(data.end(), c.data.begin(), c.data.end());
+        resp += 2 + respLen;
+        count++;
+        if (counts)
+            counts->back()++;
+    }
+    return batches;
+}
+
+std::vector<uint8_t> LzCompress(const uint8_t *in, size_t len)
+{
+    const size_t HASH_SIZE = 1 << 14;
+    const int MAX_CHAIN = 32;
+    std::vector<int> head(HASH_SIZE, -1);
+    std::vector<int> prev(len, -1);
+    std::vector<uint8_t> out;
+    size_t literal = SIZE_MAX;         // Open literal run token.
+    size_t i = 0;
+
+    auto hash = [&](size_t p) {
+        uint32_t v = in[p] | (in[p + 1] << 8) | (in[p + 2] << 16) | ((uint32_t)in[p + 3] << 24);
+        return (v * 2654435761u) >> 18;
+    };
+    auto insert = [&](size_t p) {
+        if (p + LZ_MIN_MATCH <= len)
+        {
+            uint32_t h = hash(p);
+            prev[p] = head[h];
+            head[h] = (int)p;
+        }
+    };
+
+    while (i < len)
+    {
+        size_t best = 0;
+        size_t distance = 0;
+
+        if (i + LZ_MIN_MATCH <= len)
+        {
+            int chain = 0;
+            for (int j = head[hash(i)]; j >= 0 && i - j <= LZ_WINDOW && chain < MAX_CHAIN; j = prev[j], chain++)
+            {
+                size_t n = 0;
+                while (i + n < len && n < LZ_MAX_MATCH && in[j + n] == in[i + n])
+                    n++;
+                if (n > best)
+                {
+                    best = n;
+                    distance = i - j;
+                }
+            }
+        }
+
+        if (best >= LZ_MIN_MATCH)
+        {
+            out.push_back((uint8_t)(0x80 | (best - LZ_MIN_MATCH)));
+            out.push_back((uint8_t)distance);
+            out.push_back((uint8_t)(distance >> 8));
+            for (size_t k = 0; k < best; k++)
+                insert(i + k);
+            i += best;
+            literal = SIZE_MAX;
+        }
+        else
+        {
+            if (literal == SIZE_MAX || out[literal] == LZ_MAX_LITERAL - 1)
+            {
+                literal = out.size();
+                out.push_back(0);
+            }
+            else
+            {
+                out[literal]++;
+            }
+            out.push_back(in[i]);
+            insert(i);
+            i++;
+        }
+    }
+    return out;
+}
@@ -0,0 +1,43 @@
+// Turns an image into command payloads of at most maxPayload bytes each,
+// one per frame, for the different programming commands.
+#ifndef ENCODER_H
+#define ENCODER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "Image.h"
+
+struct BootInfo;
+
+struct Payload
+{
+    uint8_t cmd;
+    std::vector<uint8_t> data;
+};
+
+// PROGRAM_FLASH: Intel HEX records, as many as fit, ends with the
+// end-of-file record.
+std::vector<Payload> EncodeHex(const Image &image, size_t maxPayload);
+
+// PROGRAM_BLOCK (4 bytes per instruction) or PROGRAM_PACKED (3 bytes).
+std::vector<Payload> EncodeBlocks(const Image &image, size_t maxPayload, bool packed);
+
+// PROGRAM_COMPRESSED, see LZ_WINDOW_SIZE in Framework.c.
+std::vector<Payload> EncodeCompressed(const Image &image, size_t maxPayload);
+
+// PROGRAM_PATCH: the pages where image differs from the installed base.
+std::vector<Payload> EncodePatch(const Image &base, const Image &image, const BootInfo &info, size_t maxPayload);
+
+// BATCH: the commands packed into as few data fields of at most
+// maxPayload bytes as the boot loader executes completely, each command
+// answered with at most respLen bytes. counts, if given, receives the
+// number of commands in each.
+std::vector<Payload> EncodeBatches(const std::vector<Payload> &cmds, size_t maxPayload, size_t respLen,
+                                   std::vector<size_t> *counts = nullptr);
+
+// The stream format PROGRAM_COMPRESSED decodes.
+std::vector<uint8_t> LzCompress(const uint8_t *in, size_t len);
+
+#endif
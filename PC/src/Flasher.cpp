@@ -0,0 +1,496 @@
+#include "Flasher.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <cstdio>
+#include <vector>
+
+#include "Encoder.h"
+
+namespace
+{
+
+const int PROGRAM_TIMEOUT_MS = 1000;
+const int ERASE_TIMEOUT_MS = 10000;
+const int CRC_TIMEOUT_MS = 10000;
+
+double Seconds(std::chrono::steady_clock::time_point since)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - since).count();
+}
+
+std::string Format(const char *fmt, ...) __attribute__((format(printf, 1, 2)));
+
+std::string Format(const char *fmt, ...)
+{
+    char buf[512];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, ap);
+    va_end(ap);
+    return buf;
+}
+
+// Picks the densest programming command both sides support.
+std::string ChooseMode(const std::string &mode, bool haveBase, const BootInfo &info)
+{
+    if (mode != "auto")
+        return mode;
+    if (haveBase && info.Supports(PROGRAM_PATCH))
+        return "patch";
+    if (info.Supports(PROGRAM_COMPRESSED))
+        return "lz";
+    if (info.Supports(PROGRAM_PACKED))
+        return "packed";
+    if (info.Supports(PROGRAM_BLOCK))
+        return "block";
+    return "hex";
+}
+
+Command ModeCommand(const std::string &mode)
+{
+    if (mode == "block")
+        return PROGRAM_BLOCK;
+    if (mode == "packed")
+        return PROGRAM_PACKED;
+    if (mode == "lz")
+        return PROGRAM_COMPRESSED;
+    if (mode == "patch")
+        return PROGRAM_PATCH;
+    return PROGRAM_FLASH;
+}
+
+uint32_t Le32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+bool Fail(FlashReport *report, const std::string &error)
+{
+    report->ok = false;
+    report->error = error;
+    return false;
+}
+
+// READ_CRC and ERASE_RANGE data of program addresses first to last.
+std::vector<uint8_t> RangeData(uint32_t first, uint32_t last)
+{
+    uint32_t len = 4 * ((last - first) / 2 + 1);
+
+    return {(uint8_t)first, (uint8_t)(first >> 8), (uint8_t)(first >> 16), 0,
+            (uint8_t)len, (uint8_t)(len >> 8), (uint8_t)(len >> 16), (uint8_t)(len >> 24)};
+}
+
+std::string PlanKey(const std::string &mode, bool erased, const BootInfo &info)
+{
+    std::string key = Format("%s %d %u %u %X %X", mode.c_str(), erased, info.frameSize, info.pageSize,
+                             info.appFirst, info.appLast);
+    for (const auto &r : info.excluded)
+        key += Format(" %X-%X", r.first, r.second);
+    return key;
+}
+
+}
+
+Flasher::Flasher(const Image &image, const Image &base, const FlashOptions &opt)
+    : image_(image), base_(base), opt_(opt)
+{
+    if (!opt_.cacheDir.empty())
+        imageKey_ = Format("image %016llX base %016llX", (unsigned long long)image_.Hash(),
+                           (unsigned long long)(base_.Empty() ? 0 : base_.Hash()));
+}
+
+std::shared_ptr<const FlashPlan> Flasher::Plan(const std::string &mode, bool erased, const BootInfo &info)
+{
+    std::string key = PlanKey(mode, erased, info);
+
+    // Boards asking for the same plan wait for the first one to encode it.
+    std::lock_guard<std::mutex> lock(plansLock_);
+    auto it = plans_.find(key);
+    if (it != plans_.end())
+        return it->second;
+
+    auto plan = std::make_shared<FlashPlan>();
+    plan->mode = mode;
+    plan->erased = erased;
+    plan->image = image_;
+    plan->dropped = plan->image.Restrict(info);
+    plan->pages = plan->image.Pages(info.pageSize);
+    plan->instructions = plan->image.Size();
+    if (mode != "hex" && mode != "patch")
+        plan->image.StripBlank(info.pageSize, !erased);
+
+    size_t maxPayload = info.MaxPayload();
+    if (mode == "hex")
+    {
+        plan->payloads = EncodeHex(plan->image, maxPayload);
+    }
+    else if (mode == "block" || mode == "packed")
+    {
+        plan->payloads = EncodeBlocks(plan->image, maxPayload, mode == "packed");
+    }
+    else if (mode == "lz")
+    {
+        plan->payloads = EncodeCompressed(plan->image, maxPayload);
+    }
+    else
+    {
+        Image base = base_;
+        base.Restrict(info);
+        plan->payloads = EncodePatch(base, plan->image, info, maxPayload);
+    }
+    for (const Payload &p : plan->payloads)
+        plan->payloadBytes += p.data.size();
+
+    plans_[key] = plan;
+    return plan;
+}
+
+std::shared_ptr<const FrameCache> Flasher::Frames(const std::string &mode, bool erased, const BootInfo &info,
+                                                  bool sequenced, bool *hit, std::string *err)
+{
+    // The version keeps entries of older encoders from matching.
+    std::string key = Format("v1 %s seq %d ", imageKey_.c_str(), sequenced) + PlanKey(mode, erased, info);
+    std::string path = FrameCache::Path(opt_.cacheDir, key);
+
+    std::lock_guard<std::mutex> lock(framesLock_);
+    auto it = frames_.find(key);
+    if (it != frames_.end())
+    {
+        *hit = true;
+        return it->second;
+    }
+
+    auto cache = std::make_shared<FrameCache>();
+    *hit = cache->Open(path, key);
+    if (!*hit)
+    {
+        std::shared_ptr<const FlashPlan> plan = Plan(mode, erased, info);
+        CachedPlan numbers;
+        numbers.instructions = plan->instructions;
+        numbers.pages = plan->pages.size();
+        numbers.dropped = plan->dropped;
+        numbers.payloadBytes = plan->payloadBytes;
+        if (!cache->Create(path, key, plan->payloads, sequenced, 1, plan->image, plan->pages, info.pageSize,
+                           numbers, err))
+            return nullptr;
+    }
+    frames_[key] = cache;
+    return cache;
+}
+
+bool Flasher::ReadCrcs(Session &session, const std::vector<CrcRange> &ranges, std::vector<uint16_t> *crcs,
+                       std::string *err)
+{
+    std::vector<Payload> reads;
+    for (const CrcRange &r : ranges)
+        reads.push_back(Payload{READ_CRC, RangeData(r.first, r.last)});
+    // One frame for all of them with BATCH, pipelined when sequenced.
+    std::vector<std::vector<uint8_t>> resps;
+    bool sent = opt_.batch ? session.Batch(reads, 2, &resps, CRC_TIMEOUT_MS, err)
+                           : session.Stream(reads, &resps, CRC_TIMEOUT_MS, err);
+    if (!sent)
+        return false;
+    crcs->clear();
+    for (size_t i = 0; i < ranges.size(); i++)
+    {
+        // Lost in a sequenced stream, ask once more.
+        if (resps[i].empty() && !session.Command(READ_CRC, reads[i].data, &resps[i], CRC_TIMEOUT_MS, err))
+            return false;
+        if (resps[i].size() < 2)
+        {
+            *err = Format("0x%06X-0x%06X refused", ranges[i].first, ranges[i].last);
+            return false;
+        }
+        crcs->push_back(resps[i][0] | (resps[i][1] << 8));
+    }
+    return true;
+}
+
+bool Flasher::BaseInstalled(Session &session, const BootInfo &info, bool *same, std::string *err)
+{
+    Image base = base_;
+    Image image = image_;
+    base.Restrict(info);
+    image.Restrict(info);
+
+    // Every page the patch may read from or writes to.
+    std::vector<uint32_t> pages = base.Pages(info.pageSize);
+    std::vector<uint32_t> imagePages = image.Pages(info.pageSize);
+    pages.insert(pages.end(), imagePages.begin(), imagePages.end());
+    std::sort(pages.begin(), pages.end());
+    pages.erase(std::unique(pages.begin(), pages.end()), pages.end());
+
+    std::vector<CrcRange> ranges;
+    for (const auto &r : PageRanges(pages, info.pageSize))
+        ranges.push_back(CrcRange{r.first, r.second, base.Crc(r.first, (r.second - r.first) / 2 + 1)});
+    std::vector<uint16_t> crcs;
+    if (!ReadCrcs(session, ranges, &crcs, err))
+        return false;
+    *same = true;
+    for (size_t i = 0; i < ranges.size(); i++)
+        *same = *same && crcs[i] == ranges[i].crc;
+    return true;
+}
+
+bool Flasher::Flash(SerialPort &port, FlashReport *report)
+{
+    std::string err;
+    auto log = [this, &port](const std::string &line) {
+        if (log_)
+            log_(port, line);
+    };
+
+    *report = FlashReport();
+    auto start = std::chrono::steady_clock::now();
+    Session session(port);
+    if (!session.Connect(opt_.connectTimeoutMs, &err))
+        return Fail(report, err);
+    const BootInfo &info = session.Info();
+    report->info = info;
+    report->sequenced = session.Sequenced();
+    report->connectTime = Seconds(start);
+    log(port.Path() + ": " + info.Describe() + (session.Sequenced() ? ", sequenced" : ""));
+
+    report->baud = opt_.baud;
+    if (opt_.switchBaud && opt_.switchBaud != report->baud)
+    {
+        if (session.ChangeBaud(opt_.switchBaud, report->baud, &err))
+        {
+            report->baud = opt_.switchBaud;
+            log(Format("switched to %u baud", report->baud));
+        }
+        else
+        {
+            log(Format("%s, staying at %u baud", err.c_str(), report->baud));
+        }
+    }
+
+    std::string mode = ChooseMode(opt_.mode, !base_.Empty(), info);
+    Command cmd = ModeCommand(mode);
+    report->mode = mode;
+    if (mode != "hex" && cmd == PROGRAM_FLASH)
+        return Fail(report, "unknown mode " + mode);
+    if (!info.Supports(cmd))
+        return Fail(report, "boot loader does not support " + mode + " mode");
+    if (mode == "patch" && base_.Empty())
+        return Fail(report, "patch mode needs --base");
+    if (mode == "patch")
+    {
+        // Patch frames rebuild pages from the instructions installed now.
+        // Built from other ones than base they would program garbage.
+        bool same = false;
+        if (!BaseInstalled(session, info, &same, &err))
+            return Fail(report, "base check: " + err);
+        if (!same && opt_.mode == "patch")
+            return Fail(report, "the board does not hold the --base image");
+        if (!same)
+        {
+            mode = ChooseMode(opt_.mode, false, info);
+            cmd = ModeCommand(mode);
+            report->mode = mode;
+            log("the board does not hold the --base image, " + mode + " mode instead");
+        }
+    }
+
+    // Boot loaders that erase pages on first write announce it. Others get
+    // the pages of the image erased if they can, all of flash otherwise.
+    std::string erase = opt_.erase;
+    if (erase == "auto")
+        erase = info.Has(FEATURE_LAZY_ERASE) ? "none" : info.Supports(ERASE_RANGE) ? "range" : "all";
+    if (mode == "patch")
+        erase = "none";                 // The patch is relative to flash contents.
+    if (erase != "all" && erase != "range" && erase != "none")
+        return Fail(report, "unknown erase " + erase);
+    if (erase == "range" && !info.Supports(ERASE_RANGE))
+        return Fail(report, "boot loader does not support range erase");
+    bool erased = (erase != "none");
+
+    // From the cache the frames go out as they are, without the plan. The
+    // encoder still runs the first time, to fill it.
+    std::shared_ptr<const FrameCache> cache;
+    std::shared_ptr<const FlashPlan> plan;
+    if (!opt_.cacheDir.empty())
+    {
+        cache = Frames(mode, erased, info, session.Sequenced(), &report->cached, &err);
+        if (!cache)
+            log("cache: " + err + ", encoding every time");
+    }
+    CachedPlan numbers;
+    if (cache)
+    {
+        numbers = cache->Plan();
+        report->frames = cache->Frames().size();
+    }
+    else
+    {
+        plan = Plan(mode, erased, info);
+        numbers.instructions = plan->instructions;
+        numbers.pages = plan->pages.size();
+        numbers.dropped = plan->dropped;
+        numbers.payloadBytes = plan->payloadBytes;
+        report->frames = plan->payloads.size();
+    }
+    if (numbers.dropped)
+        log(Format("%zu instructions outside the application range ignored", (size_t)numbers.dropped));
+    report->instructions = numbers.instructions;
+    report->pages = numbers.pages;
+    report->payloadBytes = numbers.payloadBytes;
+    log(Format("%zu instructions in %zu pages, %s mode: %zu frames, %zu payload bytes%s", report->instructions,
+               report->pages, mode.c_str(), report->frames, report->payloadBytes,
+               cache ? (report->cached ? ", from cache" : ", cached") : ""));
+
+    std::vector<Payload> erases;
+    if (erase == "range")
+    {
+        if (cache)
+        {
+            for (const CrcRange &r : cache->Ranges())
+                erases.push_back(Payload{ERASE_RANGE, RangeData(r.first, r.last)});
+        }
+        else
+        {
+            for (const auto &r : PageRanges(plan->pages, info.pageSize))
+                erases.push_back(Payload{ERASE_RANGE, RangeData(r.first, r.second)});
+        }
+    }
+    // The cached frames are numbered from FirstSeq(), the erase frames go
+    // right before them. The READ_BOOT_INFO restarting the count forgets
+    // which pages are erased, so it comes first.
+    if (cache)
+    {
+        size_t prologue = 0;
+        if (erase == "all")
+            prologue = 1;
+        else if (erase == "range")
+            prologue = opt_.batch ? session.BatchFrames(erases, 2) : erases.size();
+        if (!session.Restart(cache->FirstSeq() - (uint32_t)prologue, &err))
+            return Fail(report, "program: " + err);
+    }
+
+    std::vector<uint8_t> resp;
+    auto phase = std::chrono::steady_clock::now();
+    if (erase == "all")
+    {
+        if (!session.Command(ERASE_FLASH, {}, &resp, ERASE_TIMEOUT_MS, &err))
+            return Fail(report, "erase: " + err);
+        report->eraseTime = Seconds(phase);
+    }
+    else if (erase == "range")
+    {
+        std::vector<std::vector<uint8_t>> statuses;
+        bool sent = opt_.batch ? session.Batch(erases, 2, &statuses, ERASE_TIMEOUT_MS, &err)
+                               : session.Stream(erases, &statuses, ERASE_TIMEOUT_MS, &err);
+        if (!sent)
+            return Fail(report, "erase: " + err);
+        for (size_t i = 0; i < statuses.size(); i++)
+        {
+            // A lost status is repeated, erasing twice does no harm.
+            if (statuses[i].empty() && !session.Command(ERASE_RANGE, erases[i].data, &statuses[i],
+                                                        ERASE_TIMEOUT_MS, &err))
+                return Fail(report, "erase: " + err);
+            if (statuses[i].size() < 2)
+                return Fail(report, Format("erase: range %zu refused", i));
+        }
+        report->eraseTime = Seconds(phase);
+    }
+    // Frames sent again while erasing moved the count past FirstSeq().
+    if (cache && session.Sequenced() && session.NextSeq() != cache->FirstSeq())
+    {
+        log("cache: erase took extra frames, encoding again");
+        plan = Plan(mode, erased, info);
+    }
+
+    phase = std::chrono::steady_clock::now();
+    std::vector<std::vector<uint8_t>> resps;
+    if (progress_)
+    {
+        size_t total = report->frames;
+        session.SetProgress([this, &port, total](size_t done) { progress_(port, done, total); });
+    }
+    // One patch frame can rewrite dozens of pages, erase included.
+    int timeoutMs = (mode == "patch") ? ERASE_TIMEOUT_MS : PROGRAM_TIMEOUT_MS;
+    if (!plan)
+    {
+        if (!session.StreamFrames(cache->Frames(), &resps, timeoutMs, &err))
+            return Fail(report, "program: " + err);
+    }
+    else if (!session.Stream(plan->payloads, &resps, timeoutMs, &err))
+    {
+        return Fail(report, "program: " + err);
+    }
+    if (cmd != PROGRAM_FLASH)
+    {
+        for (size_t i = 0; i < resps.size(); i++)
+        {
+            if (resps[i].empty())
+                report->lostStatuses++;
+            else if (resps[i][0] != 0)
+                return Fail(report, Format("program: frame %zu rejected, status %u", i, resps[i][0]));
+        }
+        if (report->lostStatuses)
+            log(Format("%u frame statuses lost, relying on the CRC check", report->lostStatuses));
+    }
+    report->programTime = Seconds(phase);
+    session.SetProgress(nullptr);
+
+    phase = std::chrono::steady_clock::now();
+    report->ok = true;
+    if (opt_.verify)
+    {
+        // Compare whole pages, what the image leaves out must read blank.
+        std::vector<CrcRange> ranges;
+        if (cache)
+        {
+            ranges = cache->Ranges();
+        }
+        else
+        {
+            for (const auto &r : PageRanges(plan->pages, info.pageSize))
+                ranges.push_back(CrcRange{r.first, r.second, plan->image.Crc(r.first, (r.second - r.first) / 2 + 1)});
+        }
+        std::vector<uint16_t> crcs;
+        if (!ReadCrcs(session, ranges, &crcs, &err))
+            return Fail(report, "verify: " + err);
+        for (size_t i = 0; i < ranges.size(); i++)
+        {
+            const CrcRange &r = ranges[i];
+            if (crcs[i] != r.crc)
+            {
+                log(Format("verify: 0x%06X-0x%06X CRC 0x%04X, expected 0x%04X", r.first, r.last, crcs[i], r.crc));
+                report->ok = false;
+            }
+        }
+    }
+    report->verifyTime = Seconds(phase);
+
+    if (info.Supports(READ_STATS) && session.Command(READ_STATS, {}, &resp, 1000, &err) && resp.size() >= 8)
+    {
+        report->haveStats = true;
+        report->pagesWritten = Le32(&resp[0]);
+        report->pagesSkipped = Le32(&resp[4]);
+        log(Format("pages written %u, skipped as identical %u", report->pagesWritten, report->pagesSkipped));
+    }
+
+    if (report->ok && opt_.run)
+        session.Run();
+
+    report->totalTime = Seconds(start);
+    report->wire = session.Stats();
+    return report->ok;
+}
+
+std::string DescribeReport(const FlashReport &r)
+{
+    double kib = r.instructions * 3 / 1024.0;
+
+    return Format("%s: %zu instructions (%.1f KiB) in %.2f s (erase %.2f, program %.2f, verify %.2f), %.1f KiB/s\n",
+                  r.ok ? "done" : "FAILED", r.instructions, kib, r.totalTime, r.eraseTime, r.programTime,
+                  r.verifyTime, kib / r.totalTime) +
+           Format("wire: %llu bytes in %u frames sent, %llu bytes in %u frames received, "
+                  "%u retransmits, %u round trips, %u baud",
+                  (unsigned long long)r.wire.bytesSent, r.wire.framesSent, (unsigned long long)r.wire.bytesReceived,
+                  r.wire.framesReceived, r.wire.retransmits, r.wire.roundTrips, r.baud);
+}
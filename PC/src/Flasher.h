@@ -0,0 +1,128 @@
+// One complete update of one boot loader: connect, pick the programming
+// command, erase, program, verify with READ_CRC and optionally start the
+// application. dspic-flash and dspic-bench run it, one thread per board
+// when there are several; Flash() may run concurrently on different ports.
+#ifndef FLASHER_H
+#define FLASHER_H
+
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "FrameCache.h"
+#include "Image.h"
+#include "Protocol.h"
+#include "SerialPort.h"
+#include "Session.h"
+
+// What goes to a boot loader, depending only on its boot info and the
+// options. Encoded once and shared read-only by all boards that need the
+// same.
+struct FlashPlan
+{
+    std::string mode;
+    bool erased = false;                // Pages erased before programming.
+    Image image;                        // Restricted, blank instructions stripped.
+    size_t dropped = 0;                 // Outside the application range.
+    size_t instructions = 0;
+    std::vector<uint32_t> pages;
+    std::vector<Payload> payloads;
+    size_t payloadBytes = 0;
+};
+
+struct FlashOptions
+{
+    std::string mode = "auto";          // auto, hex, block, packed, lz or patch
+    std::string erase = "auto";         // auto, all, range or none
+    unsigned baud = 460800;
+    unsigned switchBaud = 0;
+    int connectTimeoutMs = 5000;
+    bool verify = true;
+    bool batch = true;                  // READ_CRC, ERASE_RANGE in BATCH frames when supported.
+    bool run = false;
+    std::string cacheDir;               // Encoded frames kept here, empty: none.
+};
+
+struct FlashReport
+{
+    bool ok = false;
+    std::string error;                  // Why not ok, empty on a CRC mismatch.
+    BootInfo info;
+    bool sequenced = false;
+    std::string mode;
+    unsigned baud = 0;                  // Transfer baud rate.
+    size_t instructions = 0;
+    size_t pages = 0;
+    size_t frames = 0;
+    size_t payloadBytes = 0;
+    bool cached = false;                // Frames mapped from the cache directory.
+    unsigned lostStatuses = 0;
+    bool haveStats = false;             // READ_STATS answered.
+    uint32_t pagesWritten = 0;
+    uint32_t pagesSkipped = 0;
+    double connectTime = 0;             // Seconds.
+    double eraseTime = 0;
+    double programTime = 0;
+    double verifyTime = 0;
+    double totalTime = 0;
+    SessionStats wire;
+};
+
+class Flasher
+{
+public:
+    // base is the image installed now, for patch mode, or empty.
+    Flasher(const Image &image, const Image &base, const FlashOptions &opt);
+
+    // Receive what dspic-flash prints along the way, and the number of
+    // frames acknowledged out of all while programming, with the port.
+    // Called from the thread running Flash().
+    void SetLog(std::function<void(const SerialPort &, const std::string &)> log) { log_ = std::move(log); }
+    void SetProgress(std::function<void(const SerialPort &, size_t, size_t)> progress)
+    {
+        progress_ = std::move(progress);
+    }
+
+    // Updates the boot loader on port, opened at opt.baud. Returns
+    // report->ok.
+    bool Flash(SerialPort &port, FlashReport *report);
+
+private:
+    // The plan for mode, erase and the boot info, from the cache if
+    // another board needed it already.
+    std::shared_ptr<const FlashPlan> Plan(const std::string &mode, bool erased, const BootInfo &info);
+
+    // The encoded frames of the plan, mapped from opt.cacheDir and written
+    // there first if no earlier run did. Null when the directory cannot
+    // be used, *hit tells whether the file existed.
+    std::shared_ptr<const FrameCache> Frames(const std::string &mode, bool erased, const BootInfo &info,
+                                             bool sequenced, bool *hit, std::string *err);
+
+    // READ_CRC of each range, in BATCH frames when opt.batch.
+    bool ReadCrcs(Session &session, const std::vector<CrcRange> &ranges, std::vector<uint16_t> *crcs,
+                  std::string *err);
+
+    // Whether the board holds base_ on every page of base_ and image_.
+    bool BaseInstalled(Session &session, const BootInfo &info, bool *same, std::string *err);
+
+    const Image &image_;
+    const Image &base_;
+    const FlashOptions opt_;
+    std::function<void(const SerialPort &, const std::string &)> log_;
+    std::function<void(const SerialPort &, size_t, size_t)> progress_;
+
+    std::mutex plansLock_;
+    std::map<std::string, std::shared_ptr<const FlashPlan>> plans_;
+
+    std::string imageKey_;              // Content of image and base.
+    std::mutex framesLock_;
+    std::map<std::string, std::shared_ptr<const FrameCache>> frames_;
+};
+
+// Fixed width summary lines of a report, as dspic-flash prints them.
+std::string DescribeReport(const FlashReport &report);
+
+#endif
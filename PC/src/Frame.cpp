@@ -0,0 +1,73 @@
+#include "Frame.h"
+
+#include "Crc16.h"
+
+namespace frame
+{
+
+namespace
+{
+
+void Put(uint8_t b, std::vector<uint8_t> &out)
+{
+    if (b == SOH || b == EOT || b == DLE)
+        out.push_back(DLE);
+    out.push_back(b);
+}
+
+}
+
+void Encode(const uint8_t *data, size_t len, std::vector<uint8_t> &out)
+{
+    uint16_t crc = Crc16(data, len);
+
+    out.push_back(SOH);
+    for (size_t i = 0; i < len; i++)
+        Put(data[i], out);
+    Put((uint8_t)crc, out);
+    Put((uint8_t)(crc >> 8), out);
+    out.push_back(EOT);
+}
+
+bool Parser::Feed(uint8_t b)
+{
+    if (escape_)
+    {
+        escape_ = false;
+        if (inFrame_)
+            buf_.push_back(b);
+        return false;
+    }
+
+    switch (b)
+    {
+    case SOH:
+        buf_.clear();
+        inFrame_ = true;
+        return false;
+
+    case DLE:
+        escape_ = true;
+        return false;
+
+    case EOT:
+        if (!inFrame_)
+            return false;
+        inFrame_ = false;
+        if (buf_.size() > 2 &&
+            Crc16(buf_.data(), buf_.size() - 2) == (buf_[buf_.size() - 2] | (buf_.back() << 8)))
+        {
+            data_.assign(buf_.begin(), buf_.end() - 2);
+            return true;
+        }
+        badFrames_++;
+        return false;
+
+    default:
+        if (inFrame_)
+            buf_.push_back(b);
+        return false;
+    }
+}
+
+}
@@ -0,0 +1,41 @@
+// Frame layer of the boot loader protocol: SOH, data and CRC (LSB first)
+// with SOH/EOT/DLE escaped by a DLE, EOT. Mirrors BuildRxFrame() and
+// GetTransmitFrame() in Framework.c.
+#ifndef FRAME_H
+#define FRAME_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace frame
+{
+
+const uint8_t SOH = 0x01;
+const uint8_t EOT = 0x04;
+const uint8_t DLE = 0x10;
+
+// Appends the escaped frame of data[0..len) to out.
+void Encode(const uint8_t *data, size_t len, std::vector<uint8_t> &out);
+
+class Parser
+{
+public:
+    // Returns true when b completes a frame with a valid CRC, Data() then
+    // holds its data field without the CRC.
+    bool Feed(uint8_t b);
+
+    const std::vector<uint8_t> &Data() const { return data_; }
+    unsigned BadFrames() const { return badFrames_; }
+
+private:
+    std::vector<uint8_t> buf_;
+    std::vector<uint8_t> data_;
+    bool escape_ = false;
+    bool inFrame_ = false;
+    unsigned badFrames_ = 0;
+};
+
+}
+
+#endif
@@ -0,0 +1,256 @@
+#include "FrameCache.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "Frame.h"
+#include "Protocol.h"
+
+namespace
+{
+
+// File layout, little endian as the host: the header, the key, the frame
+// index, the CRC ranges and the frames back to back.
+const char MAGIC[8] = {'D', 'S', 'P', 'F', 'R', 'M', '0', '1'};
+
+struct Header
+{
+    char magic[8];
+    uint32_t keyLen;
+    uint32_t sequenced;
+    uint32_t firstSeq;
+    uint32_t frameCount;
+    uint32_t rangeCount;
+    uint32_t reserved;
+    uint64_t instructions;
+    uint64_t pages;
+    uint64_t dropped;
+    uint64_t payloadBytes;
+    uint64_t indexOffset;
+    uint64_t rangeOffset;
+    uint64_t fileSize;
+};
+
+struct IndexEntry
+{
+    uint64_t offset;
+    uint32_t len;
+    uint32_t cmd;
+};
+
+struct RangeEntry
+{
+    uint32_t first;
+    uint32_t last;
+    uint32_t crc;
+};
+
+uint64_t Fnv1a(const std::string &s)
+{
+    uint64_t hash = 0xCBF29CE484222325ull;
+
+    for (unsigned char c : s)
+        hash = (hash ^ c) * 0x100000001B3ull;
+    return hash;
+}
+
+template <typename T>
+void Append(std::vector<uint8_t> &out, const T &value)
+{
+    const uint8_t *p = reinterpret_cast<const uint8_t *>(&value);
+    out.insert(out.end(), p, p + sizeof(value));
+}
+
+// mkdir -p
+bool MakeDirs(const std::string &dir)
+{
+    for (size_t pos = 1; pos != std::string::npos; pos++)
+    {
+        pos = dir.find('/', pos);
+        std::string part = dir.substr(0, pos);
+        if (mkdir(part.c_str(), 0755) < 0 && errno != EEXIST)
+            return false;
+        if (pos == std::string::npos)
+            break;
+    }
+    return true;
+}
+
+}
+
+FrameCache::~FrameCache()
+{
+    Close();
+}
+
+void FrameCache::Close()
+{
+    if (map_)
+        munmap(map_, size_);
+    map_ = nullptr;
+    size_ = 0;
+    frames_.clear();
+    ranges_.clear();
+}
+
+std::string FrameCache::Path(const std::string &dir, const std::string &key)
+{
+    char name[32];
+
+    snprintf(name, sizeof(name), "/%016llx.frames", (unsigned long long)Fnv1a(key));
+    return dir + name;
+}
+
+bool FrameCache::Open(const std::string &path, const std::string &key)
+{
+    struct stat st;
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+
+    Close();
+    if (fd < 0)
+        return false;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(Header))
+    {
+        close(fd);
+        return false;
+    }
+    void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        return false;
+    map_ = map;
+    size_ = st.st_size;
+
+    // Everything is checked against the file size, a truncated or foreign
+    // file is a miss.
+    const uint8_t *base = static_cast<const uint8_t *>(map_);
+    Header h;
+    memcpy(&h, base, sizeof(h));
+    if (memcmp(h.magic, MAGIC, sizeof(MAGIC)) != 0 || h.fileSize != size_ || h.keyLen != key.size() ||
+        sizeof(h) + h.keyLen > size_ || memcmp(base + sizeof(h), key.data(), key.size()) != 0 ||
+        h.indexOffset + (uint64_t)h.frameCount * sizeof(IndexEntry) > size_ ||
+        h.rangeOffset + (uint64_t)h.rangeCount * sizeof(RangeEntry) > size_)
+    {
+        Close();
+        return false;
+    }
+
+    for (uint32_t i = 0; i < h.frameCount; i++)
+    {
+        IndexEntry e;
+        memcpy(&e, base + h.indexOffset + i * sizeof(e), sizeof(e));
+        if (e.offset + e.len > size_)
+        {
+            Close();
+            return false;
+        }
+        frames_.push_back(FrameRef{(uint8_t)e.cmd, base + e.offset, e.len});
+    }
+    for (uint32_t i = 0; i < h.rangeCount; i++)
+    {
+        RangeEntry e;
+        memcpy(&e, base + h.rangeOffset + i * sizeof(e), sizeof(e));
+        ranges_.push_back(CrcRange{e.first, e.last, (uint16_t)e.crc});
+    }
+    plan_.instructions = h.instructions;
+    plan_.pages = h.pages;
+    plan_.dropped = h.dropped;
+    plan_.payloadBytes = h.payloadBytes;
+    firstSeq_ = h.firstSeq;
+    return true;
+}
+
+bool FrameCache::Create(const std::string &path, const std::string &key, const std::vector<Payload> &payloads,
+                        bool sequenced, uint32_t firstSeq, const Image &image, const std::vector<uint32_t> &pages,
+                        unsigned pageSize, const CachedPlan &plan, std::string *err)
+{
+    std::vector<std::pair<uint32_t, uint32_t>> pageRanges = PageRanges(pages, pageSize);
+    std::vector<uint8_t> data;
+    std::vector<IndexEntry> index;
+    std::vector<uint8_t> plain;
+
+    Header h = {};
+    memcpy(h.magic, MAGIC, sizeof(MAGIC));
+    h.keyLen = key.size();
+    h.sequenced = sequenced;
+    h.firstSeq = firstSeq;
+    h.frameCount = payloads.size();
+    h.rangeCount = pageRanges.size();
+    h.instructions = plan.instructions;
+    h.pages = plan.pages;
+    h.dropped = plan.dropped;
+    h.payloadBytes = plan.payloadBytes;
+    h.indexOffset = sizeof(h) + key.size();
+    h.rangeOffset = h.indexOffset + payloads.size() * sizeof(IndexEntry);
+    uint64_t dataOffset = h.rangeOffset + pageRanges.size() * sizeof(RangeEntry);
+
+    // The frames exactly as Session::Send() would put them on the wire.
+    for (size_t i = 0; i < payloads.size(); i++)
+    {
+        plain.clear();
+        if (sequenced)
+        {
+            plain.push_back(payloads[i].cmd | SEQ_FLAG);
+            plain.push_back((uint8_t)(firstSeq + i));
+        }
+        else
+        {
+            plain.push_back(payloads[i].cmd);
+        }
+        plain.insert(plain.end(), payloads[i].data.begin(), payloads[i].data.end());
+
+        size_t start = data.size();
+        frame::Encode(plain.data(), plain.size(), data);
+        index.push_back(IndexEntry{dataOffset + start, (uint32_t)(data.size() - start), payloads[i].cmd});
+    }
+    h.fileSize = dataOffset + data.size();
+
+    std::vector<uint8_t> file;
+    file.reserve(h.fileSize);
+    Append(file, h);
+    file.insert(file.end(), key.begin(), key.end());
+    for (const IndexEntry &e : index)
+        Append(file, e);
+    for (const auto &r : pageRanges)
+        Append(file, RangeEntry{r.first, r.second, image.Crc(r.first, (r.second - r.first) / 2 + 1)});
+    file.insert(file.end(), data.begin(), data.end());
+
+    std::string dir = path.substr(0, path.rfind('/'));
+    std::string tmp = path + ".tmp" + std::to_string(getpid());
+    if (!MakeDirs(dir))
+    {
+        *err = dir + ": " + strerror(errno);
+        return false;
+    }
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        *err = tmp + ": " + strerror(errno);
+        return false;
+    }
+    size_t done = 0;
+    while (done < file.size())
+    {
+        ssize_t n = write(fd, file.data() + done, file.size() - done);
+        if (n <= 0)
+            break;
+        done += n;
+    }
+    if (close(fd) < 0 || done != file.size() || rename(tmp.c_str(), path.c_str()) < 0)
+    {
+        *err = tmp + ": " + strerror(errno);
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    if (!Open(path, key))
+    {
+        *err = path + ": cannot map";
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,71 @@
+// Frames of an update as they go on the wire, escaped, with sequence
+// numbers and CRCs, plus the READ_CRC results to expect afterwards. Built
+// once per image and plan into a file, then mapped read-only: a repeated
+// update writes straight from the mapping to the port.
+#ifndef FRAME_CACHE_H
+#define FRAME_CACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "Encoder.h"
+#include "Image.h"
+#include "Session.h"
+
+struct CrcRange
+{
+    uint32_t first;                     // Program addresses, inclusive.
+    uint32_t last;
+    uint16_t crc;
+};
+
+// Numbers of the plan the frames were encoded from, for the report.
+struct CachedPlan
+{
+    uint64_t instructions = 0;
+    uint64_t pages = 0;
+    uint64_t dropped = 0;
+    uint64_t payloadBytes = 0;
+};
+
+class FrameCache
+{
+public:
+    FrameCache() = default;
+    ~FrameCache();
+    FrameCache(const FrameCache &) = delete;
+    FrameCache &operator=(const FrameCache &) = delete;
+
+    // File name of the entry for key in dir.
+    static std::string Path(const std::string &dir, const std::string &key);
+
+    // Maps path if it holds the entry for key.
+    bool Open(const std::string &path, const std::string &key);
+
+    // Encodes the payloads, sequenced from firstSeq or not, and the CRCs of
+    // image over pages into a new entry at path, then maps it. The file
+    // appears complete or not at all.
+    bool Create(const std::string &path, const std::string &key, const std::vector<Payload> &payloads,
+                bool sequenced, uint32_t firstSeq, const Image &image, const std::vector<uint32_t> &pages,
+                unsigned pageSize, const CachedPlan &plan, std::string *err);
+
+    const std::vector<FrameRef> &Frames() const { return frames_; }
+    const std::vector<CrcRange> &Ranges() const { return ranges_; }
+    const CachedPlan &Plan() const { return plan_; }
+    uint32_t FirstSeq() const { return firstSeq_; }
+    size_t Bytes() const { return size_; }
+
+private:
+    void Close();
+
+    void *map_ = nullptr;
+    size_t size_ = 0;
+    std::vector<FrameRef> frames_;
+    std::vector<CrcRange> ranges_;
+    CachedPlan plan_;
+    uint32_t firstSeq_ = 0;
+};
+
+#endif
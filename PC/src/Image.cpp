@@ -0,0 +1,242 @@
+#include "Image.h"
+
+#include "Crc16.h"
+#include "Protocol.h"
+
+#include <fstream>
+
+namespace
+{
+
+int HexNibble(char c)
+{
+    if (c >= '0' && c <= '9')
+        return c - '0';
+    if (c >= 'A' && c <= 'F')
+        return c - 'A' + 10;
+    if (c >= 'a' && c <= 'f')
+        return c - 'a' + 10;
+    return -1;
+}
+
+bool HexBytes(const std::string &line, std::vector<uint8_t> &out)
+{
+    out.clear();
+    for (size_t i = 1; i + 1 < line.size(); i += 2)
+    {
+        int hi = HexNibble(line[i]);
+        int lo = HexNibble(line[i + 1]);
+        if (hi < 0 || lo < 0)
+            return false;
+        out.push_back((uint8_t)(hi << 4 | lo));
+    }
+    return true;
+}
+
+}
+
+bool Image::LoadHex(const std::string &path, std::string *err)
+{
+    std::ifstream in(path);
+    std::string line;
+    std::vector<uint8_t> rec;
+    uint32_t base = 0;
+    unsigned lineNo = 0;
+
+    if (!in)
+    {
+        *err = path + ": cannot open";
+        return false;
+    }
+
+    words_.clear();
+    while (std::getline(in, line))
+    {
+        lineNo++;
+        while (!line.empty() && (line.back() == '\r' || line.back() == ' '))
+            line.pop_back();
+        if (line.empty())
+            continue;
+
+        uint8_t sum = 0;
+        if (line[0] != ':' || !HexBytes(line, rec) || rec.size() < 5 || rec.size() != rec[0] + 5u)
+        {
+            *err = path + ":" + std::to_string(lineNo) + ": malformed record";
+            return false;
+        }
+        for (uint8_t b : rec)
+            sum += b;
+        if (sum != 0)
+        {
+            *err = path + ":" + std::to_string(lineNo) + ": checksum error";
+            return false;
+        }
+
+        uint32_t offset = (rec[1] << 8) | rec[2];
+        switch (rec[3])
+        {
+        case 0:
+            for (unsigned i = 0; i < rec[0]; i++)
+            {
+                uint32_t hexAddress = base + offset + i;
+                unsigned byte = hexAddress & 3;
+                if (byte == 3)
+                    continue;           // Phantom byte.
+                uint32_t address = (hexAddress & ~3u) / 2;
+                auto it = words_.emplace(address, BLANK).first;
+                it->second = (it->second & ~(0xFFu << (8 * byte))) | ((uint32_t)rec[4 + i] << (8 * byte));
+            }
+            break;
+        case 1:
+            return true;
+        case 2:
+            base = ((rec[4] << 8) | rec[5]) << 4;
+            break;
+        case 4:
+            base = (uint32_t)((rec[4] << 8) | rec[5]) << 16;
+            break;
+        default:
+            break;
+        }
+    }
+    return true;
+}
+
+uint64_t Image::Hash() const
+{
+    uint64_t hash = 0xCBF29CE484222325ull;
+    auto add = [&hash](uint32_t v, int bytes) {
+        for (int i = 0; i < bytes; i++, v >>= 8)
+            hash = (hash ^ (v & 0xFF)) * 0x100000001B3ull;
+    };
+
+    for (const auto &w : words_)
+    {
+        add(w.first, 3);
+        add(w.second, 3);
+    }
+    return hash;
+}
+
+size_t Image::Restrict(const BootInfo &info)
+{
+    size_t dropped = 0;
+
+    for (auto it = words_.begin(); it != words_.end();)
+    {
+        bool keep = it->first >= info.appFirst && it->first <= info.appLast;
+        for (const auto &r : info.excluded)
+        {
+            if (it->first >= r.first && it->first <= r.second)
+                keep = false;
+        }
+        if (keep)
+        {
+            ++it;
+        }
+        else
+        {
+            it = words_.erase(it);
+            dropped++;
+        }
+    }
+    return dropped;
+}
+
+size_t Image::StripBlank(unsigned pageSize, bool keepPages)
+{
+    size_t dropped = 0;
+    auto it = words_.begin();
+
+    while (it != words_.end())
+    {
+        uint32_t page = it->first & ~(uint32_t)(pageSize - 1);
+        auto first = it;
+        bool allBlank = true;
+
+        for (; it != words_.end() && (it->first & ~(uint32_t)(pageSize - 1)) == page; ++it)
+        {
+            if (it->second != BLANK)
+                allBlank = false;
+        }
+
+        auto w = first;
+        if (allBlank && keepPages)
+            ++w;
+        while (w != it)
+        {
+            if (w->second == BLANK)
+            {
+                w = words_.erase(w);
+                dropped++;
+            }
+            else
+            {
+                ++w;
+            }
+        }
+    }
+    return dropped;
+}
+
+uint32_t Image::Word(uint32_t address) const
+{
+    auto it = words_.find(address);
+    return (it == words_.end()) ? BLANK : it->second;
+}
+
+std::vector<Run> Image::Runs(uint32_t split) const
+{
+    std::vector<Run> runs;
+
+    for (const auto &w : words_)
+    {
+        if (runs.empty() || runs.back().address + 2 * runs.back().words.size() != w.first ||
+            (split && (w.first % split) == 0))
+        {
+            runs.push_back(Run{w.first, {}});
+        }
+        runs.back().words.push_back(w.second);
+    }
+    return runs;
+}
+
+std::vector<uint32_t> Image::Pages(unsigned pageSize) const
+{
+    std::vector<uint32_t> pages;
+
+    for (const auto &w : words_)
+    {
+        uint32_t page = w.first & ~(uint32_t)(pageSize - 1);
+        if (pages.empty() || pages.back() != page)
+            pages.push_back(page);
+    }
+    return pages;
+}
+
+uint16_t Image::Crc(uint32_t address, uint32_t count) const
+{
+    uint16_t crc = 0;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        uint32_t w = Word(address + 2 * i);
+        uint8_t b[4] = {(uint8_t)w, (uint8_t)(w >> 8), (uint8_t)(w >> 16), 0};
+        crc = Crc16Update(crc, b, 4);
+    }
+    return crc;
+}
+
+std::vector<std::pair<uint32_t, uint32_t>> PageRanges(const std::vector<uint32_t> &pages, unsigned pageSize)
+{
+    std::vector<std::pair<uint32_t, uint32_t>> ranges;
+
+    for (uint32_t p : pages)
+    {
+        if (!ranges.empty() && ranges.back().second + 2 == p)
+            ranges.back().second = p + pageSize - 2;
+        else
+            ranges.emplace_back(p, p + pageSize - 2);
+    }
+    return ranges;
+}
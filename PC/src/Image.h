@@ -0,0 +1,67 @@
+// Firmware image as the boot loader sees it: 24-bit instructions by
+// program address (Intel HEX address / 2), phantom bytes dropped.
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+struct BootInfo;
+
+const uint32_t BLANK = 0x00FFFFFF;
+
+struct Run
+{
+    uint32_t address;
+    std::vector<uint32_t> words;
+};
+
+class Image
+{
+public:
+    bool LoadHex(const std::string &path, std::string *err);
+
+    // Drops what the boot loader would not program: outside the
+    // application range or in an excluded range. Returns the number of
+    // instructions dropped.
+    size_t Restrict(const BootInfo &info);
+
+    // Drops blank instructions, an erased page holds them already. With
+    // keepPages a page made of blank instructions only keeps its first one,
+    // so that the boot loader still erases it.
+    size_t StripBlank(unsigned pageSize, bool keepPages);
+
+    uint32_t Word(uint32_t address) const;
+    size_t Size() const { return words_.size(); }
+    bool Empty() const { return words_.empty(); }
+
+    // Contiguous runs of instructions, none crossing a multiple of split
+    // (program addresses, 0 for no limit).
+    std::vector<Run> Runs(uint32_t split = 0) const;
+
+    // First program address of every page holding an instruction.
+    std::vector<uint32_t> Pages(unsigned pageSize) const;
+
+    // What READ_CRC returns for count instructions from address, with
+    // blank instructions where the image has none.
+    uint16_t Crc(uint32_t address, uint32_t count) const;
+
+    // FNV-1a over the addresses and instructions, names the cached frames
+    // of the image.
+    uint64_t Hash() const;
+
+    const std::map<uint32_t, uint32_t> &Words() const { return words_; }
+    void Set(uint32_t address, uint32_t word) { words_[address] = word & BLANK; }
+
+private:
+    std::map<uint32_t, uint32_t> words_;
+};
+
+// Merges sorted page addresses into [first, last] program address ranges.
+std::vector<std::pair<uint32_t, uint32_t>> PageRanges(const std::vector<uint32_t> &pages, unsigned pageSize);
+
+#endif
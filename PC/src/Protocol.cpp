@@ -0,0 +1,122 @@
+#include "Protocol.h"
+
+#include <cstdio>
+
+namespace
+{
+
+uint32_t Get16(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8);
+}
+
+uint32_t Get32(const uint8_t *p)
+{
+    return p[0] | (p[1] << 8) | (p[2] << 16) | ((uint32_t)p[3] << 24);
+}
+
+}
+
+bool BootInfo::Parse(const uint8_t *resp, size_t len)
+{
+    if (len < 2)
+        return false;
+    major = resp[0];
+    minor = resp[1];
+    if (len < 3)
+        return true;
+
+    window = resp[2];
+    for (size_t i = 3; i + 2 <= len;)
+    {
+        uint8_t type = resp[i];
+        size_t n = resp[i + 1];
+        const uint8_t *v = &resp[i + 2];
+        i += 2 + n;
+        if (i > len)
+            return false;
+
+        switch (type)
+        {
+        case BI_FRAME_SIZE:
+            if (n >= 2)
+                frameSize = Get16(v);
+            break;
+        case BI_RX_WINDOW:
+            if (n >= 1)
+                window = v[0];
+            break;
+        case BI_COMMANDS:
+            if (n >= 4)
+                commands = Get32(v);
+            break;
+        case BI_FLASH_GEOMETRY:
+            if (n >= 4)
+            {
+                pageSize = Get16(v);
+                rowSize = Get16(v + 2);
+            }
+            break;
+        case BI_APP_RANGE:
+            if (n >= 8)
+            {
+                appFirst = Get32(v);
+                appLast = Get32(v + 4);
+            }
+            break;
+        case BI_EXCLUDED_RANGES:
+            excluded.clear();
+            for (size_t k = 0; k + 8 <= n; k += 8)
+                excluded.emplace_back(Get32(v + k), Get32(v + k + 4));
+            break;
+        case BI_DEVICE_ID:
+            if (n >= 4)
+            {
+                devId = Get16(v);
+                devRev = Get16(v + 2);
+            }
+            break;
+        case BI_BAUD_RATES:
+            baudRates.clear();
+            for (size_t k = 0; k + 4 <= n; k += 4)
+                baudRates.push_back(Get32(v + k));
+            break;
+        case BI_FEATURES:
+            if (n >= 4)
+                features = Get32(v);
+            break;
+        default:
+            // Newer entry, skip it.
+            break;
+        }
+    }
+    return true;
+}
+
+std::string BootInfo::Describe() const
+{
+    char buf[256];
+
+    snprintf(buf, sizeof(buf),
+             "boot loader V%u.%02u, frame %u bytes, window %u, commands 0x%08X, "
+             "features 0x%X, app 0x%06X-0x%06X, page 0x%X, DEVID 0x%04X rev 0x%04X",
+             major, minor, frameSize, window, commands, features, appFirst, appLast, pageSize, devId, devRev);
+    return buf;
+}
+
+bool ParseBatch(const uint8_t *resp, size_t len, std::vector<std::pair<uint8_t, std::vector<uint8_t>>> *subs,
+                bool *complete)
+{
+    subs->clear();
+    if (len < 2)
+        return false;
+    *complete = resp[1] == 0;
+    for (size_t i = 2; i < len;)
+    {
+        if (i + 2 > len || i + 2 + resp[i + 1] > len)
+            return false;
+        subs->emplace_back(resp[i], std::vector<uint8_t>(resp + i + 2, resp + i + 2 + resp[i + 1]));
+        i += 2 + resp[i + 1];
+    }
+    return subs->size() == resp[0];
+}
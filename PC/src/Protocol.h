@@ -0,0 +1,94 @@
+// Commands and READ_BOOT_INFO layout of the boot loader, see T_COMMANDS and
+// BuildBootInfo() in Framework.c.
+#ifndef PROTOCOL_H
+#define PROTOCOL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+enum Command : uint8_t
+{
+    READ_BOOT_INFO = 1,
+    ERASE_FLASH,
+    PROGRAM_FLASH,
+    READ_CRC,
+    JMP_TO_APP,
+    ERASE_RANGE,
+    READ_STATS,
+    CHANGE_BAUD,
+    PROGRAM_BLOCK,
+    PROGRAM_PACKED,
+    PROGRAM_COMPRESSED,
+    PROGRAM_PATCH,
+    BATCH,
+
+    SEQ_ACK = 0x7E,
+    SEQ_NAK = 0x7F,
+};
+
+const uint8_t SEQ_FLAG = 0x80;
+
+// BATCH limits of HandleBatch() in Framework.c: the response holds at most
+// BATCH_RESP_SIZE bytes, a sub-command only runs while BATCH_MAX_SUB_RESP
+// bytes are left for its response, and a list of more than
+// BATCH_MAX_COUNT sub-commands is refused.
+const size_t BATCH_RESP_SIZE = 996;
+const size_t BATCH_MAX_SUB_RESP = 128;
+const size_t BATCH_MAX_COUNT = 255;
+
+// Capability descriptor entry types (T_BOOT_INFO_TYPES).
+enum BootInfoType : uint8_t
+{
+    BI_FRAME_SIZE = 1,
+    BI_RX_WINDOW,
+    BI_COMMANDS,
+    BI_FLASH_GEOMETRY,
+    BI_APP_RANGE,
+    BI_EXCLUDED_RANGES,
+    BI_DEVICE_ID,
+    BI_BAUD_RATES,
+    BI_FEATURES,
+};
+
+// BI_FEATURES bits (SUPPORTED_FEATURES).
+const uint32_t FEATURE_LAZY_ERASE = 0x01;      // Pages erased when first written.
+
+// Defaults are what the original boot loader does, which answers
+// READ_BOOT_INFO with the two version bytes only.
+struct BootInfo
+{
+    unsigned major = 0;
+    unsigned minor = 0;
+    unsigned window = 0;                // 0: no sequenced frames.
+    unsigned frameSize = 1000;          // FRAMEWORK_BUFF_SIZE, CRC included.
+    uint32_t commands = (1u << READ_BOOT_INFO) | (1u << ERASE_FLASH) |
+                        (1u << PROGRAM_FLASH) | (1u << READ_CRC) | (1u << JMP_TO_APP);
+    unsigned pageSize = 0x800;          // In program addresses.
+    unsigned rowSize = 0x100;
+    uint32_t appFirst = 0;
+    uint32_t appLast = 0x0557FE;
+    std::vector<std::pair<uint32_t, uint32_t>> excluded = {{0x7FC000, 0x7FFFFF}, {0xF80000, 0xF80012}};
+    unsigned devId = 0;
+    unsigned devRev = 0;
+    std::vector<uint32_t> baudRates;
+    uint32_t features = 0;
+
+    bool Supports(Command cmd) const { return (commands >> cmd) & 1; }
+    bool Has(uint32_t feature) const { return (features & feature) == feature; }
+    // Data of the largest sequenced frame: command, sequence number and
+    // CRC take the rest.
+    size_t MaxPayload() const { return frameSize - 4; }
+    bool Parse(const uint8_t *resp, size_t len);
+    std::string Describe() const;
+};
+
+// Splits a BATCH response into command and response of each sub-command
+// executed, in order. *complete is false if the boot loader stopped
+// before the end of the list. False if the response is malformed.
+bool ParseBatch(const uint8_t *resp, size_t len, std::vector<std::pair<uint8_t, std::vector<uint8_t>>> *subs,
+                bool *complete);
+
+#endif
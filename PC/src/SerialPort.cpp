@@ -0,0 +1,162 @@
+#include "SerialPort.h"
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+namespace
+{
+
+struct Speed
+{
+    unsigned baud;
+    speed_t code;
+};
+
+const Speed speeds[] =
+{
+    {9600, B9600}, {19200, B19200}, {38400, B38400}, {57600, B57600},
+    {115200, B115200}, {230400, B230400}, {460800, B460800}, {500000, B500000},
+    {921600, B921600}, {1000000, B1000000}, {1500000, B1500000},
+    {2000000, B2000000}, {3000000, B3000000},
+};
+
+bool SpeedCode(unsigned baud, speed_t *code)
+{
+    for (const Speed &s : speeds)
+    {
+        if (s.baud == baud)
+        {
+            *code = s.code;
+            return true;
+        }
+    }
+    return false;
+}
+
+}
+
+SerialPort::~SerialPort()
+{
+    Close();
+}
+
+bool SerialPort::Open(const std::string &path, unsigned baud, std::string *err)
+{
+    Close();
+
+    fd_ = open(path.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK);
+    if (fd_ < 0)
+    {
+        *err = path + ": " + strerror(errno);
+        return false;
+    }
+    path_ = path;
+
+    struct termios tio;
+    if (tcgetattr(fd_, &tio) != 0)
+    {
+        *err = path + ": " + strerror(errno);
+        Close();
+        return false;
+    }
+    cfmakeraw(&tio);
+    tio.c_cflag |= CLOCAL | CREAD;
+    tio.c_cflag &= ~(CSTOPB | CRTSCTS);
+    tio.c_cc[VMIN] = 0;
+    tio.c_cc[VTIME] = 0;
+    if (tcsetattr(fd_, TCSANOW, &tio) != 0)
+    {
+        *err = path + ": " + strerror(errno);
+        Close();
+        return false;
+    }
+
+    if (!SetBaud(baud, err))
+    {
+        Close();
+        return false;
+    }
+    Flush();
+    return true;
+}
+
+void SerialPort::Close()
+{
+    if (fd_ >= 0)
+        close(fd_);
+    fd_ = -1;
+}
+
+bool SerialPort::SetBaud(unsigned baud, std::string *err)
+{
+    speed_t code;
+    struct termios tio;
+
+    if (!SpeedCode(baud, &code))
+    {
+        *err = "unsupported baud rate " + std::to_string(baud);
+        return false;
+    }
+    if (tcgetattr(fd_, &tio) != 0 || cfsetispeed(&tio, code) != 0 ||
+        cfsetospeed(&tio, code) != 0 || tcsetattr(fd_, TCSADRAIN, &tio) != 0)
+    {
+        *err = path_ + ": " + strerror(errno);
+        return false;
+    }
+    return true;
+}
+
+bool SerialPort::Write(const uint8_t *data, size_t len, int timeoutMs)
+{
+    while (len)
+    {
+        ssize_t n = write(fd_, data, len);
+        if (n > 0)
+        {
+            data += n;
+            len -= (size_t)n;
+            continue;
+        }
+        if (n < 0 && errno != EAGAIN && errno != EINTR)
+            return false;
+
+        struct pollfd pfd = {fd_, POLLOUT, 0};
+        if (poll(&pfd, 1, timeoutMs) <= 0)
+            return false;
+    }
+    return true;
+}
+
+ssize_t SerialPort::Read(uint8_t *data, size_t len, int timeoutMs)
+{
+    struct pollfd pfd = {fd_, POLLIN, 0};
+    int r = poll(&pfd, 1, timeoutMs);
+
+    if (r < 0)
+        return (errno == EINTR) ? 0 : -1;
+    if (r == 0)
+        return 0;
+    if (pfd.revents & (POLLERR | POLLNVAL))
+        return -1;
+
+    ssize_t n = read(fd_, data, len);
+    if (n < 0)
+        return (errno == EAGAIN || errno == EINTR) ? 0 : -1;
+    if (n == 0 && (pfd.revents & POLLHUP))
+        return -1;
+    return n;
+}
+
+void SerialPort::Drain()
+{
+    tcdrain(fd_);
+}
+
+void SerialPort::Flush()
+{
+    tcflush(fd_, TCIFLUSH);
+}
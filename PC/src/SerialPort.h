@@ -0,0 +1,44 @@
+// Raw, non-blocking serial port (termios). Works on USB/RS-232 adapters
+// and on pseudo terminals, e.g. a simulated boot loader.
+#ifndef SERIAL_PORT_H
+#define SERIAL_PORT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <sys/types.h>
+
+class SerialPort
+{
+public:
+    SerialPort() = default;
+    ~SerialPort();
+    SerialPort(const SerialPort &) = delete;
+    SerialPort &operator=(const SerialPort &) = delete;
+
+    bool Open(const std::string &path, unsigned baud, std::string *err);
+    void Close();
+    bool SetBaud(unsigned baud, std::string *err);
+
+    // Writes everything, waiting for room as long as timeoutMs allows.
+    bool Write(const uint8_t *data, size_t len, int timeoutMs);
+
+    // Waits up to timeoutMs for data, returns the number of bytes read,
+    // 0 on timeout or -1 on error.
+    ssize_t Read(uint8_t *data, size_t len, int timeoutMs);
+
+    // Waits until everything written has left the port.
+    void Drain();
+
+    // Drops anything received but not read yet.
+    void Flush();
+
+    int Fd() const { return fd_; }
+    const std::string &Path() const { return path_; }
+
+private:
+    int fd_ = -1;
+    std::string path_;
+};
+
+#endif
@@ -0,0 +1,396 @@
+#include "Session.h"
+
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+namespace
+{
+
+// Consecutive timeouts before giving up on the boot loader.
+const int MAX_RETRIES = 5;
+const int WRITE_TIMEOUT_MS = 2000;
+// Time the boot loader gets to answer at a new baud rate.
+const int BAUD_PROBE_MS = 250;
+
+int64_t NowMs()
+{
+    using namespace std::chrono;
+    return duration_cast<milliseconds>(steady_clock::now().time_since_epoch()).count();
+}
+
+}
+
+void Session::Send(uint8_t cmd, uint32_t seq, const std::vector<uint8_t> &data)
+{
+    std::vector<uint8_t> plain;
+
+    plain.reserve(data.size() + 2);
+    if (sequenced_)
+    {
+        plain.push_back(cmd | SEQ_FLAG);
+        plain.push_back((uint8_t)seq);
+    }
+    else
+    {
+        plain.push_back(cmd);
+    }
+    plain.insert(plain.end(), data.begin(), data.end());
+
+    tx_.clear();
+    frame::Encode(plain.data(), plain.size(), tx_);
+    port_.Write(tx_.data(), tx_.size(), WRITE_TIMEOUT_MS);
+    stats_.bytesSent += tx_.size();
+    stats_.framesSent++;
+}
+
+bool Session::Receive(std::vector<uint8_t> *data, int timeoutMs)
+{
+    int64_t deadline = NowMs() + timeoutMs;
+
+    for (;;)
+    {
+        while (rawPos_ < raw_.size())
+        {
+            if (parser_.Feed(raw_[rawPos_++]))
+            {
+                *data = parser_.Data();
+                stats_.framesReceived++;
+                return true;
+            }
+        }
+
+        int64_t left = deadline - NowMs();
+        if (left <= 0)
+            return false;
+
+        raw_.resize(4096);
+        rawPos_ = 0;
+        ssize_t n = port_.Read(raw_.data(), raw_.size(), (int)left);
+        raw_.resize(n > 0 ? n : 0);
+        if (n < 0)
+            return false;
+        stats_.bytesReceived += n;
+    }
+}
+
+bool Session::Connect(int timeoutMs, std::string *err)
+{
+    int64_t deadline = NowMs() + timeoutMs;
+    std::vector<uint8_t> resp;
+
+    sequenced_ = false;
+    info_ = BootInfo();
+    port_.Flush();
+    raw_.clear();
+    rawPos_ = 0;
+
+    // The board may still be resetting, ask until it answers.
+    for (;;)
+    {
+        std::string ignored;
+        if (Command(READ_BOOT_INFO, {}, &resp, 200, &ignored))
+            break;
+        if (NowMs() >= deadline)
+        {
+            *err = port_.Path() + ": no answer to READ_BOOT_INFO";
+            return false;
+        }
+    }
+
+    if (!info_.Parse(resp.data(), resp.size()))
+    {
+        *err = "malformed boot info";
+        return false;
+    }
+
+    if (info_.window > 0)
+    {
+        // A sequenced READ_BOOT_INFO starts the session at its sequence number.
+        sequenced_ = true;
+        nextSeq_ = 0;
+        if (!Command(READ_BOOT_INFO, {}, &resp, 1000, err))
+            return false;
+    }
+    return true;
+}
+
+bool Session::Command(uint8_t cmd, const std::vector<uint8_t> &data, std::vector<uint8_t> *resp,
+                      int timeoutMs, std::string *err)
+{
+    if (sequenced_)
+    {
+        std::vector<std::vector<uint8_t>> resps;
+        if (!Stream({Payload{cmd, data}}, &resps, timeoutMs, err))
+            return false;
+        *resp = resps[0];
+        return true;
+    }
+    return Exchange(cmd, [&]() { Send(cmd, 0, data); }, resp, timeoutMs, err);
+}
+
+bool Session::Exchange(uint8_t cmd, const std::function<void()> &send, std::vector<uint8_t> *resp,
+                       int timeoutMs, std::string *err)
+{
+    std::vector<uint8_t> rx;
+
+    for (int retry = 0; retry < MAX_RETRIES; retry++)
+    {
+        if (retry > 0)
+            stats_.retransmits++;
+        send();
+        stats_.roundTrips++;
+
+        int64_t deadline = NowMs() + timeoutMs;
+        int64_t left;
+        while ((left = deadline - NowMs()) > 0 && Receive(&rx, (int)left))
+        {
+            if (!rx.empty() && rx[0] == cmd)
+            {
+                resp->assign(rx.begin() + 1, rx.end());
+                return true;
+            }
+        }
+    }
+    *err = "no response to command " + std::to_string(cmd);
+    return false;
+}
+
+bool Session::Stream(const std::vector<Payload> &payloads, std::vector<std::vector<uint8_t>> *resps,
+                     int timeoutMs, std::string *err)
+{
+    return Stream(
+        payloads.size(), [&](size_t i) { return payloads[i].cmd; },
+        [&](size_t i, uint32_t seq) { Send(payloads[i].cmd, seq, payloads[i].data); }, resps, timeoutMs, err);
+}
+
+bool Session::StreamFrames(const std::vector<FrameRef> &frames, std::vector<std::vector<uint8_t>> *resps,
+                           int timeoutMs, std::string *err)
+{
+    return Stream(
+        frames.size(), [&](size_t i) { return frames[i].cmd; },
+        [&](size_t i, uint32_t) {
+            port_.Write(frames[i].data, frames[i].len, WRITE_TIMEOUT_MS);
+            stats_.bytesSent += frames[i].len;
+            stats_.framesSent++;
+        },
+        resps, timeoutMs, err);
+}
+
+bool Session::Batch(const std::vector<Payload> &cmds, size_t respLen, std::vector<std::vector<uint8_t>> *resps,
+                    int timeoutMs, std::string *err)
+{
+    if (!info_.Supports(BATCH) || cmds.size() < 2)
+        return Stream(cmds, resps, timeoutMs, err);
+
+    std::vector<size_t> pending(cmds.size());
+    for (size_t i = 0; i < pending.size(); i++)
+        pending[i] = i;
+    resps->assign(cmds.size(), {});
+
+    while (!pending.empty())
+    {
+        std::vector<Payload> list;
+        for (size_t i : pending)
+            list.push_back(cmds[i]);
+        std::vector<size_t> counts;
+        std::vector<Payload> batches = EncodeBatches(list, info_.MaxPayload(), respLen, &counts);
+        std::vector<std::vector<uint8_t>> batchResps;
+        if (!Stream(batches, &batchResps, timeoutMs, err))
+            return false;
+
+        std::vector<size_t> rest;
+        size_t first = 0;
+        for (size_t b = 0; b < batches.size(); first += counts[b], b++)
+        {
+            std::vector<std::pair<uint8_t, std::vector<uint8_t>>> subs;
+            bool complete;
+            size_t done = 0;
+            if (ParseBatch(batchResps[b].data(), batchResps[b].size(), &subs, &complete))
+            {
+                for (; done < subs.size() && done < counts[b] && subs[done].first == list[first + done].cmd; done++)
+                    (*resps)[pending[first + done]] = std::move(subs[done].second);
+            }
+            for (size_t i = done; i < counts[b]; i++)
+                rest.push_back(pending[first + i]);
+        }
+        if (rest.size() == pending.size())
+        {
+            *err = "BATCH of command " + std::to_string(cmds[pending[0]].cmd) + " not executed";
+            return false;
+        }
+        pending.swap(rest);
+    }
+    return true;
+}
+
+size_t Session::BatchFrames(const std::vector<Payload> &cmds, size_t respLen) const
+{
+    if (!info_.Supports(BATCH) || cmds.size() < 2)
+        return cmds.size();
+    return EncodeBatches(cmds, info_.MaxPayload(), respLen).size();
+}
+
+bool Session::Restart(uint32_t seq, std::string *err)
+{
+    std::vector<uint8_t> resp;
+
+    if (!sequenced_ || nextSeq_ == seq)
+        return true;
+    nextSeq_ = seq - 1;
+    return Command(READ_BOOT_INFO, {}, &resp, 1000, err);
+}
+
+bool Session::Stream(size_t count, const std::function<uint8_t(size_t)> &cmdOf,
+                     const std::function<void(size_t, uint32_t)> &send, std::vector<std::vector<uint8_t>> *resps,
+                     int timeoutMs, std::string *err)
+{
+    resps->assign(count, {});
+
+    if (!sequenced_)
+    {
+        for (size_t i = 0; i < count; i++)
+        {
+            if (!Exchange(cmdOf(i), [&]() { send(i, 0); }, &(*resps)[i], timeoutMs, err))
+                return false;
+            if (progress_)
+                progress_(i + 1);
+        }
+        return true;
+    }
+
+    // Go-back-N: payload i goes out with sequence number first + i.
+    const uint32_t first = nextSeq_;
+    const size_t window = std::min<size_t>(info_.window, 127);
+    size_t base = 0;                    // First payload not acknowledged.
+    size_t next = 0;                    // Next payload to send.
+    size_t reported = 0;
+    int timeouts = 0;
+    std::vector<uint8_t> rx;
+
+    while (base < count)
+    {
+        while (next < count && next - base < window)
+        {
+            send(next, first + next);
+            next++;
+        }
+
+        stats_.roundTrips++;
+        if (!Receive(&rx, timeoutMs))
+        {
+            if (++timeouts >= MAX_RETRIES)
+            {
+                *err = "boot loader stopped answering";
+                nextSeq_ = first + base;
+                return false;
+            }
+            stats_.retransmits += next - base;
+            next = base;
+            continue;
+        }
+        if (rx.size() < 2)
+            continue;
+
+        // Position of the frame rx refers to, relative to base.
+        size_t offset = (uint8_t)(rx[1] - (uint8_t)(first + base));
+        size_t outstanding = next - base;
+
+        if (rx[0] == SEQ_ACK)
+        {
+            // Duplicate acknowledge, rx[1] and everything before it is done.
+            if (offset < outstanding)
+            {
+                base += offset + 1;
+                timeouts = 0;
+            }
+        }
+        else if (rx[0] == SEQ_NAK)
+        {
+            // rx[1] is missing, go back to it.
+            if (offset < outstanding)
+            {
+                base += offset;
+                stats_.retransmits += next - base;
+                next = base;
+                timeouts = 0;
+            }
+        }
+        else if ((rx[0] & SEQ_FLAG) && offset < outstanding &&
+                 (rx[0] & ~SEQ_FLAG) == cmdOf(base + offset))
+        {
+            // Responses of frames before it got lost, their statuses stay empty.
+            (*resps)[base + offset].assign(rx.begin() + 2, rx.end());
+            base += offset + 1;
+            timeouts = 0;
+        }
+
+        if (progress_ && base > reported)
+        {
+            reported = base;
+            progress_(base);
+        }
+    }
+
+    nextSeq_ = first + count;
+    return true;
+}
+
+bool Session::ChangeBaud(unsigned baud, unsigned currentBaud, std::string *err)
+{
+    std::vector<uint8_t> req = {(uint8_t)baud, (uint8_t)(baud >> 8), (uint8_t)(baud >> 16), (uint8_t)(baud >> 24)};
+    std::vector<uint8_t> resp;
+
+    if (!info_.Supports(CHANGE_BAUD))
+    {
+        *err = "boot loader cannot change the baud rate";
+        return false;
+    }
+    if (!Command(CHANGE_BAUD, req, &resp, 1000, err))
+        return false;
+    if (resp.size() < 7 || resp[0] != 0)
+    {
+        *err = "baud rate " + std::to_string(baud) + " rejected";
+        return false;
+    }
+
+    // The boot loader switches once its response is out.
+    port_.Drain();
+    if (!port_.SetBaud(baud, err))
+        return false;
+
+    // It keeps the new rate once it gets a valid frame, and falls back
+    // after about a second without one.
+    for (int i = 0; i < 3; i++)
+    {
+        std::string ignored;
+        if (Command(READ_BOOT_INFO, {}, &resp, BAUD_PROBE_MS, &ignored))
+            return true;
+    }
+
+    *err = "no answer at " + std::to_string(baud) + " baud";
+    std::string ignored;
+    port_.SetBaud(currentBaud, &ignored);
+    // Wait for the boot loader to fall back as well.
+    std::this_thread::sleep_for(std::chrono::milliseconds(1500));
+    port_.Flush();
+    if (sequenced_)
+    {
+        // Resynchronize the sequence numbers.
+        sequenced_ = false;
+        info_.window = 0;
+        Connect(2000, &ignored);
+    }
+    return false;
+}
+
+void Session::Run()
+{
+    bool sequenced = sequenced_;
+
+    // Unsequenced, the boot loader leaves without answering.
+    sequenced_ = false;
+    Send(JMP_TO_APP, 0, {});
+    sequenced_ = sequenced;
+    port_.Drain();
+}
@@ -0,0 +1,115 @@
+// Command exchange with the boot loader over a serial port. Boot loaders
+// announcing a receive window get sequenced frames, up to window of them
+// outstanding (go-back-N), others one command at a time.
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include "Encoder.h"
+#include "Frame.h"
+#include "Protocol.h"
+#include "SerialPort.h"
+
+// A frame ready to send, escaped and with its CRC: SOH to EOT.
+struct FrameRef
+{
+    uint8_t cmd;
+    const uint8_t *data;
+    size_t len;
+};
+
+struct SessionStats
+{
+    uint64_t bytesSent = 0;             // On the wire, escaping included.
+    uint64_t bytesReceived = 0;
+    unsigned framesSent = 0;
+    unsigned framesReceived = 0;
+    unsigned retransmits = 0;
+    unsigned roundTrips = 0;            // Waits for a response.
+};
+
+class Session
+{
+public:
+    explicit Session(SerialPort &port) : port_(port) {}
+
+    // Reads the boot info, retrying for up to timeoutMs, and starts a
+    // sequenced session if the boot loader supports one.
+    bool Connect(int timeoutMs, std::string *err);
+
+    const BootInfo &Info() const { return info_; }
+    bool Sequenced() const { return sequenced_; }
+    const SessionStats &Stats() const { return stats_; }
+
+    // Executes one command, resp receives the response without the
+    // command (and sequence) byte.
+    bool Command(uint8_t cmd, const std::vector<uint8_t> &data, std::vector<uint8_t> *resp,
+                 int timeoutMs, std::string *err);
+
+    // Executes the commands in order, pipelined when sequenced. Responses
+    // are returned in the order of the payloads.
+    bool Stream(const std::vector<Payload> &payloads, std::vector<std::vector<uint8_t>> *resps,
+                int timeoutMs, std::string *err);
+
+    // Stream() of frames built already. Sequenced, frame i must carry
+    // sequence number NextSeq() + i.
+    bool StreamFrames(const std::vector<FrameRef> &frames, std::vector<std::vector<uint8_t>> *resps,
+                      int timeoutMs, std::string *err);
+
+    // Stream() of small commands, packed into BATCH frames if the boot
+    // loader supports them. Each command is answered with at most respLen
+    // bytes; those not executed, or whose BATCH response got lost, are
+    // sent again.
+    bool Batch(const std::vector<Payload> &cmds, size_t respLen, std::vector<std::vector<uint8_t>> *resps,
+               int timeoutMs, std::string *err);
+    // The number of frames Batch() sends when none is lost.
+    size_t BatchFrames(const std::vector<Payload> &cmds, size_t respLen) const;
+
+    // Makes seq the next sequence number, by a sequenced READ_BOOT_INFO
+    // with the one before it: the boot loader restarts its count there.
+    // That starts a new session, pages erased before it are erased again
+    // when written.
+    bool Restart(uint32_t seq, std::string *err);
+    uint32_t NextSeq() const { return nextSeq_; }
+
+    // Called by Stream() whenever more payloads are done, with their number.
+    void SetProgress(std::function<void(size_t)> progress) { progress_ = std::move(progress); }
+
+    // Switches both ends to baud, reverting if the boot loader does not
+    // answer at the new rate.
+    bool ChangeBaud(unsigned baud, unsigned currentBaud, std::string *err);
+
+    // JMP_TO_APP, the boot loader does not answer it.
+    void Run();
+
+private:
+    void Send(uint8_t cmd, uint32_t seq, const std::vector<uint8_t> &data);
+    // Sends an unsequenced command until its response arrives.
+    bool Exchange(uint8_t cmd, const std::function<void()> &send, std::vector<uint8_t> *resp, int timeoutMs,
+                  std::string *err);
+    // count commands, cmdOf(i) telling the command of the i-th and
+    // send(i, seq) sending it.
+    bool Stream(size_t count, const std::function<uint8_t(size_t)> &cmdOf,
+                const std::function<void(size_t, uint32_t)> &send, std::vector<std::vector<uint8_t>> *resps,
+                int timeoutMs, std::string *err);
+    // Waits for the next valid frame, false on timeout or port error.
+    bool Receive(std::vector<uint8_t> *data, int timeoutMs);
+
+    SerialPort &port_;
+    frame::Parser parser_;
+    BootInfo info_;
+    bool sequenced_ = false;
+    uint32_t nextSeq_ = 0;
+    SessionStats stats_;
+    std::function<void(size_t)> progress_;
+    std::vector<uint8_t> raw_;
+    std::vector<uint8_t> tx_;
+    size_t rawPos_ = 0;
+};
+
+#endif
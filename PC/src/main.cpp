@@ -0,0 +1,194 @@
+// dspic-flash: programs an Intel HEX image through the dsPIC33 serial boot
+// loader, on several boards at once when given several ports.
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <getopt.h>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "Flasher.h"
+#include "Image.h"
+#include "SerialPort.h"
+
+namespace
+{
+
+struct Options
+{
+    std::vector<std::string> ports;
+    std::string hex;
+    std::string base;
+    FlashOptions flash;
+};
+
+void Usage()
+{
+    fprintf(stderr,
+            "usage: dspic-flash -p PORT [-p PORT ...] [options] IMAGE.hex\n"
+            "  -p, --port PATH          serial port (or pty) of the boot loader, once\n"
+            "                           per board to update several in parallel\n"
+            "  -b, --baud N             baud rate the boot loader listens at (460800)\n"
+            "  -s, --switch-baud N      switch to N baud for the transfer (CHANGE_BAUD)\n"
+            "  -m, --mode MODE          auto, hex, block, packed, lz or patch (auto)\n"
+            "  -B, --base FILE          image installed now, for patch mode (checked\n"
+            "                           with READ_CRC first)\n"
+            "  -e, --erase WHAT         auto, all, range or none (auto: none if the boot\n"
+            "                           loader erases pages on first write, else the\n"
+            "                           pages of the image with ERASE_RANGE, else all)\n"
+            "  -t, --connect-timeout MS time to wait for the boot loader (5000)\n"
+            "  -n, --no-verify          skip the READ_CRC check\n"
+            "      --no-batch           one frame per READ_CRC or ERASE_RANGE even if\n"
+            "                           the boot loader takes BATCH\n"
+            "  -r, --run                start the application when done\n"
+            "  -C, --cache DIR          keep the encoded frames of each image in DIR\n"
+            "                           ($XDG_CACHE_HOME/dspic-flash)\n"
+            "      --no-cache           encode the image every time\n");
+}
+
+bool ParseOptions(int argc, char **argv, Options *opt)
+{
+    static const struct option longOptions[] = {
+        {"port", required_argument, nullptr, 'p'},
+        {"baud", required_argument, nullptr, 'b'},
+        {"switch-baud", required_argument, nullptr, 's'},
+        {"mode", required_argument, nullptr, 'm'},
+        {"base", required_argument, nullptr, 'B'},
+        {"erase", required_argument, nullptr, 'e'},
+        {"connect-timeout", required_argument, nullptr, 't'},
+        {"no-verify", no_argument, nullptr, 'n'},
+        {"no-batch", no_argument, nullptr, 'A'},
+        {"run", no_argument, nullptr, 'r'},
+        {"cache", required_argument, nullptr, 'C'},
+        {"no-cache", no_argument, nullptr, 'N'},
+        {"help", no_argument, nullptr, 'h'},
+        {nullptr, 0, nullptr, 0},
+    };
+    int c;
+
+    if (getenv("XDG_CACHE_HOME") && *getenv("XDG_CACHE_HOME"))
+        opt->flash.cacheDir = std::string(getenv("XDG_CACHE_HOME")) + "/dspic-flash";
+    else if (getenv("HOME"))
+        opt->flash.cacheDir = std::string(getenv("HOME")) + "/.cache/dspic-flash";
+    while ((c = getopt_long(argc, argv, "p:b:s:m:B:e:t:nrC:h", longOptions, nullptr)) != -1)
+    {
+        switch (c)
+        {
+        case 'p': opt->ports.push_back(optarg); break;
+        case 'b': opt->flash.baud = strtoul(optarg, nullptr, 0); break;
+        case 's': opt->flash.switchBaud = strtoul(optarg, nullptr, 0); break;
+        case 'm': opt->flash.mode = optarg; break;
+        case 'B': opt->base = optarg; break;
+        case 'e': opt->flash.erase = optarg; break;
+        case 't': opt->flash.connectTimeoutMs = atoi(optarg); break;
+        case 'n': opt->flash.verify = false; break;
+        case 'A': opt->flash.batch = false; break;
+        case 'r': opt->flash.run = true; break;
+        case 'C': opt->flash.cacheDir = optarg; break;
+        case 'N': opt->flash.cacheDir.clear(); break;
+        default: return false;
+        }
+    }
+    if (optind + 1 != argc || opt->ports.empty())
+        return false;
+    opt->hex = argv[optind];
+    return true;
+}
+
+struct Board
+{
+    std::string port;
+    FlashReport report;
+    std::string error;
+};
+
+// One board: opens its port and updates it, whatever the others do.
+void FlashBoard(Flasher &flasher, unsigned baud, Board *board)
+{
+    SerialPort port;
+
+    if (!port.Open(board->port, baud, &board->error))
+        return;
+    if (!flasher.Flash(port, &board->report))
+        board->error = board->report.error;
+}
+
+}
+
+int main(int argc, char **argv)
+{
+    Options opt;
+    std::string err;
+    Image image;
+    Image base;
+
+    if (!ParseOptions(argc, argv, &opt))
+    {
+        Usage();
+        return 2;
+    }
+    if (!image.LoadHex(opt.hex, &err) || (!opt.base.empty() && !base.LoadHex(opt.base, &err)))
+    {
+        fprintf(stderr, "%s\n", err.c_str());
+        return 1;
+    }
+
+    std::vector<Board> boards(opt.ports.size());
+    for (size_t i = 0; i < boards.size(); i++)
+        boards[i].port = opt.ports[i];
+
+    Flasher flasher(image, base, opt.flash);
+    if (boards.size() == 1)
+    {
+        flasher.SetLog([](const SerialPort &, const std::string &line) { printf("%s\n", line.c_str()); });
+        FlashBoard(flasher, opt.flash.baud, &boards[0]);
+        if (!boards[0].error.empty())
+        {
+            fprintf(stderr, "%s\n", boards[0].error.c_str());
+            return 1;
+        }
+        printf("%s\n", DescribeReport(boards[0].report).c_str());
+        return boards[0].report.ok ? 0 : 1;
+    }
+
+    // Several boards: a thread each, the image and the encoded frames are
+    // shared. Lines are prefixed with the port, progress goes in 10 % steps.
+    std::mutex outputLock;
+    flasher.SetLog([&outputLock](const SerialPort &port, const std::string &line) {
+        std::lock_guard<std::mutex> lock(outputLock);
+        printf("[%s] %s\n", port.Path().c_str(), line.c_str());
+        fflush(stdout);
+    });
+    flasher.SetProgress([&outputLock](const SerialPort &port, size_t done, size_t total) {
+        if (done * 10 / total == (done - 1) * 10 / total)
+            return;
+        std::lock_guard<std::mutex> lock(outputLock);
+        printf("[%s] programmed %zu %%\n", port.Path().c_str(), done * 100 / total);
+        fflush(stdout);
+    });
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> threads;
+    for (Board &board : boards)
+        threads.emplace_back(FlashBoard, std::ref(flasher), opt.flash.baud, &board);
+    for (std::thread &t : threads)
+        t.join();
+    double total = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    unsigned ok = 0;
+    for (const Board &board : boards)
+    {
+        if (!board.error.empty())
+        {
+            printf("[%s] FAILED: %s\n", board.port.c_str(), board.error.c_str());
+            continue;
+        }
+        std::string summary = DescribeReport(board.report);
+        printf("[%s] %s\n", board.port.c_str(), summary.substr(0, summary.find('\n')).c_str());
+        ok += board.report.ok;
+    }
+    printf("%u of %zu boards updated in %.2f s\n", ok, boards.size(), total);
+    return ok == boards.size() ? 0 : 1;
+}
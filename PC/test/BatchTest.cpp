@@ -0,0 +1,184 @@
+// BATCH: HandleBatch() executing sub-commands in order, stopping where
+// the response might not fit and refusing more than the count byte holds,
+// and EncodeBatches() / ParseBatch() of the host packing within those
+// limits.
+#include <algorithm>
+#include <vector>
+
+#include "Check.h"
+#include "Encoder.h"
+#include "Image.h"
+#include "Protocol.h"
+#include "Loopback.h"
+
+namespace
+{
+
+typedef std::vector<std::pair<uint8_t, std::vector<uint8_t>>> SubResps;
+
+std::vector<uint8_t> Entry(uint8_t cmd, const std::vector<uint8_t> &data)
+{
+    std::vector<uint8_t> entry(3 + data.size());
+
+    entry[0] = cmd;
+    entry[1] = (uint8_t)data.size();
+    entry[2] = (uint8_t)(data.size() >> 8);
+    std::copy(data.begin(), data.end(), entry.begin() + 3);
+    return entry;
+}
+
+// READ_CRC of many ranges, packed by the host: every batch fits a frame
+// and runs to the end, and the CRCs are those of single commands.
+void TestReadCrc()
+{
+    Loopback device;
+    std::vector<uint8_t> resp;
+    Image image = Pattern(0x002000, 0x4000, 4);
+    std::vector<Payload> reads;
+
+    CHECK(device.Program(EncodeBlocks(image, 995, true)));
+    for (uint32_t i = 0; i < 200; i++)
+        reads.push_back(Payload{READ_CRC, RangeData(0x002000 + 0x100 * i, 0x40 + i)});
+
+    std::vector<size_t> counts;
+    std::vector<Payload> batches = EncodeBatches(reads, device.Info().MaxPayload(), 2, &counts);
+    CHECK(batches.size() > 1);
+    CHECK_EQ(batches.size(), counts.size());
+    size_t first = 0;
+    for (size_t b = 0; b < batches.size(); b++)
+    {
+        SubResps subs;
+        bool complete = false;
+        CHECK_EQ(batches[b].cmd, BATCH);
+        CHECK(batches[b].data.size() <= device.Info().MaxPayload());
+        CHECK(device.Command(BATCH, batches[b].data, &resp));
+        CHECK(ParseBatch(resp.data(), resp.size(), &subs, &complete));
+        CHECK(complete);
+        CHECK_EQ(subs.size(), counts[b]);
+        for (size_t i = 0; i < subs.size() && first + i < reads.size(); i++)
+        {
+            uint32_t n = 0x40 + (uint32_t)(first + i);
+            CHECK_EQ(subs[i].first, READ_CRC);
+            CHECK_EQ(subs[i].second.size(), 2);
+            CHECK_EQ(subs[i].second[0] | (subs[i].second[1] << 8), image.Crc(0x002000 + 0x100 * (first + i), n));
+        }
+        first += counts[b];
+    }
+    CHECK_EQ(first, reads.size());
+}
+
+// The boot loader runs a sub-command only while BATCH_MAX_SUB_RESP bytes
+// are left: 49 READ_STATS of 16 bytes each, 2 + 49 * 18 bytes.
+void TestResponseLimit()
+{
+    Loopback device;
+    std::vector<uint8_t> resp;
+    std::vector<uint8_t> data;
+    std::vector<Payload> stats(60, Payload{READ_STATS, {}});
+    SubResps subs;
+    bool complete = true;
+
+    for (const Payload &p : stats)
+    {
+        std::vector<uint8_t> entry = Entry(p.cmd, p.data);
+        data.insert(data.end(), entry.begin(), entry.end());
+    }
+    CHECK(device.Command(BATCH, data, &resp));
+    CHECK(ParseBatch(resp.data(), resp.size(), &subs, &complete));
+    CHECK(!complete);
+    CHECK_EQ(subs.size(), 49);
+    CHECK(resp.size() <= BATCH_RESP_SIZE);
+
+    std::vector<size_t> counts;
+    std::vector<Payload> batches = EncodeBatches(stats, device.Info().MaxPayload(), 16, &counts);
+    CHECK_EQ(batches.size(), 2);
+    CHECK_EQ(counts[0], 49);
+    for (const Payload &b : batches)
+    {
+        CHECK(device.Command(BATCH, b.data, &resp));
+        CHECK(ParseBatch(resp.data(), resp.size(), &subs, &complete));
+        CHECK(complete);
+    }
+}
+
+// A nested BATCH or an entry longer than the rest of the frame stops the
+// list, what came before it has run.
+void TestMalformed()
+{
+    Loopback device;
+    std::vector<uint8_t> resp;
+    std::vector<uint8_t> data = Entry(READ_CRC, RangeData(0x002000, 4));
+    std::vector<uint8_t> nested = Entry(BATCH, Entry(READ_STATS, {}));
+    SubResps subs;
+    bool complete = true;
+
+    data.insert(data.end(), nested.begin(), nested.end());
+    CHECK(device.Command(BATCH, data, &resp));
+    CHECK(ParseBatch(resp.data(), resp.size(), &subs, &complete));
+    CHECK(!complete);
+    CHECK_EQ(subs.size(), 1);
+
+    data = Entry(READ_STATS, {});
+    data.insert(data.end(), {READ_CRC, 8, 0, 0x00, 0x20});
+    CHECK(device.Command(BATCH, data, &resp));
+    CHECK(ParseBatch(resp.data(), resp.size(), &subs, &complete));
+    CHECK(!complete);
+    CHECK_EQ(subs.size(), 1);
+    CHECK_EQ(subs[0].first, READ_STATS);
+
+    // Short entry header.
+    CHECK(device.Command(BATCH, {READ_STATS, 0}, &resp));
+    CHECK(ParseBatch(resp.data(), resp.size(), &subs, &complete));
+    CHECK(!complete);
+    CHECK(subs.empty());
+
+    // Count and entries disagree, or an entry runs past the end.
+    const std::vector<uint8_t> bad[] = {{}, {2, 0, READ_STATS, 0}, {1, 0, READ_CRC, 2, 0x12}};
+    for (const std::vector<uint8_t> &r : bad)
+        CHECK(!ParseBatch(r.data(), r.size(), &subs, &complete));
+}
+
+// Sub-commands without response data, more than the count byte can
+// number: refused before any runs, and split by EncodeBatches().
+void TestCount()
+{
+    Loopback device;
+    std::vector<uint8_t> resp;
+    std::vector<Payload> refused(300, Payload{ERASE_RANGE, {}});
+    SubResps subs;
+    bool complete = true;
+
+    std::vector<size_t> counts;
+    std::vector<Payload> batches = EncodeBatches(refused, device.Info().MaxPayload(), 0, &counts);
+    CHECK_EQ(batches.size(), 2);
+    CHECK_EQ(counts[0], BATCH_MAX_COUNT);
+    for (const Payload &b : batches)
+    {
+        CHECK(device.Command(BATCH, b.data, &resp));
+        CHECK(ParseBatch(resp.data(), resp.size(), &subs, &complete));
+        CHECK(complete);
+    }
+    CHECK_EQ(subs.size(), 300 - BATCH_MAX_COUNT);
+
+    std::vector<uint8_t> data;
+    for (const Payload &p : refused)
+    {
+        std::vector<uint8_t> entry = Entry(p.cmd, p.data);
+        data.insert(data.end(), entry.begin(), entry.end());
+    }
+    CHECK(device.Command(BATCH, data, &resp));
+    CHECK(ParseBatch(resp.data(), resp.size(), &subs, &complete));
+    CHECK(!complete);
+    CHECK(subs.empty());
+}
+
+}
+
+int main()
+{
+    TestReadCrc();
+    TestResponseLimit();
+    TestMalformed();
+    TestCount();
+    return CheckResult();
+}
@@ -0,0 +1,39 @@
+// Checks of the tests under test/. A failed check prints where and what,
+// and the test goes on; main() returns CheckResult().
+#ifndef CHECK_H
+#define CHECK_H
+
+#include <cstdio>
+
+inline unsigned checkFailures = 0;
+
+#define CHECK(cond)                                                                    \
+    do                                                                                 \
+    {                                                                                  \
+        if (!(cond))                                                                   \
+        {                                                                              \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond);   \
+            checkFailures++;                                                           \
+        }                                                                              \
+    } while (0)
+
+#define CHECK_EQ(a, b)                                                                 \
+    do                                                                                 \
+    {                                                                                  \
+        long long a_ = (long long)(a), b_ = (long long)(b);                            \
+        if (a_ != b_)                                                                  \
+        {                                                                              \
+            fprintf(stderr, "%s:%d: CHECK_EQ(%s, %s) failed: 0x%llX != 0x%llX\n",      \
+                    __FILE__, __LINE__, #a, #b, a_, b_);                               \
+            checkFailures++;                                                           \
+        }                                                                              \
+    } while (0)
+
+inline int CheckResult()
+{
+    if (checkFailures)
+        fprintf(stderr, "%u checks failed\n", checkFailures);
+    return checkFailures ? 1 : 0;
+}
+
+#endif
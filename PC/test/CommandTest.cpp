@@ -0,0 +1,184 @@
+// Argument checks of the commands that take numbers from the host: short
+// data and out of range values get an error response, never a division
+// by zero or a read past the received frame. And an unsequenced
+// READ_BOOT_INFO ending a sequenced session, and frames as large as the
+// boot info announces.
+#include <cstring>
+#include <vector>
+
+#include "Check.h"
+#include "Frame.h"
+#include "Image.h"
+#include "Loopback.h"
+
+namespace
+{
+
+std::vector<uint8_t> Le32(uint32_t value)
+{
+    return {(uint8_t)value, (uint8_t)(value >> 8), (uint8_t)(value >> 16), (uint8_t)(value >> 24)};
+}
+
+uint32_t RespBaud(const std::vector<uint8_t> &resp)
+{
+    uint32_t baud;
+
+    memcpy(&baud, &resp[1], sizeof(baud));
+    return baud;
+}
+
+// CHANGE_BAUD: status, actual rate and error, 7 bytes whatever came in.
+void TestChangeBaud()
+{
+    Loopback device;
+    std::vector<uint8_t> resp;
+
+    CHECK(device.Command(CHANGE_BAUD, Le32(921600), &resp));
+    CHECK_EQ(resp.size(), 7);
+    CHECK_EQ(resp[0], 0);
+    CHECK(RespBaud(resp) != 0);
+
+    // Above Fcy/4, 4*baud used to overflow to a zero divisor.
+    const uint32_t refused[] = {0, 0x40000000, 0x80000000, 0xFFFFFFFF, SYS_FCY / 4 + 1};
+    for (uint32_t baud : refused)
+    {
+        CHECK(device.Command(CHANGE_BAUD, Le32(baud), &resp));
+        CHECK_EQ(resp.size(), 7);
+        CHECK_EQ(resp[0], 1);
+        CHECK_EQ(RespBaud(resp), 0);
+    }
+
+    // Fcy/4 itself is BRG 0.
+    CHECK(device.Command(CHANGE_BAUD, Le32(SYS_FCY / 4), &resp));
+    CHECK_EQ(resp[0], 0);
+    CHECK_EQ(RespBaud(resp), SYS_FCY / 4);
+
+    for (size_t len = 0; len < 4; len++)
+    {
+        std::vector<uint8_t> data(len, 0x10);
+        CHECK(device.Command(CHANGE_BAUD, data, &resp));
+        CHECK_EQ(resp.size(), 7);
+        CHECK_EQ(resp[0], 1);
+    }
+}
+
+// READ_CRC: 2 bytes of CRC, nothing for short data or a length above all
+// of main flash (0x055800 / 2 instructions of 4 bytes).
+void TestReadCrc()
+{
+    Loopback device;
+    std::vector<uint8_t> resp;
+    std::vector<uint8_t> data = RangeData(0x001000, 0x20);
+
+    CHECK(device.Command(READ_CRC, data, &resp));
+    CHECK_EQ(resp.size(), 2);
+    CHECK_EQ(resp[0] | (resp[1] << 8), Image().Crc(0x001000, 0x20));
+
+    for (size_t len = 0; len < 8; len++)
+    {
+        CHECK(device.Command(READ_CRC, std::vector<uint8_t>(data.begin(), data.begin() + len), &resp));
+        CHECK_EQ(resp.size(), 0);
+    }
+
+    CHECK(device.Command(READ_CRC, RangeData(0, 0x055800 / 2), &resp));
+    CHECK_EQ(resp.size(), 2);
+    CHECK_EQ(resp[0] | (resp[1] << 8), Image().Crc(0, 0x055800 / 2));
+    data = RangeData(0, 0);
+    data[4] = data[5] = data[6] = data[7] = 0xFF;
+    CHECK(device.Command(READ_CRC, data, &resp));
+    CHECK_EQ(resp.size(), 0);
+    CHECK(device.Command(READ_CRC, RangeData(0, 0x055800 / 2 + 1), &resp));
+    CHECK_EQ(resp.size(), 0);
+}
+
+// ERASE_RANGE: erased page count, nothing for short data or a length
+// above all of main flash. A length near 0xFFFFFFFF wrapped in the
+// conversion to instructions and erased nothing, or everything from the
+// address on.
+void TestEraseRange()
+{
+    Loopback device(0);
+    std::vector<uint8_t> resp;
+    std::vector<uint8_t> data = RangeData(0x004000, 0x400);
+
+    for (size_t len = 0; len < 8; len++)
+    {
+        CHECK(device.Command(ERASE_RANGE, std::vector<uint8_t>(data.begin(), data.begin() + len), &resp));
+        CHECK_EQ(resp.size(), 0);
+    }
+    for (uint32_t len = 0xFFFFFFFC; len != 0; len++)
+    {
+        data = RangeData(0x004000, 0);
+        memcpy(&data[4], &len, sizeof(len));
+        CHECK(device.Command(ERASE_RANGE, data, &resp));
+        CHECK_EQ(resp.size(), 0);
+    }
+    CHECK_EQ(SimFlashStats.PageErases, 0);
+
+    CHECK(device.Command(ERASE_RANGE, RangeData(0x004000, 0x400), &resp));
+    CHECK_EQ(resp.size(), 2);
+    CHECK_EQ(resp[0] | (resp[1] << 8), 1);
+    CHECK_EQ(SimFlashStats.PageErases, 1);
+
+    // All of main flash from the last two pages on, and none past its end.
+    CHECK(device.Command(ERASE_RANGE, RangeData(0x054800, 0x055800 / 2), &resp));
+    CHECK_EQ(resp[0] | (resp[1] << 8), 2);
+    CHECK(device.Command(ERASE_RANGE, RangeData(0x7FC000, 0x10), &resp));
+    CHECK_EQ(resp.size(), 2);
+    CHECK_EQ(resp[0] | (resp[1] << 8), 0);
+    CHECK_EQ(SimFlashStats.PageErases, 3);
+    CHECK_EQ(SimFlashStats.ProgramErrors, 0);
+}
+
+// A host that starts over unsequenced gets no SEQ_NAK for a frame with
+// a CRC error, just no answer, as before sequenced frames.
+void TestSessionRestart()
+{
+    Loopback device;
+    std::vector<uint8_t> resp;
+    std::vector<uint8_t> wire;
+    const uint8_t plain[] = {READ_CRC, 0x00, 0x20, 0x00, 0x00, 0x10, 0x00, 0x00, 0x00};
+
+    CHECK(device.Command(READ_BOOT_INFO | SEQ_FLAG, {7}, &resp));
+    CHECK(device.Command(READ_BOOT_INFO, {}, &resp));
+
+    frame::Encode(plain, sizeof(plain), wire);
+    wire[wire.size() - 2] ^= 0x01;      // CRC high byte, not a control character.
+    for (size_t done = 0; done < wire.size();)
+        done += BuildRxFrame(&wire[done], (INT16)(wire.size() - done));
+    while (FrameWorkTask())
+        ;
+    std::vector<uint8_t> tx(2 * FRAMEWORK_BUFF_SIZE + 8);
+    CHECK_EQ(GetTransmitFrame(tx.data()), 0);
+}
+
+// A sequenced frame of BI_FRAME_SIZE bytes, CRC included, is taken, one
+// byte more is dropped. READ_CRC ignores data after the range.
+void TestFrameSize()
+{
+    Loopback device;
+    std::vector<uint8_t> resp;
+    std::vector<uint8_t> data = RangeData(0x002000, 0x10);
+
+    CHECK(device.Command(READ_BOOT_INFO | SEQ_FLAG, {0}, &resp));
+    data.insert(data.begin(), 1);       // Sequence number.
+    data.resize(1 + device.Info().MaxPayload());
+    CHECK(device.Command(READ_CRC | SEQ_FLAG, data, &resp));
+    CHECK_EQ(resp.size(), 1 + 2);
+
+    data[0] = 2;
+    data.push_back(0);
+    CHECK(!device.Command(READ_CRC | SEQ_FLAG, data, &resp));
+}
+
+}
+
+int main()
+{
+    TestChangeBaud();
+    TestReadCrc();
+    TestEraseRange();
+    TestSessionRestart();
+    TestFrameSize();
+    return CheckResult();
+}
@@ -0,0 +1,94 @@
+// CalculateCrc() and CalculateCrcProgMem() of the boot loader against the
+// host's Crc16() and known CRC-CCITT values.
+#include <string>
+#include <vector>
+
+#include "Check.h"
+#include "Crc16.h"
+#include "Image.h"
+#include "Loopback.h"
+
+extern "C"
+{
+UINT16 CalculateCrc(UINT8 *data, UINT32 len);
+UINT16 CalculateCrcProgMem(UINT32 progAdrs, UINT32 len);
+}
+
+namespace
+{
+
+uint16_t FirmwareCrc(std::vector<uint8_t> data)
+{
+    return CalculateCrc(data.data(), data.size());
+}
+
+std::vector<uint8_t> Bytes(const std::string &s)
+{
+    return std::vector<uint8_t>(s.begin(), s.end());
+}
+
+void TestVectors()
+{
+    std::vector<uint8_t> counting(256);
+    std::vector<uint8_t> ones(1000, 0xFF);
+
+    for (size_t i = 0; i < counting.size(); i++)
+        counting[i] = i;
+
+    // CRC-16/XMODEM check values.
+    CHECK_EQ(FirmwareCrc(Bytes("123456789")), 0x31C3);
+    CHECK_EQ(FirmwareCrc(Bytes("A")), 0x58E5);
+    CHECK_EQ(FirmwareCrc({}), 0);
+    CHECK_EQ(FirmwareCrc({0}), 0);
+    CHECK_EQ(FirmwareCrc(counting), Crc16(counting.data(), counting.size()));
+    CHECK_EQ(FirmwareCrc(ones), Crc16(ones.data(), ones.size()));
+    // A frame with escaped bytes and its CRC appended checks to 0.
+    std::vector<uint8_t> frame = {0x81, 0x01, 0x04, 0x10, 0x7E};
+    uint16_t crc = FirmwareCrc(frame);
+    frame.push_back(crc >> 8);
+    frame.push_back(crc);
+    CHECK_EQ(FirmwareCrc(frame), 0);
+}
+
+// 4 bytes per instruction, the phantom byte 0, stopping after len bytes.
+void TestProgMem()
+{
+    Loopback device;
+    Image image = Pattern(0x003000, 600, 9);
+    std::vector<uint8_t> bytes;
+
+    for (const auto &w : image.Words())
+    {
+        *simProgWord(w.first) = w.second;
+        bytes.push_back(w.second);
+        bytes.push_back(w.second >> 8);
+        bytes.push_back(w.second >> 16);
+        bytes.push_back(0);
+    }
+    for (UINT32 len : {1u, 3u, 4u, 5u, 7u, 400u, 2399u, 2400u})
+        CHECK_EQ(CalculateCrcProgMem(0x003000, len), Crc16(bytes.data(), len));
+    CHECK_EQ(device.ReadCrc(0x003000, 600), image.Crc(0x003000, 600));
+    CHECK_EQ(device.ReadCrc(0x002F00, 0x200), image.Crc(0x002F00, 0x200));
+}
+
+// Responses carry the firmware CRC, the host parser checks it.
+void TestFrames()
+{
+    Loopback device;
+    std::vector<uint8_t> resp;
+
+    CHECK(device.Command(READ_BOOT_INFO, {}, &resp));
+    CHECK(resp.size() > 20);
+    CHECK(device.Command(READ_STATS, {}, &resp));
+    CHECK_EQ(resp.size(), 16);
+}
+
+}
+
+int main()
+{
+    TestVectors();
+    TestProgMem();
+    TestFrames();
+    return CheckResult();
+}
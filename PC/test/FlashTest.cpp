@@ -0,0 +1,202 @@
+// Complete dspic-flash updates against dspic-sim over its pty, as
+// dspic-bench runs them without the timing: the READ_CRC check in BATCH
+// frames or one frame per range, each way of erasing, with and without
+// the frame cache, and patches against the right and a wrong base. Run
+// from PC/, next to dspic-sim.
+#include <cstdlib>
+#include <filesystem>
+#include <map>
+#include <string>
+#include <unistd.h>
+
+#include "Check.h"
+#include "Flasher.h"
+#include "Image.h"
+#include "SerialPort.h"
+#include "Simulator.h"
+#include "Workload.h"
+
+namespace
+{
+
+const char SIM[] = "./dspic-sim";
+
+struct Update
+{
+    FlashReport report;
+    std::map<std::string, double> sim;
+};
+
+// One update of a blank simulated board, or of one holding flash, from
+// base in patch mode.
+bool Run(const Image &image, const FlashOptions &options, const std::string &flash, Update *u,
+         const Image &base = Image())
+{
+    Simulator sim;
+    SerialPort port;
+    FlashOptions opt = options;
+    std::string err;
+
+    opt.run = true;                     // Ends dspic-sim.
+    if (!sim.Start(SIM, 0, 0, 0, flash, &err) || !port.Open(sim.Pty(), opt.baud, &err))
+    {
+        fprintf(stderr, "%s\n", err.c_str());
+        return false;
+    }
+    Flasher flasher(image, base, opt);
+    bool ok = flasher.Flash(port, &u->report);
+    port.Close();
+    if (!ok)
+    {
+        // No JMP_TO_APP, no report to wait for.
+        fprintf(stderr, "%s\n", u->report.error.c_str());
+        return false;
+    }
+    return sim.Finish(&u->sim, &err);
+}
+
+// Every other page of the image, one READ_CRC range each: a single BATCH
+// frame without sequenced pipelining to wait for, the same result.
+void TestBatchVerify()
+{
+    Image image = Gaps(Synthesize(48), 0x800);
+    FlashOptions opt;
+    Update batched, single;
+
+    opt.mode = "lz";
+    CHECK(Run(image, opt, "", &batched));
+    opt.batch = false;
+    CHECK(Run(image, opt, "", &single));
+
+    CHECK(batched.report.ok);
+    CHECK(single.report.ok);
+    CHECK(batched.report.info.Supports(BATCH));
+    // 8 ranges: 7 round trips fewer.
+    CHECK_EQ(single.report.wire.roundTrips - batched.report.wire.roundTrips, 7);
+    CHECK_EQ(batched.sim["double_word_writes"], single.sim["double_word_writes"]);
+    CHECK_EQ(batched.sim["page_erases"], 8);
+}
+
+// The boot loader announces lazy erase, so auto erases nothing up front
+// and every page once on its first write. ERASE_RANGE erases the same
+// pages, ERASE_FLASH all of flash and no page after it.
+void TestErase()
+{
+    Image image = Gaps(Synthesize(48), 0x800);
+    FlashOptions opt;
+    Update u;
+
+    opt.mode = "lz";
+    CHECK(Run(image, opt, "", &u));
+    CHECK(u.report.info.Has(FEATURE_LAZY_ERASE));
+    CHECK_EQ(u.sim["bulk_erases"], 0);
+    CHECK_EQ(u.sim["page_erases"], 8);
+
+    for (bool batch : {true, false})
+    {
+        opt.erase = "range";
+        opt.batch = batch;
+        CHECK(Run(image, opt, "", &u));
+        CHECK(u.report.ok);
+        CHECK_EQ(u.sim["bulk_erases"], 0);
+        CHECK_EQ(u.sim["page_erases"], 8);
+    }
+
+    opt.erase = "all";
+    CHECK(Run(image, opt, "", &u));
+    CHECK(u.report.ok);
+    CHECK_EQ(u.sim["bulk_erases"], 1);
+    CHECK_EQ(u.sim["page_erases"], 0);
+}
+
+// Frames written to the cache and read back from it erase as much as
+// frames encoded on the spot (range and all share the frames, all erasing
+// first): no READ_BOOT_INFO between the erase and
+// the cached frames makes the boot loader erase the pages again.
+void TestCachedErase()
+{
+    Image image = Gaps(Synthesize(48), 0x800);
+    char dir[] = "/tmp/flash-test.XXXXXX";
+
+    if (!mkdtemp(dir))
+    {
+        perror("mkdtemp");
+        CHECK(false);
+        return;
+    }
+    for (const char *erase : {"auto", "range", "all"})
+    {
+        FlashOptions opt;
+        Update plain, first, hit;
+
+        opt.mode = "lz";
+        opt.erase = erase;
+        CHECK(Run(image, opt, "", &plain));
+        opt.cacheDir = dir;
+        CHECK(Run(image, opt, "", &first));
+        CHECK(Run(image, opt, "", &hit));
+
+        CHECK(hit.report.cached);
+        for (Update *u : {&first, &hit})
+        {
+            CHECK(u->report.ok);
+            CHECK_EQ(u->sim["page_erases"], plain.sim["page_erases"]);
+            CHECK_EQ(u->sim["bulk_erases"], plain.sim["bulk_erases"]);
+            CHECK_EQ(u->sim["double_word_writes"], plain.sim["double_word_writes"]);
+        }
+    }
+    std::filesystem::remove_all(dir);
+}
+
+// A patch only goes to a board holding the base image. Auto falls back
+// to a mode sending the whole image, an explicit patch mode refuses.
+void TestPatchBase()
+{
+    Image image = Synthesize(24);
+    Image base = Previous(image);
+    Image other = Edited(base, "modify");
+    char dir[] = "/tmp/flash-test.XXXXXX";
+
+    if (!mkdtemp(dir))
+    {
+        perror("mkdtemp");
+        CHECK(false);
+        return;
+    }
+    std::string file = std::string(dir) + "/flash.bin";
+    FlashOptions opt;
+    Update u;
+
+    CHECK(WriteFlashFile(file, base));
+    CHECK(Run(image, opt, file, &u, base));
+    CHECK(u.report.ok);
+    CHECK(u.report.mode == "patch");
+
+    CHECK(WriteFlashFile(file, other));
+    CHECK(Run(image, opt, file, &u, base));
+    CHECK(u.report.ok);
+    CHECK(u.report.mode == "lz");
+
+    opt.mode = "patch";
+    CHECK(WriteFlashFile(file, other));
+    CHECK(!Run(image, opt, file, &u, base));
+    CHECK(u.report.error == "the board does not hold the --base image");
+    CHECK_EQ(u.report.frames, 0);
+    std::filesystem::remove_all(dir);
+}
+
+}
+
+int main()
+{
+    if (access(SIM, X_OK) != 0)
+    {
+        fprintf(stderr, "%s missing, run from PC/ after make\n", SIM);
+        return 1;
+    }
+    TestBatchVerify();
+    TestErase();
+    TestCachedErase();
+    TestPatchBase();
+    return CheckResult();
+}
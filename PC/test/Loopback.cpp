@@ -0,0 +1,111 @@
+#include "Frame.h"
+#include "Loopback.h"
+
+Loopback::Loopback(uint32_t fill)
+{
+    std::vector<uint8_t> resp;
+
+    simReset(fill);
+    SimTiming.Scale = 0;
+    if (Command(READ_BOOT_INFO, {}, &resp))
+        info_.Parse(resp.data(), resp.size());
+}
+
+bool Loopback::Command(uint8_t cmd, const std::vector<uint8_t> &data, std::vector<uint8_t> *resp)
+{
+    std::vector<uint8_t> plain = {cmd};
+    std::vector<uint8_t> wire;
+    frame::Parser parser;
+
+    plain.insert(plain.end(), data.begin(), data.end());
+    frame::Encode(plain.data(), plain.size(), wire);
+    for (size_t done = 0; done < wire.size();)
+    {
+        done += BuildRxFrame(&wire[done], (INT16)(wire.size() - done));
+        FrameWorkTask();
+    }
+    while (FrameWorkTask())
+        ;
+
+    // Escaping at most doubles the frame.
+    std::vector<uint8_t> tx(2 * FRAMEWORK_BUFF_SIZE + 8);
+    UINT len = GetTransmitFrame(tx.data());
+    resp->clear();
+    for (UINT i = 0; i < len; i++)
+    {
+        if (parser.Feed(tx[i]) && !parser.Data().empty() && parser.Data()[0] == cmd)
+        {
+            resp->assign(parser.Data().begin() + 1, parser.Data().end());
+            return true;
+        }
+    }
+    return false;
+}
+
+bool Loopback::Program(const std::vector<Payload> &payloads)
+{
+    std::vector<uint8_t> resp;
+
+    for (const Payload &p : payloads)
+    {
+        if (!Command(p.cmd, p.data, &resp))
+            return false;
+        // PROGRAM_FLASH answers without a status.
+        if (p.cmd != PROGRAM_FLASH && (resp.empty() || resp[0] != 0))
+            return false;
+    }
+    return true;
+}
+
+uint16_t Loopback::ReadCrc(uint32_t address, uint32_t count)
+{
+    std::vector<uint8_t> resp;
+
+    if (!Command(READ_CRC, RangeData(address, count), &resp) || resp.size() != 2)
+        return 0;
+    return resp[0] | (resp[1] << 8);
+}
+
+bool Loopback::FlashHolds(const Image &image, unsigned pageSize)
+{
+    for (uint32_t page : image.Pages(pageSize))
+    {
+        for (uint32_t a = page; a < page + pageSize; a += 2)
+        {
+            UINT32 *w = simProgWord(a);
+            if (!w || *w != image.Word(a))
+                return false;
+        }
+    }
+    return true;
+}
+
+Image Pattern(uint32_t address, uint32_t count, uint32_t seed)
+{
+    Image image;
+    uint32_t state = seed;
+
+    for (uint32_t i = 0; i < count; i++)
+    {
+        state = state * 1103515245 + 12345;
+        image.Set(address + 2 * i, state >> 8);
+    }
+    return image;
+}
+
+std::vector<uint8_t> RangeData(uint32_t address, uint32_t count)
+{
+    uint32_t len = 4 * count;
+
+    return {(uint8_t)address, (uint8_t)(address >> 8), (uint8_t)(address >> 16), (uint8_t)(address >> 24),
+            (uint8_t)len,     (uint8_t)(len >> 8),     (uint8_t)(len >> 16),     (uint8_t)(len >> 24)};
+}
+
+// SimMain.c has these in dspic-sim: nothing to send, no LEDs.
+extern "C" void simService(void)
+{
+}
+
+extern "C" void blinkLEDs(void)
+{
+}
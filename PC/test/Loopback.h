@@ -0,0 +1,58 @@
+// The boot loader built for the simulator, driven through the functions
+// the UART loop calls (BuildRxFrame(), FrameWorkTask() and
+// GetTransmitFrame()) instead of a pty: no timing, every command of a
+// whole image runs in a moment, and the device model is right there to
+// look at. Include the host headers before this one, the firmware headers
+// define SOH, TRUE and the like as macros.
+#ifndef LOOPBACK_H
+#define LOOPBACK_H
+
+#include <cstdint>
+#include <vector>
+
+#include "Encoder.h"
+#include "Image.h"
+#include "Protocol.h"
+
+extern "C"
+{
+#include "system.h"
+#include "Framework.h"
+#include "NVMem.h"
+}
+
+class Loopback
+{
+public:
+    // Power on state, main flash filled with fill, and a new session
+    // (READ_BOOT_INFO). Flash operations take no wall time.
+    explicit Loopback(uint32_t fill = BLANK);
+
+    const BootInfo &Info() const { return info_; }
+
+    // Sends cmd unsequenced, resp receives the response without the
+    // command byte. False if no response came back.
+    bool Command(uint8_t cmd, const std::vector<uint8_t> &data, std::vector<uint8_t> *resp);
+
+    // Every payload in turn. False at the first one not answered, or
+    // answered with a status other than 0.
+    bool Program(const std::vector<Payload> &payloads);
+
+    // READ_CRC of count instructions from address.
+    uint16_t ReadCrc(uint32_t address, uint32_t count);
+
+    // Main flash holds image over its pages, blank where image has none.
+    static bool FlashHolds(const Image &image, unsigned pageSize = 0x800);
+
+private:
+    BootInfo info_;
+};
+
+// count instructions from address, pseudo random from seed.
+Image Pattern(uint32_t address, uint32_t count, uint32_t seed);
+
+// Address and length (4 bytes per instruction) as READ_CRC and
+// ERASE_RANGE take them.
+std::vector<uint8_t> RangeData(uint32_t address, uint32_t count);
+
+#endif
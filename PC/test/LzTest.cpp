@@ -0,0 +1,184 @@
+// PROGRAM_COMPRESSED: what LzCompress() packs, WriteCompressed2Flash()
+// unpacks into the same instructions, and a malformed stream is refused
+// with status 1 instead of reading outside the frame or the window.
+#include <algorithm>
+#include <vector>
+
+#include "Check.h"
+#include "Encoder.h"
+#include "Image.h"
+#include "Loopback.h"
+
+namespace
+{
+
+// Program address (24 bits) followed by the stream, as EncodeCompressed().
+std::vector<uint8_t> Frame(uint32_t address, const std::vector<uint8_t> &stream)
+{
+    std::vector<uint8_t> data(3 + stream.size());
+
+    data[0] = (uint8_t)address;
+    data[1] = (uint8_t)(address >> 8);
+    data[2] = (uint8_t)(address >> 16);
+    std::copy(stream.begin(), stream.end(), data.begin() + 3);
+    return data;
+}
+
+uint8_t Status(Loopback &device, const std::vector<uint8_t> &data)
+{
+    std::vector<uint8_t> resp;
+
+    if (!device.Command(PROGRAM_COMPRESSED, data, &resp) || resp.size() != 1)
+        return 0xFF;
+    return resp[0];
+}
+
+size_t PayloadBytes(const std::vector<Payload> &payloads)
+{
+    size_t bytes = 0;
+
+    for (const Payload &p : payloads)
+        bytes += p.data.size();
+    return bytes;
+}
+
+// Encoded, programmed on an erased part and read back, at two frame sizes.
+void RoundTrip(const Image &image, bool compressible)
+{
+    for (size_t maxPayload : {995, 64})
+    {
+        Loopback device;
+        std::vector<uint8_t> resp;
+        std::vector<Payload> payloads = EncodeCompressed(image, maxPayload);
+
+        for (const Payload &p : payloads)
+        {
+            CHECK_EQ(p.cmd, PROGRAM_COMPRESSED);
+            CHECK(p.data.size() <= maxPayload);
+        }
+        // Each frame starts with an empty window, small ones hardly pack.
+        if (compressible && maxPayload == 995)
+            CHECK(PayloadBytes(payloads) < image.Size() * 3);
+
+        CHECK(device.Command(ERASE_FLASH, {}, &resp));
+        CHECK(device.Program(payloads));
+        // READ_CRC programs what is left in the page cache.
+        const Run first = image.Runs().front();
+        CHECK_EQ(device.ReadCrc(first.address, first.words.size()), image.Crc(first.address, first.words.size()));
+        CHECK(Loopback::FlashHolds(image));
+        CHECK_EQ(SimFlashStats.ProgramErrors, 0);
+    }
+}
+
+void TestRoundTrip()
+{
+    // Pseudo random, barely compressible.
+    RoundTrip(Pattern(0x002000, 3000, 7), false);
+
+    // Code like: a few instructions repeated with small changes, matches
+    // of every length and distances up to the window.
+    Image code;
+    Image random = Pattern(0, 64, 8);
+    for (uint32_t i = 0; i < 6000; i++)
+        code.Set(0x004000 + 2 * i, random.Word(2 * (i % 37 + (i / 400) % 27)) ^ (i % 11 == 0 ? i : 0));
+    RoundTrip(code, true);
+
+    // Constant runs and holes between them.
+    Image runs;
+    for (uint32_t i = 0; i < 2000; i++)
+        runs.Set(0x010000 + 2 * i, 0x000000);
+    for (uint32_t i = 0; i < 700; i++)
+        runs.Set(0x012100 + 2 * i, i < 350 ? 0x123456 : 0xABCDEF);
+    runs.Set(0x015000, 0x060000);
+    RoundTrip(runs, true);
+}
+
+// A match reaching exactly LZ_WINDOW_SIZE (1024) bytes back is the oldest
+// byte still in the window. The first 1024 bytes don't fit a frame as
+// literals: 512 random ones and 512 copied from 256 back.
+void TestWindowEdge()
+{
+    Loopback device;
+    std::vector<uint8_t> resp;
+    std::vector<uint8_t> stream;
+    std::vector<uint8_t> bytes;
+    Image random = Pattern(0, 512 / 4, 9);
+
+    for (uint32_t i = 0; i < 512; i++)
+        bytes.push_back((uint8_t)(random.Word(2 * (i / 4)) >> (8 * (i % 4))));
+    for (size_t i = 0; i < bytes.size(); i += 128)
+    {
+        stream.push_back(127);
+        stream.insert(stream.end(), bytes.begin() + i, bytes.begin() + i + 128);
+    }
+    for (int i = 0; i < 4; i++)
+        stream.insert(stream.end(), {0x80 | (128 - 4), 0x00, 0x01});
+    for (size_t i = 0; i < 512; i++)
+        bytes.push_back(bytes[bytes.size() - 256]);
+    // 127 + LZ_MIN_MATCH = 131 bytes from the start, 1155 bytes in all.
+    stream.insert(stream.end(), {0xFF, 0x00, 0x04});
+    for (size_t i = 0; i < 131; i++)
+        bytes.push_back(bytes[i]);
+
+    CHECK(device.Command(ERASE_FLASH, {}, &resp));
+    CHECK_EQ(Status(device, Frame(0x006000, stream)), 0);
+    Image expect;
+    for (size_t i = 0; i < bytes.size(); i += 3)
+        expect.Set(0x006000 + 2 * (uint32_t)(i / 3), bytes[i] | (bytes[i + 1] << 8) | (bytes[i + 2] << 16));
+    CHECK_EQ(device.ReadCrc(0x006000, bytes.size() / 3), expect.Crc(0x006000, bytes.size() / 3));
+
+    // One byte further is out of the window.
+    stream[stream.size() - 2] = 0x01;
+    CHECK_EQ(Status(device, Frame(0x006000, stream)), 1);
+}
+
+void TestMalformed()
+{
+    Loopback device;
+    std::vector<uint8_t> resp;
+    // Three literals, one instruction.
+    const std::vector<uint8_t> literal = {0x02, 0x11, 0x22, 0x33};
+
+    CHECK(device.Command(ERASE_FLASH, {}, &resp));
+    CHECK_EQ(Status(device, Frame(0x008000, literal)), 0);
+
+    // Odd address, no address at all.
+    CHECK_EQ(Status(device, Frame(0x008001, literal)), 1);
+    CHECK_EQ(Status(device, {0x00, 0x80}), 1);
+
+    // Literal run longer than what is left of the frame.
+    CHECK_EQ(Status(device, Frame(0x008000, {0x05, 0x11, 0x22, 0x33})), 1);
+
+    // Match without its distance, or half of it.
+    std::vector<uint8_t> stream = literal;
+    stream.push_back(0x80);
+    CHECK_EQ(Status(device, Frame(0x008000, stream)), 1);
+    stream.push_back(0x01);
+    CHECK_EQ(Status(device, Frame(0x008000, stream)), 1);
+
+    // Distance 0 and distances before the start of the frame.
+    for (uint16_t dist : {0, 4, 1000, 0xFFFF})
+    {
+        stream = literal;
+        stream.insert(stream.end(), {0x81, (uint8_t)dist, (uint8_t)(dist >> 8)});
+        CHECK_EQ(Status(device, Frame(0x008000, stream)), 1);
+    }
+    // Distance 3 repeats the instruction: 3 + 5 bytes is not a whole one.
+    stream = literal;
+    stream.insert(stream.end(), {0x81, 0x03, 0x00});
+    CHECK_EQ(Status(device, Frame(0x008000, stream)), 1);
+    stream[4] = 0x82;
+    CHECK_EQ(Status(device, Frame(0x008000, stream)), 0);
+
+    CHECK_EQ(SimFlashStats.ProgramErrors, 0);
+}
+
+}
+
+int main()
+{
+    TestRoundTrip();
+    TestWindowEdge();
+    TestMalformed();
+    return CheckResult();
+}
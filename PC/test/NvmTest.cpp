@@ -0,0 +1,117 @@
+// NVMem.c on the device model: rows go out as double-word writes with
+// interrupts disabled around each unlock sequence, every operation waits
+// for WR, and a whole image programs without a single program error.
+#include <string>
+#include <vector>
+
+#include "Check.h"
+#include "Encoder.h"
+#include "Image.h"
+#include "Loopback.h"
+
+namespace
+{
+
+void TestRow()
+{
+    Loopback device;
+    std::vector<UINT32> row(NVMEM_ROW_INSTRUCTIONS);
+    T_NVMEM_STATS before = NVMemStats;
+
+    for (size_t i = 0; i < row.size(); i++)
+        row[i] = 0x100000 + i;
+    CHECK_EQ(NVMemWriteRow(0x001100, row.data()), 0);
+
+    CHECK_EQ(SimFlashStats.DoubleWordWrites, NVMEM_ROW_INSTRUCTIONS / 2);
+    CHECK_EQ(NVMemStats.RowBuffers, before.RowBuffers + 1);
+    CHECK_EQ(NVMemStats.DoubleWordWrites, before.DoubleWordWrites + NVMEM_ROW_INSTRUCTIONS / 2);
+    for (size_t i = 0; i < row.size(); i++)
+        CHECK_EQ(*simProgWord(0x001100 + 2 * i), row[i]);
+    // The rows around it are untouched.
+    CHECK_EQ(*simProgWord(0x0010FE), BLANK);
+    CHECK_EQ(*simProgWord(0x001200), BLANK);
+
+    CHECK_EQ(SimFlashStats.ProgramErrors, 0);
+    CHECK_EQ(SimFlashStats.InterruptUnlocks, 0);
+    CHECK_EQ(SimFlashStats.BusyStarts, 0);
+    CHECK_EQ(INTCON2bits.GIE, 1);
+    CHECK_EQ(NVMCONbits.WR, 0);
+}
+
+void TestEraseAndWords()
+{
+    Loopback device(0);
+
+    CHECK_EQ(NVMemErasePage(0x001800), 0);
+    CHECK_EQ(*simProgWord(0x001800), BLANK);
+    CHECK_EQ(*simProgWord(0x001FFE), BLANK);
+    CHECK_EQ(*simProgWord(0x002000), 0);
+
+    // Single instructions leave the other one of the pair alone.
+    CHECK_EQ(NVMemWriteWord(0x001802, 0x123456), 0);
+    CHECK_EQ(NVMemWriteWord(0x001804, 0x654321), 0);
+    CHECK_EQ(*simProgWord(0x001800), BLANK);
+    CHECK_EQ(*simProgWord(0x001802), 0x123456);
+    CHECK_EQ(*simProgWord(0x001804), 0x654321);
+    CHECK_EQ(*simProgWord(0x001806), BLANK);
+
+    // The boot loader's own flash is not writable.
+    CHECK(NVMemWriteDoubleWord(0x7FC000, 0, 0) != 0);
+    CHECK_EQ(SimFlashStats.ProgramErrors, 2);
+    SimFlashStats.ProgramErrors = 0;
+
+    CHECK_EQ(NVMemBlockErase(), 0);
+    CHECK_EQ(*simProgWord(0x002000), BLANK);
+    CHECK_EQ(SimFlashStats.PageErases, 1);
+    CHECK_EQ(SimFlashStats.BulkErases, 1);
+    CHECK_EQ(SimFlashStats.InterruptUnlocks, 0);
+    CHECK_EQ(SimFlashStats.BusyStarts, 0);
+    CHECK_EQ(INTCON2bits.GIE, 1);
+}
+
+// All of main flash through the page cache, which programs complete rows
+// with NVMemWriteRow() and the rest with double words, over flash holding
+// an older image: every page is erased before it is written.
+void TestFullImage(const char *mode)
+{
+    Loopback device(0x0F0F0F);
+    const BootInfo &info = device.Info();
+    Image image = Pattern(info.appFirst, (info.appLast - info.appFirst) / 2 + 1, 7);
+    std::vector<Payload> payloads;
+
+    // A few holes, so partial rows are written too, and a blank page.
+    for (uint32_t a = 0x004010; a < 0x004020; a += 2)
+        image.Set(a, BLANK);
+    for (uint32_t a = 0x020000; a < 0x020800; a += 2)
+        image.Set(a, BLANK);
+    Image sent = image;
+    sent.StripBlank(info.pageSize, true);
+
+    if (std::string(mode) == "hex")
+        payloads = EncodeHex(sent, info.MaxPayload());
+    else
+        payloads = EncodeBlocks(sent, info.MaxPayload(), true);
+    CHECK(device.Program(payloads));
+    // READ_CRC flushes the last page.
+    CHECK_EQ(device.ReadCrc(info.appFirst, (info.appLast - info.appFirst) / 2 + 1),
+             image.Crc(info.appFirst, (info.appLast - info.appFirst) / 2 + 1));
+    CHECK(Loopback::FlashHolds(image, info.pageSize));
+
+    CHECK_EQ(SimFlashStats.ProgramErrors, 0);
+    CHECK_EQ(SimFlashStats.PageErases, image.Pages(info.pageSize).size());
+    CHECK_EQ(SimFlashStats.InterruptUnlocks, 0);
+    CHECK_EQ(SimFlashStats.BusyStarts, 0);
+    CHECK_EQ(INTCON2bits.GIE, 1);
+    CHECK(PageCacheStats.PartialRows > 0);
+}
+
+}
+
+int main()
+{
+    TestRow();
+    TestEraseAndWords();
+    TestFullImage("hex");
+    TestFullImage("packed");
+    return CheckResult();
+}
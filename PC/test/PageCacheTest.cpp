@@ -0,0 +1,146 @@
+// The page write cache of Framework.c: instructions collect across
+// frames, complete rows go out with NVMemWriteRow() as soon as their page
+// is erased, and the rest is programmed when the data moves to another
+// page, on the end-of-file record, before READ_CRC and on JMP_TO_APP.
+#include <vector>
+
+#include "Check.h"
+#include "Encoder.h"
+#include "Image.h"
+#include "Loopback.h"
+
+namespace
+{
+
+// Hex records of a row split over two frames, on an erased part: the row
+// is written once its last instruction arrives, before any flush.
+void TestRowAcrossFrames()
+{
+    Loopback device;
+    std::vector<uint8_t> resp;
+    Image image = Pattern(0x002000, NVMEM_ROW_INSTRUCTIONS, 1);
+    std::vector<Payload> frames = EncodeHex(image, 200);
+
+    CHECK(device.Command(ERASE_FLASH, {}, &resp));
+    CHECK(frames.size() > 2);
+    std::vector<Payload> first(frames.begin(), frames.begin() + frames.size() / 2);
+    CHECK(device.Program(first));
+    CHECK_EQ(PageCacheStats.Misses, 1);
+    CHECK_EQ(SimFlashStats.DoubleWordWrites, 0);
+
+    std::vector<Payload> rest(frames.begin() + frames.size() / 2, frames.end());
+    CHECK(device.Program(rest));
+    CHECK_EQ(PageCacheStats.Misses, 1);
+    CHECK_EQ(PageCacheStats.Hits, NVMEM_ROW_INSTRUCTIONS - 1);
+    CHECK_EQ(PageCacheStats.CompleteRows, 1);
+    CHECK_EQ(PageCacheStats.PartialRows, 0);
+    CHECK_EQ(PageCacheStats.PagesWritten, 1);   // End-of-file record.
+    CHECK_EQ(SimFlashStats.DoubleWordWrites, NVMEM_ROW_INSTRUCTIONS / 2);
+    CHECK_EQ(SimFlashStats.PageErases, 0);
+    CHECK(Loopback::FlashHolds(image));
+}
+
+// Without ERASE_FLASH a page waits in the cache until it is complete or
+// left: it may turn out identical and need no erase at all.
+void TestDiscontinuity()
+{
+    Loopback device(0);
+    Image a = Pattern(0x004000, 2 * NVMEM_ROW_INSTRUCTIONS + 10, 2);
+    Image b = Pattern(0x008000, 4, 3);
+
+    CHECK(device.Program(EncodeBlocks(a, 995, true)));
+    CHECK_EQ(PageCacheStats.Misses, 1);
+    CHECK_EQ(SimFlashStats.PageErases, 0);
+    CHECK_EQ(SimFlashStats.DoubleWordWrites, 0);
+
+    // Moving to another page programs the first one: two full rows and
+    // the 10 instructions of the third as 5 double words.
+    CHECK(device.Program(EncodeBlocks(b, 995, true)));
+    CHECK_EQ(PageCacheStats.Misses, 2);
+    CHECK_EQ(PageCacheStats.PagesWritten, 1);
+    CHECK_EQ(PageCacheStats.CompleteRows, 2);
+    CHECK_EQ(PageCacheStats.PartialRows, 1);
+    CHECK_EQ(SimFlashStats.PageErases, 1);
+    CHECK_EQ(SimFlashStats.DoubleWordWrites, NVMEM_ROW_INSTRUCTIONS + 5);
+    CHECK(Loopback::FlashHolds(a));
+
+    // The second page goes out on JMP_TO_APP, which has no response.
+    std::vector<uint8_t> resp;
+    CHECK(!device.Command(JMP_TO_APP, {}, &resp));
+    CHECK_EQ(PageCacheStats.PagesWritten, 2);
+    CHECK_EQ(PageCacheStats.PartialRows, 2);
+    CHECK_EQ(SimFlashStats.DoubleWordWrites, NVMEM_ROW_INSTRUCTIONS + 7);
+    CHECK(Loopback::FlashHolds(b));
+}
+
+// READ_CRC covers what is still cached, and a second session sending the
+// same data finds the page identical.
+void TestReadCrcAndIdentical()
+{
+    Loopback device(0x123456);
+    Image image = Pattern(0x010000, 300, 4);
+
+    CHECK(device.Program(EncodeBlocks(image, 995, false)));
+    CHECK_EQ(SimFlashStats.DoubleWordWrites, 0);
+    CHECK_EQ(device.ReadCrc(0x010000, 0x400), image.Crc(0x010000, 0x400));
+    CHECK_EQ(PageCacheStats.PagesWritten, 1);
+    CHECK_EQ(SimFlashStats.PageErases, 1);
+
+    std::vector<uint8_t> resp;
+    CHECK(device.Command(READ_BOOT_INFO, {}, &resp));
+    CHECK_EQ(PageCacheStats.PagesWritten, 0);
+    CHECK(device.Program(EncodeBlocks(image, 995, false)));
+    CHECK_EQ(device.ReadCrc(0x010000, 0x400), image.Crc(0x010000, 0x400));
+    CHECK_EQ(PageCacheStats.PagesSkipped, 1);
+    CHECK_EQ(PageCacheStats.PagesWritten, 0);
+    CHECK_EQ(SimFlashStats.PageErases, 1);
+}
+
+// ERASE_FLASH drops what is cached, the erase would wipe it anyway.
+void TestEraseDropsCache()
+{
+    Loopback device;
+    std::vector<uint8_t> resp;
+
+    CHECK(device.Program(EncodeBlocks(Pattern(0x006000, 8, 5), 995, true)));
+    CHECK(device.Command(ERASE_FLASH, {}, &resp));
+    CHECK_EQ(device.ReadCrc(0x006000, 8), Image().Crc(0x006000, 8));
+    CHECK_EQ(PageCacheStats.PagesWritten, 0);
+    CHECK_EQ(SimFlashStats.DoubleWordWrites, 0);
+}
+
+// A new session programs what the last one left in the cache first: the
+// host had its acknowledge, and the page bitmap is about to be cleared.
+void TestNewSessionFlushes()
+{
+    Loopback device;
+    std::vector<uint8_t> resp;
+    Image image = Pattern(0x00A000, 2 * NVMEM_ROW_INSTRUCTIONS + 6, 6);
+
+    CHECK(device.Command(ERASE_FLASH, {}, &resp));
+    CHECK(device.Program(EncodeBlocks(image, 995, true)));
+    CHECK_EQ(SimFlashStats.DoubleWordWrites, NVMEM_ROW_INSTRUCTIONS);
+    CHECK(device.Command(READ_BOOT_INFO, {}, &resp));
+    CHECK_EQ(SimFlashStats.DoubleWordWrites, NVMEM_ROW_INSTRUCTIONS + 3);
+    CHECK_EQ(SimFlashStats.PageErases, 0);
+    CHECK_EQ(SimFlashStats.ProgramErrors, 0);
+    CHECK(Loopback::FlashHolds(image));
+    CHECK_EQ(PageCacheStats.PagesWritten, 0);
+
+    // Nothing left over for the new session to program.
+    CHECK_EQ(device.ReadCrc(0x00A000, 0x400), image.Crc(0x00A000, 0x400));
+    CHECK_EQ(SimFlashStats.DoubleWordWrites, NVMEM_ROW_INSTRUCTIONS + 3);
+    CHECK_EQ(SimFlashStats.ProgramErrors, 0);
+}
+
+}
+
+int main()
+{
+    TestRowAcrossFrames();
+    TestDiscontinuity();
+    TestReadCrcAndIdentical();
+    TestEraseDropsCache();
+    TestNewSessionFlushes();
+    return CheckResult();
+}
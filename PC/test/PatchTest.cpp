@@ -0,0 +1,174 @@
+// PROGRAM_PATCH: PatchEncode() and PatchApply() of Patch.c on their own,
+// then the boot loader rebuilding the edits of bench/Workload.cpp on top
+// of the old image, erasing only the pages that changed.
+#include <vector>
+
+#include "Check.h"
+#include "Encoder.h"
+#include "Image.h"
+#include "Workload.h"
+#include "Loopback.h"
+
+#define PATCH_ENCODER
+extern "C"
+{
+#include "Patch.h"
+}
+
+namespace
+{
+
+// Installed image and the pages PatchApply() completed, for the T_PATCH
+// callbacks.
+std::vector<UINT32> oldWords;
+std::vector<UINT32> newWords;
+UINT32 pageBuffer[PATCH_PAGE_INSTRUCTIONS];
+
+UINT32 ReadOld(UINT32 progAddress)
+{
+    return progAddress / 2 < oldWords.size() ? oldWords[progAddress / 2] : BLANK;
+}
+
+void PageDone(UINT32 progAddress, UINT32 *page)
+{
+    if (newWords.size() < progAddress / 2 + PATCH_PAGE_INSTRUCTIONS)
+        newWords.resize(progAddress / 2 + PATCH_PAGE_INSTRUCTIONS, BLANK);
+    std::copy(page, page + PATCH_PAGE_INSTRUCTIONS, newWords.begin() + progAddress / 2);
+}
+
+std::vector<UINT32> Words(const Image &image, uint32_t end)
+{
+    std::vector<UINT32> words(end / 2);
+
+    for (uint32_t i = 0; i < end / 2; i++)
+        words[i] = image.Word(2 * i);
+    return words;
+}
+
+// Every page of the new image encoded and applied as whole, at frame
+// sizes down to a few ops, and the result compared.
+void TestEncodeApply()
+{
+    Image base = Synthesize(12);
+    const uint32_t end = 2 * PATCH_PAGE_INSTRUCTIONS * 5;
+
+    for (const std::string &kind : EditKinds())
+    {
+        Image image = Edited(base, kind);
+        std::vector<UINT32> target = Words(image, end);
+        oldWords = Words(base, end);
+
+        for (UINT outMax : {995u, 64u, 7u})
+        {
+            T_PATCH patch = {0, 0, pageBuffer, ReadOld, PageDone};
+            std::vector<uint8_t> out(outMax);
+            newWords.clear();
+            for (UINT i = 0; i < target.size();)
+            {
+                UINT used = 0;
+                UINT len = PatchEncode(2 * i, &target[i], (UINT)target.size() - i, oldWords.data(),
+                                       (UINT32)oldWords.size(), out.data(), outMax, &used);
+                CHECK(used > 0);
+                CHECK(len <= outMax);
+                if (used == 0)
+                    break;
+                CHECK_EQ(PatchApply(&patch, out.data(), len), 0);
+                i += used;
+            }
+            CHECK(newWords == target);
+        }
+    }
+}
+
+void TestApplyMalformed()
+{
+    T_PATCH patch = {0, 0, pageBuffer, ReadOld, PageDone};
+    oldWords.assign(2 * PATCH_PAGE_INSTRUCTIONS, 0x000123);
+
+    // Too short, not on a page.
+    CHECK_EQ(PatchApply(&patch, std::vector<uint8_t>{0x00, 0x08}.data(), 2), 1);
+    CHECK_EQ(PatchApply(&patch, std::vector<uint8_t>{0x02, 0x08, 0x00, PATCH_COPY}.data(), 4), 1);
+
+    // Literal without its instructions, move and fill without their value.
+    std::vector<uint8_t> frame = {0x00, 0x08, 0x00, PATCH_LITERAL | 1, 1, 2, 3, 4, 5};
+    CHECK_EQ(PatchApply(&patch, frame.data(), frame.size()), 1);
+    for (uint8_t op : {PATCH_MOVE, PATCH_FILL})
+    {
+        frame = {0x00, 0x08, 0x00, op, 0x00, 0x00};
+        CHECK_EQ(PatchApply(&patch, frame.data(), frame.size()), 1);
+    }
+
+    // 1020 instructions, then an op of 8 crossing into the next page.
+    patch.Pos = 0;
+    frame = {0x00, 0x08, 0x00};
+    for (int i = 0; i < 15; i++)
+        frame.push_back(PATCH_COPY | (PATCH_MAX_RUN - 1));
+    frame.push_back(PATCH_COPY | 59);
+    CHECK_EQ(PatchApply(&patch, frame.data(), frame.size()), 0);
+    CHECK_EQ(patch.Pos, 1020);
+    std::vector<uint8_t> next = {(uint8_t)(0x0800 + 2 * 1020), (uint8_t)((0x0800 + 2 * 1020) >> 8), 0x00, PATCH_COPY | 7};
+    CHECK_EQ(PatchApply(&patch, next.data(), next.size()), 1);
+
+    // Nor may a frame skip ahead within the page.
+    next = {(uint8_t)(0x0800 + 2 * 1022), (uint8_t)((0x0800 + 2 * 1022) >> 8), 0x00, PATCH_COPY | 1};
+    CHECK_EQ(PatchApply(&patch, next.data(), next.size()), 1);
+}
+
+size_t ChangedPages(const Image &base, const Image &image, const BootInfo &info)
+{
+    size_t pages = 0;
+
+    for (uint32_t page = info.appFirst; page < info.appLast; page += info.pageSize)
+    {
+        for (uint32_t a = page; a < page + info.pageSize; a += 2)
+        {
+            if (image.Word(a) != base.Word(a))
+            {
+                pages++;
+                break;
+            }
+        }
+    }
+    return pages;
+}
+
+// EncodePatch() frames through the boot loader, the old image in flash.
+void TestFirmware()
+{
+    BootInfo info = Loopback().Info();
+    Image base = Synthesize(24);
+
+    base.Restrict(info);
+    for (const std::string &kind : EditKinds())
+    {
+        Image image = Edited(base, kind);
+        image.Restrict(info);
+
+        for (size_t maxPayload : {info.MaxPayload(), (size_t)64})
+        {
+            Loopback device;
+            std::vector<uint8_t> resp;
+            std::vector<Payload> payloads = EncodePatch(base, image, info, maxPayload);
+
+            for (const auto &w : base.Words())
+                *simProgWord(w.first) = w.second;
+            CHECK(!payloads.empty());
+            CHECK(device.Program(payloads));
+            // The next session programs the last page from the cache.
+            CHECK(device.Command(READ_BOOT_INFO, {}, &resp));
+            CHECK(Loopback::FlashHolds(image));
+            CHECK_EQ(SimFlashStats.PageErases, ChangedPages(base, image, info));
+            CHECK_EQ(SimFlashStats.ProgramErrors, 0);
+        }
+    }
+}
+
+}
+
+int main()
+{
+    TestEncodeApply();
+    TestApplyMalformed();
+    TestFirmware();
+    return CheckResult();
+}
@@ -64,9 +64,9 @@ INT main(void)
    BYTE timer_ro = 1;
 
    // switch to FRC w/PLL to keep up at higher baud rates (120MHz!
-   PLLFBD=63;
-   CLKDIVbits.PLLPOST = 0;
-   CLKDIVbits.PLLPRE = 0;
+   PLLFBD = PLL_M - 2;
+   CLKDIVbits.PLLPOST = PLL_N2/2 - 1;
+   CLKDIVbits.PLLPRE = PLL_N1 - 2;
 
     __builtin_write_OSCCONH(0x01);
    __builtin_write_OSCCONL(OSCCON | 0x01);
@@ -151,6 +151,7 @@ INT main(void)
 void JumpToApp(void)
 {
    printString("APP");
+   uartClose();
    void (*fptr)(void);
    fptr = (void (*)(void))0;
    fptr();
@@ -41,6 +41,7 @@
 
 #include "BootLoader.h"
 #include "NVMem.h"
+#include "Patch.h"
 #include  <string.h>
 
 #define DATA_RECORD 		0
@@ -49,10 +50,21 @@
 #define EXT_LIN_ADRS_RECORD 4
 
 #define FLASH_PAGE_SIZE		 			(2*1024)
+#define MAIN_FLASH_END_ADRS				(0x055800)
+#define MAIN_FLASH_PAGES				(MAIN_FLASH_END_ADRS/FLASH_PAGE_SIZE)
+#define FLASH_PAGE_INSTRUCTIONS			(FLASH_PAGE_SIZE/2)
+#define FLASH_PAGE_ROWS					(FLASH_PAGE_SIZE/NVMEM_ROW_SIZE)
+#define MAX_RANGE_LEN					((UINT32)MAIN_FLASH_END_ADRS*2)	// Main flash in hex bytes.
 #define AUX_FLASH_BASE_ADRS				(0x7FC000)
 #define AUX_FLASH_END_ADRS				(0x7FFFFF)
 #define DEV_CONFIG_REG_BASE_ADDRESS 	(0xF80000)
 #define DEV_CONFIG_REG_END_ADDRESS   	(0xF80012)
+#define DEV_ID_ADDRESS					(0xFF0000)
+
+// Boot area and device configuration bits are never written.
+#define PROGRAMMABLE_ADDRESS(a)	\
+	((((a) < AUX_FLASH_BASE_ADRS) || ((a) > AUX_FLASH_END_ADRS))	\
+	 && (((a) < DEV_CONFIG_REG_BASE_ADDRESS) || ((a) > DEV_CONFIG_REG_END_ADDRESS)))
 
 
 typedef enum
@@ -61,10 +73,75 @@ typedef enum
 	ERASE_FLASH, 
 	PROGRAM_FLASH,
 	READ_CRC,
-	JMP_TO_APP
+	JMP_TO_APP,
+	ERASE_RANGE,
+	READ_STATS,
+	CHANGE_BAUD,
+	PROGRAM_BLOCK,
+	PROGRAM_PACKED,
+	PROGRAM_COMPRESSED,
+	PROGRAM_PATCH,
+	BATCH,
+
+	SEQ_ACK = 0x7E,		// Cumulative acknowledge of sequenced frames.
+	SEQ_NAK = 0x7F		// Retransmit request, starting at the given sequence number.
 	
 }T_COMMANDS;	
 
+// Commands this boot loader handles, bit n set for command n.
+#define SUPPORTED_COMMANDS	((1ul << READ_BOOT_INFO) | (1ul << ERASE_FLASH) | (1ul << PROGRAM_FLASH)	\
+							| (1ul << READ_CRC) | (1ul << JMP_TO_APP) | (1ul << ERASE_RANGE)	\
+							| (1ul << READ_STATS) | (1ul << CHANGE_BAUD) | (1ul << PROGRAM_BLOCK)	\
+							| (1ul << PROGRAM_PACKED) | (1ul << PROGRAM_COMPRESSED)	\
+							| (1ul << PROGRAM_PATCH) | (1ul << BATCH))
+
+// Behaviour the commands alone don't tell, BI_FEATURES bits.
+#define FEATURE_LAZY_ERASE	0x00000001ul	// A page is erased when first written, ERASE_FLASH not needed.
+#define SUPPORTED_FEATURES	(FEATURE_LAZY_ERASE)
+
+// Capability descriptor, appended to the READ_BOOT_INFO response as
+// type, length, value entries. Hosts skip types they don't know.
+typedef enum
+{
+	BI_FRAME_SIZE = 1,		// UINT16, largest frame data field, CRC included.
+	BI_RX_WINDOW,			// UINT8, sequenced frames the host may have outstanding.
+	BI_COMMANDS,			// UINT32, SUPPORTED_COMMANDS.
+	BI_FLASH_GEOMETRY,		// UINT16 page size, UINT16 row size, in program addresses.
+	BI_APP_RANGE,			// UINT32 first, UINT32 last program address of the application.
+	BI_EXCLUDED_RANGES,		// UINT32 first, UINT32 last, per range never programmed.
+	BI_DEVICE_ID,			// UINT16 DEVID, UINT16 DEVREV.
+	BI_BAUD_RATES,			// UINT32 per CHANGE_BAUD rate within BAUD_MAX_ERROR.
+	BI_FEATURES				// UINT32, SUPPORTED_FEATURES.
+	
+}T_BOOT_INFO_TYPES;
+
+// Command byte flag of a sequenced (pipelined) frame. The sequence number
+// follows the command byte, the response carries the same header and
+// acknowledges every frame up to and including that sequence number.
+#define SEQ_FLAG			0x80
+
+#define NO_RESPONSE			(-1)
+
+// PROGRAM_COMPRESSED data, after the start address, is an LZ77 style stream
+// of the packed (3 bytes per instruction) image. Each frame is decompressed
+// on its own, back references reach at most LZ_WINDOW_SIZE bytes back.
+//  0x00..0x7F		Literal run, token + 1 bytes follow.
+//  0x80..0xFF		Match of (token & 0x7F) + LZ_MIN_MATCH bytes, followed by
+//					the distance (2 bytes, LSB first, 1..LZ_WINDOW_SIZE).
+#define LZ_WINDOW_SIZE		1024	// Must be a power of 2.
+#define LZ_MIN_MATCH		4
+
+// BATCH data is a list of sub-commands: command (1), length (2, LSB first),
+// data. The response holds the number of sub-commands executed, 0 if all
+// were executed or 1 if the list stopped early, then command (1), response
+// length (1) and response per sub-command executed.
+#define BATCH_RESP_SIZE		(FRAMEWORK_BUFF_SIZE - 4)	// Sequence header and CRC.
+#define BATCH_MAX_SUB_RESP	128		// Room kept free for the next sub-command.
+#define BATCH_MAX_COUNT		255		// Sub-commands the count byte can number.
+
+// Largest deviation from the requested baud rate CHANGE_BAUD accepts, in 1/1000.
+#define BAUD_MAX_ERROR		20
+
 
 typedef struct
 {
@@ -91,19 +168,149 @@ static const UINT8 BootInfo[2] =
     0
 };
 
+// Common baud rates offered in the capability descriptor, if the baud rate
+// generator gets them within BAUD_MAX_ERROR.
+static const UINT32 BaudRates[] =
+{
+	115200, 230400, 460800, 500000, 921600, 1000000, 1500000, 2000000, 3000000
+};
+
+
+#ifdef CRC_BYTE_TABLE
+/**
+ * Static table used for the table_driven implementation, one byte per step.
+ * Kept in program memory and read through PSV.
+ *****************************************************************************/
+static const UINT16 crc_table[256] __attribute__((space(auto_psv))) = 
+{
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+    0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef,
+    0x1231, 0x0210, 0x3273, 0x2252, 0x52b5, 0x4294, 0x72f7, 0x62d6,
+    0x9339, 0x8318, 0xb37b, 0xa35a, 0xd3bd, 0xc39c, 0xf3ff, 0xe3de,
+    0x2462, 0x3443, 0x0420, 0x1401, 0x64e6, 0x74c7, 0x44a4, 0x5485,
+    0xa56a, 0xb54b, 0x8528, 0x9509, 0xe5ee, 0xf5cf, 0xc5ac, 0xd58d,
+    0x3653, 0x2672, 0x1611, 0x0630, 0x76d7, 0x66f6, 0x5695, 0x46b4,
+    0xb75b, 0xa77a, 0x9719, 0x8738, 0xf7df, 0xe7fe, 0xd79d, 0xc7bc,
+    0x48c4, 0x58e5, 0x6886, 0x78a7, 0x0840, 0x1861, 0x2802, 0x3823,
+    0xc9cc, 0xd9ed, 0xe98e, 0xf9af, 0x8948, 0x9969, 0xa90a, 0xb92b,
+    0x5af5, 0x4ad4, 0x7ab7, 0x6a96, 0x1a71, 0x0a50, 0x3a33, 0x2a12,
+    0xdbfd, 0xcbdc, 0xfbbf, 0xeb9e, 0x9b79, 0x8b58, 0xbb3b, 0xab1a,
+    0x6ca6, 0x7c87, 0x4ce4, 0x5cc5, 0x2c22, 0x3c03, 0x0c60, 0x1c41,
+    0xedae, 0xfd8f, 0xcdec, 0xddcd, 0xad2a, 0xbd0b, 0x8d68, 0x9d49,
+    0x7e97, 0x6eb6, 0x5ed5, 0x4ef4, 0x3e13, 0x2e32, 0x1e51, 0x0e70,
+    0xff9f, 0xefbe, 0xdfdd, 0xcffc, 0xbf1b, 0xaf3a, 0x9f59, 0x8f78,
+    0x9188, 0x81a9, 0xb1ca, 0xa1eb, 0xd10c, 0xc12d, 0xf14e, 0xe16f,
+    0x1080, 0x00a1, 0x30c2, 0x20e3, 0x5004, 0x4025, 0x7046, 0x6067,
+    0x83b9, 0x9398, 0xa3fb, 0xb3da, 0xc33d, 0xd31c, 0xe37f, 0xf35e,
+    0x02b1, 0x1290, 0x22f3, 0x32d2, 0x4235, 0x5214, 0x6277, 0x7256,
+    0xb5ea, 0xa5cb, 0x95a8, 0x8589, 0xf56e, 0xe54f, 0xd52c, 0xc50d,
+    0x34e2, 0x24c3, 0x14a0, 0x0481, 0x7466, 0x6447, 0x5424, 0x4405,
+    0xa7db, 0xb7fa, 0x8799, 0x97b8, 0xe75f, 0xf77e, 0xc71d, 0xd73c,
+    0x26d3, 0x36f2, 0x0691, 0x16b0, 0x6657, 0x7676, 0x4615, 0x5634,
+    0xd94c, 0xc96d, 0xf90e, 0xe92f, 0x99c8, 0x89e9, 0xb98a, 0xa9ab,
+    0x5844, 0x4865, 0x7806, 0x6827, 0x18c0, 0x08e1, 0x3882, 0x28a3,
+    0xcb7d, 0xdb5c, 0xeb3f, 0xfb1e, 0x8bf9, 0x9bd8, 0xabbb, 0xbb9a,
+    0x4a75, 0x5a54, 0x6a37, 0x7a16, 0x0af1, 0x1ad0, 0x2ab3, 0x3a92,
+    0xfd2e, 0xed0f, 0xdd6c, 0xcd4d, 0xbdaa, 0xad8b, 0x9de8, 0x8dc9,
+    0x7c26, 0x6c07, 0x5c64, 0x4c45, 0x3ca2, 0x2c83, 0x1ce0, 0x0cc1,
+    0xef1f, 0xff3e, 0xcf5d, 0xdf7c, 0xaf9b, 0xbfba, 0x8fd9, 0x9ff8,
+    0x6e17, 0x7e36, 0x4e55, 0x5e74, 0x2e93, 0x3eb2, 0x0ed1, 0x1ef0
+};
+
+// Shifts one data byte into the CRC.
+#define CRC_UPDATE(crc, data, i)	\
+	i = ((crc >> 8) ^ (data)) & 0xFF;	\
+	crc = crc_table[i] ^ (crc << 8)
+#else
+/**
+ * Static table used for the table_driven implementation.
+ *****************************************************************************/
+static const UINT16 crc_table[16] = 
+{
+    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
+    0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef
+};
+
+// Shifts one data byte into the CRC, one nibble at a time.
+#define CRC_UPDATE(crc, data, i)	\
+	i = (crc >> 12) ^ ((data) >> 4);	\
+	crc = crc_table[i & 0x0F] ^ (crc << 4);	\
+	i = (crc >> 12) ^ ((data) >> 0);	\
+	crc = crc_table[i & 0x0F] ^ (crc << 4)
+#endif
 
-static T_FRAME RxBuff;
-static T_FRAME TxBuff;
-static BOOL RxFrameValid;
+
+// Receive frame pool. The parser fills RxSlot[RxFill] while earlier frames
+// wait for processing, starting at RxSlot[RxProc]. Both run between
+// commands, from the main loop. Slots are handed over by index, frames are
+// never copied.
+static FAR T_FRAME RxSlot[FRAMEWORK_RX_SLOTS];
+static UINT8 RxFill;			// Slot the parser is filling.
+static UINT8 RxProc;			// Oldest valid frame.
+static UINT8 RxReady;			// Number of valid frames waiting.
+static UINT16 RxCrc;			// CRC of the frame being received, two bytes behind.
+static FAR T_FRAME TxBuff;
+static BOOL RxFrameBad;			// Frame with CRC error received.
+
+// Sliding window state of sequenced frames.
+static BOOL Pipelining = FALSE;	// Host sends sequenced frames in this session.
+static UINT8 ExpectedSeq;		// Sequence number of the next frame to process.
+static BOOL NakSent;			// Retransmit already requested for ExpectedSeq.
+
+static UINT16 RxFrames;			// Valid frames received, wraps around.
+static BOOL BaudChangePending;	// CHANGE_BAUD accepted, switch once the response is out.
+static UINT16 NewBrg;			// Baud rate generator value to switch to.
+
+// Most recent bytes produced by the PROGRAM_COMPRESSED decompressor.
+static FAR UINT8 LzWindow[LZ_WINDOW_SIZE];
+
+UINT32 PatchRead(UINT32 progAddress);
+void PatchPageDone(UINT32 progAddress, UINT32 *page);
+
+// PROGRAM_PATCH rebuilds each new page here from the installed image.
+static FAR UINT32 PatchPage[FLASH_PAGE_INSTRUCTIONS];
+static T_PATCH Patch = {0, 0, PatchPage, PatchRead, PatchPageDone};
+
+// Page write cache. Instructions decoded from hex records are collected here,
+// across records and frames, so that complete rows can be programmed with NVMemWriteRow()
+// and a complete page can be compared against flash before it is erased.
+#define PAGE_CACHE_EMPTY	(0xFFFFFFFF)
+
+static FAR UINT32 PageCache[FLASH_PAGE_INSTRUCTIONS];
+static UINT16 PageValid[FLASH_PAGE_INSTRUCTIONS/16];	// One bit per instruction in PageCache.
+static UINT RowFill[FLASH_PAGE_ROWS];					// Number of valid instructions per row.
+static UINT32 PageAddress = PAGE_CACHE_EMPTY;
+
+T_PAGE_CACHE_STATS PageCacheStats;
+
+// One bit per main flash page, set once the page has been erased (or found
+// identical to the new image) in this session.
+static UINT8 PageErased[(MAIN_FLASH_PAGES + 7)/8];
 
 static BOOL RunApplication = FALSE;
 static BOOL pc_comm = FALSE;
 
-void HandleCommand(void);
-void BuildRxFrame(UINT8 *RxData, INT16 RxLen);
+INT HandleCommand(UINT8 Cmd, UINT8 *Data, UINT DataLen, UINT8 *Resp);
+INT HandleBatch(UINT8 *Data, UINT DataLen, UINT8 *Resp);
+UINT BuildRxFrame(UINT8 *RxData, INT16 RxLen);
 UINT GetTransmitFrame(UINT8* Buff);
 void WriteHexRecord2Flash(UINT8* HexRecord, UINT totalRecLen);
-BOOL BaudRateChangeRequested(void);
+UINT8 WriteBlock2Flash(UINT8 *Block, UINT BlockLen, UINT WordSize);
+UINT8 WriteCompressed2Flash(UINT8 *Data, UINT DataLen);
+void ProgramInstruction(UINT32 ProgAddress, UINT32 WrData);
+void PageCacheStore(UINT32 progAddress, UINT32 data);
+void PageCacheFlush(void);
+void PageCacheWriteRow(UINT row);
+BOOL PageCacheMatchesFlash(void);
+BOOL PageIsErased(UINT32 address);
+void MarkPageErased(UINT32 address);
+UINT EraseFlashRange(UINT32 address, UINT32 len);
+void ErasePageOnce(UINT32 address);
+BOOL BaudRateChangeRequested(UINT16 *Brg);
+UINT16 ValidFramesReceived(void);
+BOOL CalculateBrg(UINT32 baud, UINT16 *Brg, UINT32 *Actual, INT16 *Error);
+UINT BuildBootInfo(UINT8 *Resp);
+UINT PutTlv(UINT8 *Resp, UINT8 Type, const void *Value, UINT8 Len);
 UINT16 CalculateCrc(UINT8 *data, UINT32 len);
 UINT16 CalculateCrcProgMem(UINT32 progAdrs, UINT32 len);
 
@@ -119,6 +326,9 @@ UINT16 CalculateCrcProgMem(UINT32 progAdrs, UINT32 len);
 * Side Effects:	None.
 *
 * Overview: 	Process the command if there is a valid fame.
+*				Sequenced frames are processed strictly in order, a
+*				frame out of order or with a CRC error gets a SEQ_NAK
+*				asking the host to go back to the first missing frame.
 *
 *			
 * Note:		 	None.
@@ -126,13 +336,90 @@ UINT16 CalculateCrcProgMem(UINT32 progAdrs, UINT32 len);
 
 int FrameWorkTask(void)
 {
+	UINT8 Cmd;
+	UINT8 Seq;
+	INT RespLen;
+	T_FRAME *Rx;
 	
-	if(RxFrameValid)
+	if(RxFrameBad && (RxReady == 0))
+	{
+		// Frames received before the bad one are answered first.
+		RxFrameBad = FALSE;
+		if(Pipelining && !NakSent)
+		{
+			// Host is streaming, ask for a retransmit instead of waiting for its timeout.
+			TxBuff.Data[0] = SEQ_NAK;
+			TxBuff.Data[1] = ExpectedSeq;
+			TxBuff.Len = 2;
+			NakSent = TRUE;
+			return 1;
+		}
+	}
+
+	if(RxReady)
 	{
 		// Valid frame received, process the command.
-		HandleCommand();	
-		// Reset the flag.
-		RxFrameValid = FALSE;
+		Rx = &RxSlot[RxProc];
+		Cmd = Rx->Data[0];
+		TxBuff.Len = 0;
+
+		if((Cmd & SEQ_FLAG) && (Rx->Len > 3))
+		{
+			Seq = Rx->Data[1];
+			if((Cmd & ~SEQ_FLAG) == READ_BOOT_INFO)
+			{
+				// Host (re)starts a sequenced session.
+				Pipelining = TRUE;
+				ExpectedSeq = Seq;
+			}
+
+			if(Seq == ExpectedSeq)
+			{
+				TxBuff.Data[0] = Cmd;
+				TxBuff.Data[1] = Seq;
+				RespLen = HandleCommand(Cmd & ~SEQ_FLAG, &Rx->Data[2], Rx->Len - 4, &TxBuff.Data[2]);
+				// Always acknowledge, even commands without a response.
+				TxBuff.Len = 2 + ((RespLen > 0) ? RespLen : 0);
+				ExpectedSeq++;
+				NakSent = FALSE;
+			}
+			else if((UINT8)(ExpectedSeq - Seq) <= FRAMEWORK_RX_WINDOW)
+			{
+				// Already processed, our acknowledge got lost. Acknowledge again.
+				TxBuff.Data[0] = SEQ_ACK;
+				TxBuff.Data[1] = ExpectedSeq - 1;
+				TxBuff.Len = 2;
+			}
+			else if(!NakSent)
+			{
+				// A frame is missing, frames after it are dropped until it is retransmitted.
+				TxBuff.Data[0] = SEQ_NAK;
+				TxBuff.Data[1] = ExpectedSeq;
+				TxBuff.Len = 2;
+				NakSent = TRUE;
+			}
+		}
+		else
+		{
+			if(Cmd == READ_BOOT_INFO)
+			{
+				// Host starts over unsequenced, no SEQ_ACK/NAK for it.
+				Pipelining = FALSE;
+				NakSent = FALSE;
+			}
+			// Partially build response frame. First byte in the data field carries command.
+			TxBuff.Data[0] = Cmd;
+			RespLen = HandleCommand(Cmd, &Rx->Data[1], Rx->Len - 3, &TxBuff.Data[1]);	//Negate length of command and CRC.
+			if(RespLen != NO_RESPONSE)
+			{
+				TxBuff.Len = 1 + RespLen;
+			}
+		}
+
+		// Slot is free for the parser again.
+		Rx->Len = 0;
+		RxProc = (RxProc + 1) % FRAMEWORK_RX_SLOTS;
+		RxReady--;
       return 1;
 	}
    return 0;
@@ -144,74 +431,170 @@ int FrameWorkTask(void)
 *
 * Precondition: 
 *
-* Input: 		None.
+* Input: 		Command, its data field and the response buffer.
 *
-* Output:		None.
+* Output:		Length of the response (not counting the command), or
+*				NO_RESPONSE.
 *
 * Side Effects:	None.
 *
-* Overview: 	Process the received frame and take action depending on
-				the command received.
+* Overview: 	Take action depending on the command received.
 *
 *			
 * Note:		 	None.
 ********************************************************************/
-void HandleCommand(void)
+INT HandleCommand(UINT8 Cmd, UINT8 *Data, UINT DataLen, UINT8 *Resp)
 {
-	UINT8 Cmd;
 	DWORD_VAL Address;
 	DWORD_VAL Length;
 	UINT Result;
 	WORD_VAL crc;
+	WORD_VAL pages;
+	DWORD_VAL baud;
+	UINT16 brg;
+	INT16 err;
+	INT RespLen = NO_RESPONSE;
 
-	
-	// First byte of the data field is command.
-	Cmd = RxBuff.Data[0];
-	// Partially build response frame. First byte in the data field carries command.
-	TxBuff.Data[0] = RxBuff.Data[0];
-	
-	// Reset the response length to 0.
-	TxBuff.Len = 0;
-			
 	// Process the command.		
 	switch(Cmd)
 	{
 		case READ_BOOT_INFO: // Read boot loader version info.
          pc_comm = TRUE;
-			memcpy(&TxBuff.Data[1], BootInfo, 2);
-			//Set the transmit frame length.
-			TxBuff.Len = 2 + 1; // Boot Info Fields	+ command
+			// Data of the previous session was acknowledged already, program it
+			// while its page is still known to be erased.
+			PageCacheFlush();
+			// New session, every page has to be erased again before it is written.
+			memset(PageErased, 0, sizeof(PageErased));
+			memset(&PageCacheStats, 0, sizeof(PageCacheStats));
+			Patch.Pos = 0;
+			RespLen = BuildBootInfo(Resp);
 			break;
 			
 		case ERASE_FLASH:
+			// Anything still cached would be wiped by the erase, drop it.
+			PageAddress = PAGE_CACHE_EMPTY;
 			Result = NVMemBlockErase();
 			// Assert on NV error. This must be caught during debug phase.
 			ASSERT(Result==0);
-					           
-            //Set the transmit frame length.
-            TxBuff.Len = 1; // Command
+			// Whole main flash is erased now.
+			memset(PageErased, 0xFF, sizeof(PageErased));
+			RespLen = 0;
 			break;
 		
 		case PROGRAM_FLASH:
-		    WriteHexRecord2Flash(&RxBuff.Data[1], RxBuff.Len-3);	//Negate length of command and CRC RxBuff.Len.
-		    //Set the transmit frame length.
-            TxBuff.Len = 1; // Command	    	
+		    WriteHexRecord2Flash(Data, DataLen);
+			RespLen = 0;
 		   	break;
 		   
+		case PROGRAM_BLOCK:
+			Resp[0] = WriteBlock2Flash(Data, DataLen, 4);
+			RespLen = 1;	// Status, 0 if the block was accepted.
+			break;
+		   
+		case PROGRAM_PACKED:
+			// As PROGRAM_BLOCK, without the phantom bytes.
+			Resp[0] = WriteBlock2Flash(Data, DataLen, 3);
+			RespLen = 1;	// Status, 0 if the block was accepted.
+			break;
+		   
+		case PROGRAM_COMPRESSED:
+			Resp[0] = WriteCompressed2Flash(Data, DataLen);
+			RespLen = 1;	// Status, 0 if the stream was decoded completely.
+			break;
+		   
+		case PROGRAM_PATCH:
+			Resp[0] = PatchApply(&Patch, Data, DataLen);
+			RespLen = 1;	// Status, 0 if the patch frame was applied.
+			break;
+		   
+		case BATCH:
+			RespLen = HandleBatch(Data, DataLen, Resp);
+			break;
+		   
 		   
 		case READ_CRC:
+			// No response data if address and length are missing or the
+			// length is more than all of main flash.
+			RespLen = 0;
+			if(DataLen < 8)
+			{
+				break;
+			}
 			 // Get address from the packet.
-    	    memcpy(&Address.v[0], &RxBuff.Data[1], sizeof(Address.Val));
-    	    memcpy(&Length.v[0], &RxBuff.Data[5], sizeof(Length.Val));
+    	    memcpy(&Address.v[0], &Data[0], sizeof(Address.Val));
+    	    memcpy(&Length.v[0], &Data[4], sizeof(Length.Val));
+			if(Length.Val > MAX_RANGE_LEN)
+			{
+				break;
+			}
+			// CRC must cover everything received so far.
+			PageCacheFlush();
 			crc.Val = CalculateCrcProgMem(Address.Val, Length.Val);
-			memcpy(&TxBuff.Data[1], &crc.v[0], 2);	
-			
-			//Set the transmit frame length.
-            TxBuff.Len = 1 + 2;	// Command + 2 bytes of CRC.
-			
+			memcpy(&Resp[0], &crc.v[0], 2);	
+			RespLen = 2;	// 2 bytes of CRC.
+			break;
+	    
+		case ERASE_RANGE:
+			// No response data if address and length are missing or the
+			// length is more than all of main flash.
+			RespLen = 0;
+			if(DataLen < 8)
+			{
+				break;
+			}
+			// Get address and length from the packet.
+    	    memcpy(&Address.v[0], &Data[0], sizeof(Address.Val));
+    	    memcpy(&Length.v[0], &Data[4], sizeof(Length.Val));
+			if(Length.Val > MAX_RANGE_LEN)
+			{
+				break;
+			}
+			// Program pending data before erasing, commands are executed in order.
+			PageCacheFlush();
+			pages.Val = EraseFlashRange(Address.Val, Length.Val);
+			memcpy(&Resp[0], &pages.v[0], 2);
+			RespLen = 2;	// 2 bytes of erased page count.
+			break;
+	    
+		case READ_STATS:
+			// Pages programmed vs. pages skipped because flash already held the data,
+			// then blank instructions and rows that needed no programming.
+			memcpy(&Resp[0], &PageCacheStats.PagesWritten, 4);
+			memcpy(&Resp[4], &PageCacheStats.PagesSkipped, 4);
+			memcpy(&Resp[8], &PageCacheStats.BlankWordsSkipped, 4);
+			memcpy(&Resp[12], &PageCacheStats.BlankRowsSkipped, 4);
+			RespLen = 16;	// 4 counters.
+			break;
+	    
+		case CHANGE_BAUD:
+			Resp[0] = 1;
+			baud.Val = 0;
+			err = 0;
+			// Requested baud rate, Fcy/4 (BRG = 0) at most.
+			if(DataLen >= sizeof(baud.Val))
+			{
+				memcpy(&baud.v[0], &Data[0], sizeof(baud.Val));
+			}
+			if((baud.Val == 0) || (baud.Val > SYS_FCY/4))
+			{
+				// Refused, actual rate and error 0.
+				baud.Val = 0;
+			}
+			else if(CalculateBrg(baud.Val, &brg, &baud.Val, &err))
+			{
+				// Switch after this response has been sent.
+				Resp[0] = 0;
+				NewBrg = brg;
+				BaudChangePending = TRUE;
+			}
+			memcpy(&Resp[1], &baud.v[0], 4);
+			memcpy(&Resp[5], &err, 2);
+			RespLen = 7;	// Status, achieved baud rate, error.
 			break;
 	    
 	    case JMP_TO_APP:
+	    	// Program the last cached page before leaving.
+	    	PageCacheFlush();
 	    	// Exit firmware upgrade mode.
 	    	RunApplication = TRUE;
 	    	break;
@@ -220,6 +603,197 @@ void HandleCommand(void)
 	    	// Nothing to do.
 	    	break;
 	} 		
+
+	return RespLen;
+}
+
+
+/********************************************************************
+* Function: 	HandleBatch()
+*
+* Precondition: 
+*
+* Input: 		BATCH data field and the response buffer.
+*
+* Output:		Length of the aggregated response.
+*
+* Side Effects:	None.
+*
+* Overview: 	Executes the sub-commands in order, as if each came in
+*				a frame of its own. Stops at a malformed or nested
+*				BATCH entry, or when the response might not fit.
+*
+*			
+* Note:		 	A list of more than BATCH_MAX_COUNT entries is refused
+*				before any of them runs.
+********************************************************************/
+INT HandleBatch(UINT8 *Data, UINT DataLen, UINT8 *Resp)
+{
+	UINT8 Cmd;
+	WORD_VAL Len;
+	INT SubLen;
+	INT RespLen = 2;	// Count and status.
+	UINT Count = 0;
+	UINT i;
+
+	Resp[0] = 0;
+	Resp[1] = 0;
+
+	// The count byte would wrap, count the entries first.
+	for(i = 0; (i + 3) <= DataLen; i += 3 + Len.Val)
+	{
+		Len.byte.LB = Data[i + 1];
+		Len.byte.HB = Data[i + 2];
+		if(++Count > BATCH_MAX_COUNT)
+		{
+			Resp[1] = 1;
+			return RespLen;
+		}
+		if(Len.Val > (DataLen - i - 3))
+		{
+			break;		// Malformed, the loop below stops there.
+		}
+	}
+
+	while(DataLen)
+	{
+		if(DataLen < 3)
+		{
+			Resp[1] = 1;
+			break;
+		}
+		Cmd = Data[0];
+		Len.byte.LB = Data[1];
+		Len.byte.HB = Data[2];
+		Data += 3;
+		DataLen -= 3;
+
+		if((Len.Val > DataLen) || (Cmd == BATCH)
+		   || ((RespLen + 2 + BATCH_MAX_SUB_RESP) > BATCH_RESP_SIZE))
+		{
+			Resp[1] = 1;
+			break;
+		}
+
+		Resp[RespLen] = Cmd;
+		SubLen = HandleCommand(Cmd, Data, Len.Val, &Resp[RespLen + 2]);
+		if(SubLen == NO_RESPONSE)
+		{
+			SubLen = 0;
+		}
+		Resp[RespLen + 1] = (UINT8)SubLen;
+		RespLen += 2 + SubLen;
+		Resp[0]++;
+
+		Data += Len.Val;
+		DataLen -= Len.Val;
+	}
+
+	return RespLen;
+}
+
+
+/********************************************************************
+* Function: 	BuildBootInfo()
+*
+* Precondition: 
+*
+* Input: 		Response buffer.
+*
+* Output:		Length of the response.
+*
+* Side Effects:	None.
+*
+* Overview: 	Version bytes and receive window, as before, followed
+*				by the capability descriptor (T_BOOT_INFO_TYPES).
+*
+*			
+* Note:		 	Hosts that only know the version bytes ignore the rest.
+********************************************************************/
+UINT BuildBootInfo(UINT8 *Resp)
+{
+	UINT Len;
+	UINT i;
+	UINT16 words[2];
+	UINT32 ranges[4];
+	UINT32 baud;
+	UINT16 brg;
+	INT16 err;
+	UINT8 *rates;
+
+	memcpy(&Resp[0], BootInfo, 2);
+	// Number of sequenced frames the host may have outstanding.
+	Resp[2] = FRAMEWORK_RX_WINDOW;
+	Len = 2 + 1; // Boot Info Fields + window size
+
+	words[0] = FRAMEWORK_BUFF_SIZE;
+	Len += PutTlv(&Resp[Len], BI_FRAME_SIZE, words, 2);
+	Len += PutTlv(&Resp[Len], BI_RX_WINDOW, &Resp[2], 1);
+	ranges[0] = SUPPORTED_COMMANDS;
+	Len += PutTlv(&Resp[Len], BI_COMMANDS, ranges, 4);
+
+	words[0] = FLASH_PAGE_SIZE;
+	words[1] = NVMEM_ROW_SIZE;
+	Len += PutTlv(&Resp[Len], BI_FLASH_GEOMETRY, words, 4);
+
+	ranges[0] = 0;
+	ranges[1] = MAIN_FLASH_END_ADRS - 2;
+	Len += PutTlv(&Resp[Len], BI_APP_RANGE, ranges, 8);
+
+	ranges[0] = AUX_FLASH_BASE_ADRS;
+	ranges[1] = AUX_FLASH_END_ADRS;
+	ranges[2] = DEV_CONFIG_REG_BASE_ADDRESS;
+	ranges[3] = DEV_CONFIG_REG_END_ADDRESS;
+	Len += PutTlv(&Resp[Len], BI_EXCLUDED_RANGES, ranges, 16);
+
+	TBLPAG = (UINT8)(DEV_ID_ADDRESS >> 16);
+	words[0] = tblReadLow((UINT16)DEV_ID_ADDRESS);
+	words[1] = tblReadLow((UINT16)DEV_ID_ADDRESS + 2);
+	Len += PutTlv(&Resp[Len], BI_DEVICE_ID, words, 4);
+
+	// Rates are filled in place, after the type and length bytes.
+	rates = &Resp[Len + 2];
+	for(i = 0; i < sizeof(BaudRates)/sizeof(BaudRates[0]); i++)
+	{
+		if(CalculateBrg(BaudRates[i], &brg, &baud, &err))
+		{
+			memcpy(rates, &BaudRates[i], 4);
+			rates += 4;
+		}
+	}
+	Resp[Len] = BI_BAUD_RATES;
+	Resp[Len + 1] = (UINT8)(rates - &Resp[Len + 2]);
+	Len += 2 + Resp[Len + 1];
+
+	ranges[0] = SUPPORTED_FEATURES;
+	Len += PutTlv(&Resp[Len], BI_FEATURES, ranges, 4);
+
+	return Len;
+}
+
+
+/********************************************************************
+* Function: 	PutTlv()
+*
+* Precondition: 
+*
+* Input: 		Buffer, type, value and its length.
+*
+* Output:		Number of bytes added to the buffer.
+*
+* Side Effects:	None.
+*
+* Overview: 	Adds one capability descriptor entry.
+*
+*			
+* Note:		 	None.
+********************************************************************/
+UINT PutTlv(UINT8 *Resp, UINT8 Type, const void *Value, UINT8 Len)
+{
+	Resp[0] = Type;
+	Resp[1] = Len;
+	memcpy(&Resp[2], Value, Len);
+	return 2 + Len;
 }
 
 
@@ -230,30 +804,50 @@ void HandleCommand(void)
 *
 * Input: 		Pointer to Rx Data and Rx byte length.
 *
-* Output:		None.
+* Output:		Number of bytes consumed. Stops early once every slot
+*				of the receive frame pool holds a frame waiting to be
+*				processed.
 *
 * Side Effects:	None.
 *
-* Overview: 	Builds rx frame and checks CRC.
+* Overview: 	Builds rx frame and checks CRC. The CRC is calculated
+*				while the bytes arrive, checking it at EOT takes no time.
 *
 *			
 * Note:		 	None.
 ********************************************************************/
-void BuildRxFrame(UINT8 *RxData, INT16 RxLen)
+// Stores a received data byte. The CRC is updated as bytes arrive but lags
+// two bytes behind, so at EOT it covers everything except the frame CRC.
+// A frame longer than the buffer is dropped. One that fills it exactly is
+// still checked at EOT, BI_FRAME_SIZE announces the whole buffer.
+#define RX_STORE(data)	\
+	do	\
+	{	\
+		if(RxBuff->Len >= sizeof(RxBuff->Data))	\
+		{	\
+			RxBuff->Len = 0;	\
+			RxCrc = 0;	\
+		}	\
+		if(RxBuff->Len >= 2)	\
+		{	\
+			CRC_UPDATE(RxCrc, RxBuff->Data[RxBuff->Len-2], i);	\
+		}	\
+		RxBuff->Data[RxBuff->Len++] = (data);	\
+	}while(0)
+
+UINT BuildRxFrame(UINT8 *RxData, INT16 RxLen)
 {
 	static BOOL Escape = FALSE;
 	WORD_VAL crc;
+	UINT i;
+	UINT consumed = 0;
+	T_FRAME *RxBuff = &RxSlot[RxFill];
 	
 	
-	while((RxLen > 0) && (!RxFrameValid)) // Loop till len = 0 or till frame is valid
+	while((RxLen > 0) && (RxReady < FRAMEWORK_RX_SLOTS)) // Loop till len = 0 or till no slot is free
 	{
 		RxLen--;
 		
-		if(RxBuff.Len >= sizeof(RxBuff.Data))
-		{
-			RxBuff.Len = 0;
-		}	
-		
 		switch(*RxData)
 		{
 			
@@ -261,14 +855,15 @@ void BuildRxFrame(UINT8 *RxData, INT16 RxLen)
 				if(Escape)
 				{
 					// Received byte is not SOH, but data.
-					RxBuff.Data[RxBuff.Len++] = *RxData;
+					RX_STORE(*RxData);
 					// Reset Escape Flag.
 					Escape = FALSE;
 				}
 				else
 				{
 					// Received byte is indeed a SOH which indicates start of new frame.
-					RxBuff.Len = 0;				
+					RxBuff->Len = 0;				
+					RxCrc = 0;
 				}		
 				break;
 				
@@ -276,24 +871,41 @@ void BuildRxFrame(UINT8 *RxData, INT16 RxLen)
 				if(Escape)
 				{
 					// Received byte is not EOT, but data.
-					RxBuff.Data[RxBuff.Len++] = *RxData;
+					RX_STORE(*RxData);
 					// Reset Escape Flag.
 					Escape = FALSE;
 				}
 				else
 				{
 					// Received byte is indeed a EOT which indicates end of frame.
-					// Calculate CRC to check the validity of the frame.
-					if(RxBuff.Len > 1)
+					// Check the CRC to check the validity of the frame. RxCrc already
+					// covers everything up to the two CRC bytes.
+					if(RxBuff->Len > 1)
 					{
-						crc.byte.LB = RxBuff.Data[RxBuff.Len-2];
-						crc.byte.HB = RxBuff.Data[RxBuff.Len-1];
-						if((CalculateCrc(RxBuff.Data, (UINT32)(RxBuff.Len-2)) == crc.Val) && (RxBuff.Len > 2))
+						crc.byte.LB = RxBuff->Data[RxBuff->Len-2];
+						crc.byte.HB = RxBuff->Data[RxBuff->Len-1];
+						if((RxCrc == crc.Val) && (RxBuff->Len > 2))
 						{
 							// CRC matches and frame received is valid.
-							RxFrameValid = TRUE;
+							// Hand the slot over and go on with the next one.
+							RxReady++;
+							RxFrames++;
+							RxFill = (RxFill + 1) % FRAMEWORK_RX_SLOTS;
+							RxBuff = &RxSlot[RxFill];
+							if(RxReady < FRAMEWORK_RX_SLOTS)
+							{
+								// Next slot is free, otherwise it still holds a frame
+								// to process and FrameWorkTask() empties it.
+								RxBuff->Len = 0;
+							}
+							RxCrc = 0;
 												
 						}
+						else
+						{
+							// Corrupted frame, may need a retransmit.
+							RxFrameBad = TRUE;
+						}
 					}		
 					
 				}							
@@ -304,7 +916,7 @@ void BuildRxFrame(UINT8 *RxData, INT16 RxLen)
 				if(Escape)
 				{
 					// Received byte is not ESC but data.
-					RxBuff.Data[RxBuff.Len++] = *RxData;
+					RX_STORE(*RxData);
 					// Reset Escape Flag.
 					Escape = FALSE;					
 				}
@@ -316,7 +928,7 @@ void BuildRxFrame(UINT8 *RxData, INT16 RxLen)
 				break;
 			
 			default: // Data field.
-			    RxBuff.Data[RxBuff.Len++] = *RxData;
+			    RX_STORE(*RxData);
 			    // Reset Escape Flag.
 			    Escape = FALSE;
 				break;	
@@ -325,9 +937,11 @@ void BuildRxFrame(UINT8 *RxData, INT16 RxLen)
 
 		//Increment the pointer.
 		RxData++;	
+		consumed++;
 	
 	}	
 	
+	return consumed;
 }	
 
 
@@ -351,7 +965,7 @@ UINT GetTransmitFrame(UINT8* Buff)
 {
 	INT BuffLen = 0;
 	WORD_VAL crc;
-	UINT8 i;
+	UINT i;
 	
 	if(TxBuff.Len) 
 	{
@@ -413,7 +1027,6 @@ void WriteHexRecord2Flash(UINT8* HexRecord, UINT totalHexRecLen)
 	UINT i;
 	UINT32 WrData;
 	UINT32 ProgAddress;
-	UINT Result;
 	UINT32 nextRecStartPt = 0;
 
 
@@ -468,8 +1081,7 @@ void WriteHexRecord2Flash(UINT8* HexRecord, UINT totalHexRecLen)
 						ProgAddress = (HexRecordSt.Address.Val/2);
 						
 						// Make sure we are not writing boot area and device configuration bits.
-						if(((ProgAddress < AUX_FLASH_BASE_ADRS) || (ProgAddress > AUX_FLASH_END_ADRS))
-						   && ((ProgAddress < DEV_CONFIG_REG_BASE_ADDRESS) || (ProgAddress > DEV_CONFIG_REG_END_ADDRESS)))
+						if(PROGRAMMABLE_ADDRESS(ProgAddress))
 						{
 							if(HexRecordSt.RecDataLen < 4)
 							{
@@ -483,10 +1095,8 @@ void WriteHexRecord2Flash(UINT8* HexRecord, UINT totalHexRecLen)
 							{	
 								memcpy(&WrData, HexRecordSt.Data, 4);
 							}		
-							// Write the data into flash.	
-							Result = NVMemWriteWord(ProgAddress, WrData);	
-							// Assert on error. This must be caught during debug phase.		
-							ASSERT(Result==0);					
+							// Queue the data for programming.
+							PageCacheStore(ProgAddress, WrData);
 						}	
 						
 						// Increment the address.
@@ -524,6 +1134,12 @@ void WriteHexRecord2Flash(UINT8* HexRecord, UINT totalHexRecLen)
 					break;
 					
 				case END_OF_FILE_RECORD:  //Record Type 01, defines the end of file record.
+					// No more data will follow, program the cached page.
+					PageCacheFlush();
+					HexRecordSt.ExtSegAddress.Val = 0;
+					HexRecordSt.ExtLinAddress.Val = 0;
+					break;
+
 				default: 
 					HexRecordSt.ExtSegAddress.Val = 0;
 					HexRecordSt.ExtLinAddress.Val = 0;
@@ -535,88 +1151,735 @@ void WriteHexRecord2Flash(UINT8* HexRecord, UINT totalHexRecLen)
 }	
 
 
-/**
- * Static table used for the table_driven implementation.
- *****************************************************************************/
-static const UINT16 crc_table[16] = 
-{
-    0x0000, 0x1021, 0x2042, 0x3063, 0x4084, 0x50a5, 0x60c6, 0x70e7,
-    0x8108, 0x9129, 0xa14a, 0xb16b, 0xc18c, 0xd1ad, 0xe1ce, 0xf1ef
-};
-
 /********************************************************************
-* Function: 	CalculateCrc()
+* Function: 	WriteBlock2Flash()
 *
 * Precondition: 
 *
-* Input: 		Data pointer and data length
+* Input: 		PROGRAM_BLOCK/PROGRAM_PACKED data field: 24-bit program
+*				address (LSB first), followed by instruction words (LSB
+*				first) of WordSize bytes each: 4 with the phantom byte,
+*				3 packed.
 *
-* Output:		CRC.
+* Output:		0 if the block was queued for programming, 1 if it is
+*				malformed.
 *
 * Side Effects:	None.
 *
-* Overview:     Calculates CRC for the given data and len
+* Overview:     Writes a contiguous run of instructions to flash. The
+*				frame CRC covers the data, there is no per-record
+*				overhead as with hex records.
 *
 *			
 * Note:		 	None.
-********************************************************************/	
-UINT16 CalculateCrc(UINT8 *data, UINT32 len)
+********************************************************************/
+UINT8 WriteBlock2Flash(UINT8 *Block, UINT BlockLen, UINT WordSize)
 {
-    UINT i;
-    UINT16 crc = 0;
-    
-    while(len--)
-    {
-        i = (crc >> 12) ^ (*data >> 4);
-	    crc = crc_table[i & 0x0F] ^ (crc << 4);
-	    i = (crc >> 12) ^ (*data >> 0);
-	    crc = crc_table[i & 0x0F] ^ (crc << 4);
-	    data++;
-	} 
+	DWORD_VAL ProgAddress;
+	UINT32 WrData;
 
-    return (crc & 0xFFFF);
+	if((BlockLen < 3) || ((BlockLen - 3) % WordSize) || (Block[0] & 0x01))
+	{
+		// Odd address or a partial instruction word.
+		return 1;
+	}
+
+	ProgAddress.Val = 0;
+	ProgAddress.byte.LB = Block[0];
+	ProgAddress.byte.HB = Block[1];
+	ProgAddress.byte.UB = Block[2];
+	Block += 3;
+	BlockLen -= 3;
+
+	while(BlockLen)
+	{
+		// Phantom byte is 0 when not sent.
+		WrData = 0;
+		memcpy(&WrData, Block, WordSize);
+		ProgramInstruction(ProgAddress.Val, WrData);
+
+		ProgAddress.Val += 2;
+		Block += WordSize;
+		BlockLen -= WordSize;
+	}
+
+	return 0;
 }
 
 
 /********************************************************************
-* Function: 	CalculateCrcProgMem()
+* Function: 	WriteCompressed2Flash()
 *
 * Precondition: 
 *
-* Input: 		Program pointer and data length
+* Input: 		PROGRAM_COMPRESSED data field: 24-bit program address
+*				(LSB first), followed by the compressed stream.
 *
-* Output:		CRC.
+* Output:		0 if the stream was decoded completely, 1 if it is
+*				malformed. Instructions decoded before the error are
+*				programmed anyway, the host sends the frame again.
 *
 * Side Effects:	None.
 *
-* Overview:     Calculates CRC for the given data and len for program memory
+* Overview:     Decompresses the stream (see LZ_WINDOW_SIZE) and hands
+*				each instruction to the programming path as soon as its
+*				3 bytes are complete. Apart from LzWindow nothing is
+*				buffered.
 *
 *			
 * Note:		 	None.
-********************************************************************/	
-UINT16 CalculateCrcProgMem(UINT32 adress, UINT32 len)
+********************************************************************/
+UINT8 WriteCompressed2Flash(UINT8 *Data, UINT DataLen)
 {
-    UINT i;
-    UINT16 crc = 0;
+	DWORD_VAL ProgAddress;
+	DWORD_VAL WrData;
+	UINT16 pos = 0;		// Bytes produced. At most ~44K from a full frame.
+	UINT16 dist;
+	UINT run;
+	UINT8 token;
+	UINT8 b;
+	UINT fill = 0;
+
+	if((DataLen < 3) || (Data[0] & 0x01))
+	{
+		// Odd address.
+		return 1;
+	}
+
+	ProgAddress.Val = 0;
+	ProgAddress.byte.LB = Data[0];
+	ProgAddress.byte.HB = Data[1];
+	ProgAddress.byte.UB = Data[2];
+	Data += 3;
+	DataLen -= 3;
+	WrData.Val = 0;
+
+	while(DataLen)
+	{
+		token = *Data++;
+		DataLen--;
+
+		if(token & 0x80)
+		{
+			// Match, copy from the window.
+			if(DataLen < 2)
+			{
+				return 1;
+			}
+			dist = Data[0] | ((UINT16)Data[1] << 8);
+			Data += 2;
+			DataLen -= 2;
+			run = (token & 0x7F) + LZ_MIN_MATCH;
+			if((dist == 0) || (dist > pos) || (dist > LZ_WINDOW_SIZE))
+			{
+				// Reaches before the start of the frame or out of the window.
+				return 1;
+			}
+		}
+		else
+		{
+			// Literal run.
+			run = token + 1;
+			if(DataLen < run)
+			{
+				return 1;
+			}
+			dist = 0;
+		}
+
+		while(run--)
+		{
+			if(dist)
+			{
+				b = LzWindow[(pos - dist) & (LZ_WINDOW_SIZE - 1)];
+			}
+			else
+			{
+				b = *Data++;
+				DataLen--;
+			}
+			LzWindow[pos & (LZ_WINDOW_SIZE - 1)] = b;
+			pos++;
+
+			WrData.v[fill++] = b;
+			if(fill == 3)
+			{
+				// Instruction complete, phantom byte stays 0.
+				ProgramInstruction(ProgAddress.Val, WrData.Val);
+				ProgAddress.Val += 2;
+				fill = 0;
+			}
+		}
+	}
+
+	// A partial instruction at the end is an error.
+	return (fill == 0) ? 0 : 1;
+}
+
+
+/********************************************************************
+* Function: 	PatchRead()
+*
+* Precondition: 
+*
+* Input: 		Program memory address.
+*
+* Output:		Instruction of the installed image.
+*
+* Side Effects:	None.
+*
+* Overview:     Table read for PatchApply(). Pages not rebuilt yet still
+*				hold the installed image.
+*
+*			
+* Note:		 	None.
+********************************************************************/
+UINT32 PatchRead(UINT32 progAddress)
+{
+	DWORD_VAL progAdrs;
+	DWORD_VAL flash;
+
+	progAdrs.Val = progAddress;
+	TBLPAG = progAdrs.byte.UB;
+	flash.word.HW = tblReadHigh(progAdrs.word.LW) & 0x00FF;
+	flash.word.LW = tblReadLow(progAdrs.word.LW);
+
+	return flash.Val;
+}
+
+
+/********************************************************************
+* Function: 	PatchPageDone()
+*
+* Precondition: 
+*
+* Input: 		Program memory address and instructions of a page.
+*
+* Output:		None.
+*
+* Side Effects:	None.
+*
+* Overview:     Programs a page rebuilt by PatchApply(). It passes the
+*				page cache as a whole, so with SKIP_IDENTICAL_PAGES an
+*				unchanged page is neither erased nor written.
+*
+*			
+* Note:		 	None.
+********************************************************************/
+void PatchPageDone(UINT32 progAddress, UINT32 *page)
+{
+	UINT i;
+
+	for(i = 0; i < FLASH_PAGE_INSTRUCTIONS; i++)
+	{
+		ProgramInstruction(progAddress, page[i]);
+		progAddress += 2;
+	}
+}
+
+
+/********************************************************************
+* Function: 	ProgramInstruction()
+*
+* Precondition: 
+*
+* Input: 		Program memory address and instruction word.
+*
+* Output:		None.
+*
+* Side Effects:	None.
+*
+* Overview:     Queues one instruction of a PROGRAM_BLOCK/PACKED/
+*				COMPRESSED frame for programming, unless it belongs to
+*				the boot area or configuration bits.
+*
+*			
+* Note:		 	None.
+********************************************************************/
+void ProgramInstruction(UINT32 ProgAddress, UINT32 WrData)
+{
+	slower++;
+	if (slower > 50)
+	{
+		blinkLEDs();
+		slower = 0;
+	}
+
+	if(PROGRAMMABLE_ADDRESS(ProgAddress))
+	{
+		// Queue the data for programming.
+		PageCacheStore(ProgAddress, WrData);
+	}
+}
+
+
+/********************************************************************
+* Function: 	PageCacheStore()
+*
+* Precondition: 
+*
+* Input: 		Program memory address and instruction word.
+*
+* Output:		None.
+*
+* Side Effects:	Programs the cached page when the address is in another page.
+*
+* Overview:     Stores one instruction word in the page write cache. A row
+*				that gets complete in an already erased page is programmed
+*				right away.
+*
+*			
+* Note:		 	None.
+********************************************************************/
+void PageCacheStore(UINT32 progAddress, UINT32 data)
+{
+	UINT32 pageAddress;
+	UINT index;
+	UINT row;
+	UINT16 mask;
+
+	pageAddress = progAddress & ~((UINT32)FLASH_PAGE_SIZE - 1);
+
+	if(pageAddress != PageAddress)
+	{
+		// Address discontinuity, program the current page first.
+		PageCacheFlush();
+		PageAddress = pageAddress;
+		memset(PageCache, 0xFF, sizeof(PageCache));
+		memset(PageValid, 0, sizeof(PageValid));
+		memset(RowFill, 0, sizeof(RowFill));
+		PageCacheStats.Misses++;
+#ifndef SKIP_IDENTICAL_PAGES
+		// Erase the page on first use in this session.
+		ErasePageOnce(pageAddress);
+#endif
+	}
+	else
+	{
+		PageCacheStats.Hits++;
+	}
+
+	index = (UINT)((progAddress - pageAddress) >> 1);
+	mask = (1u << (index & 0x0F));
+	PageCache[index] = data;
+	if((PageValid[index >> 4] & mask) == 0)
+	{
+		PageValid[index >> 4] |= mask;
+		row = index / NVMEM_ROW_INSTRUCTIONS;
+		RowFill[row]++;
+
+		if((RowFill[row] == NVMEM_ROW_INSTRUCTIONS) && PageIsErased(pageAddress))
+		{
+			// Row complete, program it in one go.
+			PageCacheWriteRow(row);
+		}
+	}
+}
+
+
+/********************************************************************
+* Function: 	PageCacheFlush()
+*
+* Precondition: 
+*
+* Input: 		None.
+*
+* Output:		None.
+*
+* Side Effects:	Page write cache is emptied.
+*
+* Overview:     Programs the rows still held in the page write cache.
+*				With SKIP_IDENTICAL_PAGES a page that was not erased yet
+*				is first compared against flash, and left alone (no erase,
+*				no write) when flash already holds the same data.
+*
+*			
+* Note:		 	None.
+********************************************************************/
+void PageCacheFlush(void)
+{
+	UINT row;
+
+	if(PageAddress == PAGE_CACHE_EMPTY)
+	{
+		// Nothing to program.
+		return;
+	}
+
+#ifdef SKIP_IDENTICAL_PAGES
+	if(!PageIsErased(PageAddress))
+	{
+		if(PageCacheMatchesFlash())
+		{
+			// Treat the page as done for the rest of the session.
+			MarkPageErased(PageAddress);
+			PageCacheStats.PagesSkipped++;
+			PageAddress = PAGE_CACHE_EMPTY;
+			return;
+		}
+		ErasePageOnce(PageAddress);
+	}
+#endif
+
+	for(row = 0; row < FLASH_PAGE_ROWS; row++)
+	{
+		if(RowFill[row])
+		{
+			PageCacheWriteRow(row);
+		}
+	}
+	PageCacheStats.PagesWritten++;
+
+	PageAddress = PAGE_CACHE_EMPTY;
+}
+
+
+/********************************************************************
+* Function: 	PageCacheWriteRow()
+*
+* Precondition: 
+*
+* Input: 		Row number within the cached page.
+*
+* Output:		None.
+*
+* Side Effects:	Row is removed from the page write cache.
+*
+* Overview:     Programs one row of the cached page. A complete row is
+*				written with NVMemWriteRow(), a partial row with one
+*				double-word write for every instruction pair that holds data.
+*				Blank (0xFFFFFF) instruction pairs are skipped, the page
+*				is known to be erased.
+*
+*			
+* Note:		 	None.
+********************************************************************/
+void PageCacheWriteRow(UINT row)
+{
+	UINT i;
+	UINT first;
+	UINT blank = 0;
+	UINT valid;
+	UINT Result = 0;
+	UINT32 rowAddress;
+
+	first = row * NVMEM_ROW_INSTRUCTIONS;
+	rowAddress = PageAddress + (UINT32)row * NVMEM_ROW_SIZE;
+
+	// The page is erased, double-words that are blank (instructions not sent
+	// are blank too) need no programming.
+	for(i = first; i < (first + NVMEM_ROW_INSTRUCTIONS); i += 2)
+	{
+		if((PageCache[i] & PageCache[i + 1] & 0x00FFFFFF) == 0x00FFFFFF)
+		{
+			blank++;
+		}
+	}
+
+	if(blank == NVMEM_ROW_INSTRUCTIONS/2)
+	{
+		PageCacheStats.BlankWordsSkipped += RowFill[row];
+		PageCacheStats.BlankRowsSkipped++;
+	}
+	else if((RowFill[row] == NVMEM_ROW_INSTRUCTIONS) && (blank == 0))
+	{
+		Result = NVMemWriteRow(rowAddress, &PageCache[first]);
+		PageCacheStats.CompleteRows++;
+	}
+	else
+	{
+		for(i = first; i < (first + NVMEM_ROW_INSTRUCTIONS); i += 2)
+		{
+			// Bit pair of instruction i and i+1.
+			valid = (PageValid[i >> 4] >> (i & 0x0F)) & 3u;
+			if(valid == 0)
+			{
+				continue;
+			}
+			if((PageCache[i] & PageCache[i + 1] & 0x00FFFFFF) == 0x00FFFFFF)
+			{
+				PageCacheStats.BlankWordsSkipped += (valid == 3u) ? 2 : 1;
+			}
+			else
+			{
+				Result |= NVMemWriteDoubleWord(PageAddress + ((UINT32)i << 1), PageCache[i], PageCache[i + 1]);
+			}
+		}
+		PageCacheStats.PartialRows++;
+	}
+	// Assert on error. This must be caught during debug phase.
+	ASSERT(Result==0);
+
+	// Row is programmed, forget it.
+	memset(&PageCache[first], 0xFF, NVMEM_ROW_INSTRUCTIONS * sizeof(PageCache[0]));
+	memset(&PageValid[first >> 4], 0, (NVMEM_ROW_INSTRUCTIONS/16) * sizeof(PageValid[0]));
+	RowFill[row] = 0;
+}
+
+
+/********************************************************************
+* Function: 	PageCacheMatchesFlash()
+*
+* Precondition: 
+*
+* Input: 		None.
+*
+* Output:		TRUE if the flash page already holds the cached data.
+*
+* Side Effects:	None.
+*
+* Overview:     Compares the cached page against flash. Instructions not
+*				received are expected to be erased (0xFFFFFF), exactly what
+*				an erase followed by programming would leave behind.
+*
+*			
+* Note:		 	None.
+********************************************************************/
+BOOL PageCacheMatchesFlash(void)
+{
+	UINT i;
+	DWORD_VAL progAdrs;
+	DWORD_VAL flash;
+
+	progAdrs.Val = PageAddress;
+	// A page never crosses a table page boundary.
+	TBLPAG = progAdrs.byte.UB;
+
+	for(i = 0; i < FLASH_PAGE_INSTRUCTIONS; i++)
+	{
+		flash.word.HW = tblReadHigh(progAdrs.word.LW) & 0x00FF;
+		flash.word.LW = tblReadLow(progAdrs.word.LW);
+		if(flash.Val != (PageCache[i] & 0x00FFFFFF))
+		{
+			return FALSE;
+		}
+		progAdrs.word.LW += 2;
+	}
+
+	return TRUE;
+}
+
+
+/********************************************************************
+* Function: 	PageIsErased()
+*
+* Precondition: 
+*
+* Input: 		Program memory address.
+*
+* Output:		TRUE if the page may be programmed without erasing it first.
+*
+* Side Effects:	None.
+*
+* Overview:     Checks the session page bitmap. Addresses outside of main
+*				flash can't be erased and are always reported as erased.
+*
+*			
+* Note:		 	None.
+********************************************************************/
+BOOL PageIsErased(UINT32 address)
+{
+	UINT page;
+
+	if(address >= MAIN_FLASH_END_ADRS)
+	{
+		return TRUE;
+	}
+
+	page = (UINT)(address / FLASH_PAGE_SIZE);
+	return (PageErased[page >> 3] & (1 << (page & 0x07))) ? TRUE : FALSE;
+}
+
+
+/********************************************************************
+* Function: 	EraseFlashRange()
+*
+* Precondition: 
+*
+* Input: 		Program memory address and length. Length is given in
+*				bytes of hex data (4 per instruction), same as READ_CRC,
+*				at most MAX_RANGE_LEN.
+*
+* Output:		Number of pages erased.
+*
+* Side Effects:	None.
+*
+* Overview:     Erases every main flash page covered by the given range.
+*				Pages outside of main flash (aux flash, configuration)
+*				are never erased.
+*
+*			
+* Note:		 	None.
+********************************************************************/
+UINT EraseFlashRange(UINT32 address, UINT32 len)
+{
+	UINT32 endAddress;
+	UINT erased = 0;
+	UINT Result;
+
+	if((len == 0) || (address >= MAIN_FLASH_END_ADRS))
+	{
+		return 0;
+	}
+	if(len > MAX_RANGE_LEN)
+	{
+		len = MAX_RANGE_LEN;
+	}
+
+	// Last program memory address of the range, no wrap with both bounded.
+	endAddress = address + ((len + 3) / 4) * 2 - 1;
+	if(endAddress >= MAIN_FLASH_END_ADRS)
+	{
+		endAddress = MAIN_FLASH_END_ADRS - 1;
+	}
+
+	// Start at the beginning of the first page.
+	address &= ~((UINT32)FLASH_PAGE_SIZE - 1);
+
+	while(address <= endAddress)
+	{
+		Result = NVMemErasePage(address);
+		// Assert on NV error. This must be caught during debug phase.
+		ASSERT(Result==0);
+		MarkPageErased(address);
+		erased++;
+		address += FLASH_PAGE_SIZE;
+	}
+
+	return erased;
+}
+
+
+/********************************************************************
+* Function: 	ErasePageOnce()
+*
+* Precondition: 
+*
+* Input: 		Program memory address.
+*
+* Output:		None.
+*
+* Side Effects:	None.
+*
+* Overview:     Erases the main flash page holding the address, unless it
+*				was already erased in this session (READ_BOOT_INFO starts a
+*				new session). This way only pages that actually get
+*				written are erased, right before the first write.
+*
+*			
+* Note:		 	None.
+********************************************************************/
+void ErasePageOnce(UINT32 address)
+{
+	UINT Result;
+
+	if(!PageIsErased(address))
+	{
+		Result = NVMemErasePage(address & ~((UINT32)FLASH_PAGE_SIZE - 1));
+		// Assert on NV error. This must be caught during debug phase.
+		ASSERT(Result==0);
+		MarkPageErased(address);
+	}
+}
+
+
+/********************************************************************
+* Function: 	MarkPageErased()
+*
+* Precondition: 
+*
+* Input: 		Program memory address.
+*
+* Output:		None.
+*
+* Side Effects:	None.
+*
+* Overview:     Records in the session page bitmap that the page holding
+*				the address may be programmed without erasing it.
+*
+*			
+* Note:		 	None.
+********************************************************************/
+void MarkPageErased(UINT32 address)
+{
+	UINT page;
+
+	if(address < MAIN_FLASH_END_ADRS)
+	{
+		page = (UINT)(address / FLASH_PAGE_SIZE);
+		PageErased[page >> 3] |= (1 << (page & 0x07));
+	}
+}
+
+
+
+/********************************************************************
+* Function: 	CalculateCrc()
+*
+* Precondition: 
+*
+* Input: 		Data pointer and data length
+*
+* Output:		CRC.
+*
+* Side Effects:	None.
+*
+* Overview:     Calculates CRC for the given data and len
+*
+*			
+* Note:		 	None.
+********************************************************************/	
+UINT16 CalculateCrc(UINT8 *data, UINT32 len)
+{
+    UINT i;
+    UINT16 crc = 0;
+
+    while(len--)
+    {
+        CRC_UPDATE(crc, *data, i);
+	    data++;
+	} 
+
+    return (crc & 0xFFFF);
+}
+
+
+/********************************************************************
+* Function: 	CalculateCrcProgMem()
+*
+* Precondition: 
+*
+* Input: 		Program pointer and data length
+*
+* Output:		CRC.
+*
+* Side Effects:	None.
+*
+* Overview:     Calculates CRC for the given data and len for program memory
+*
+*			
+* Note:		 	None.
+********************************************************************/	
+UINT16 CalculateCrcProgMem(UINT32 adress, UINT32 len)
+{
+    UINT i;
+    UINT16 crc = 0;
     DWORD_VAL byte;
     UINT inLoop;
     DWORD_VAL progAdrs;
     
     progAdrs.Val = adress;
-       
+
     while(len)
     {
 	    TBLPAG = progAdrs.byte.UB;
-	    byte.word.HW = __builtin_tblrdh(progAdrs.word.LW);
-		byte.word.LW = __builtin_tblrdl(progAdrs.word.LW);
+	    byte.word.HW = tblReadHigh(progAdrs.word.LW);
+		byte.word.LW = tblReadLow(progAdrs.word.LW);
 		
 		inLoop = 0;
 		while(inLoop < 4)
 		{
-			i = (crc >> 12) ^ (byte.v[inLoop] >> 4);
-		    crc = crc_table[i & 0x0F] ^ (crc << 4);
-		    i = (crc >> 12) ^ (byte.v[inLoop] >> 0);
-		    crc = crc_table[i & 0x0F] ^ (crc << 4);
+			CRC_UPDATE(crc, byte.v[inLoop], i);
 		    inLoop++;
 		    len--;
 		    if(len == 0)
@@ -631,7 +1894,6 @@ UINT16 CalculateCrcProgMem(UINT32 adress, UINT32 len)
 }
 
 
-
 /********************************************************************
 * Function: 	ExitFirmwareUpgradeMode()
 *
@@ -658,5 +1920,109 @@ BOOL pcCommunicating(void)
    return pc_comm;
 }
 
+
+/********************************************************************
+* Function: 	BaudRateChangeRequested()
+*
+* Precondition: 
+*
+* Input: 		Pointer to the new baud rate generator value.
+*
+* Output:		True once, after an accepted CHANGE_BAUD response has
+*				been handed to the transport layer.
+*
+* Side Effects:	None.
+*
+* Overview:     The transport layer switches the UART to *Brg after the
+*				response has been sent, the host switches after it has
+*				received the response.
+*
+*			
+* Note:		 	None.
+********************************************************************/
+BOOL BaudRateChangeRequested(UINT16 *Brg)
+{
+	if(BaudChangePending && (TxBuff.Len == 0))
+	{
+		BaudChangePending = FALSE;
+		*Brg = NewBrg;
+		return TRUE;
+	}
+	return FALSE;
+}
+
+
+/********************************************************************
+* Function: 	CalculateBrg()
+*
+* Precondition: 
+*
+* Input: 		Requested baud rate.
+*
+* Output:		True if the UART gets within BAUD_MAX_ERROR of it.
+*				*Brg, *Actual and *Error (in 1/1000) are set in
+*				any case, all 0 if the rate is out of range.
+*
+* Side Effects:	None.
+*
+* Overview:     BRGH = 1: baud = Fcy/(4*(BRG+1)), Fcy from the PLL
+*				settings in system.h. The divider is rounded.
+*
+*			
+* Note:		 	None.
+********************************************************************/
+BOOL CalculateBrg(UINT32 baud, UINT16 *Brg, UINT32 *Actual, INT16 *Error)
+{
+	UINT32 div = 0;
+	INT32 err;
+
+	if((baud != 0) && (baud <= SYS_FCY/4))
+	{
+		// Rounded divider, BRG + 1. 4*baud can't overflow.
+		div = (SYS_FCY + 2*baud) / (4*baud);
+	}
+	if((div == 0) || (div > 0x10000))
+	{
+		// Out of the generator range.
+		*Brg = 0;
+		*Actual = 0;
+		*Error = 0;
+		return FALSE;
+	}
+
+	*Brg = (UINT16)(div - 1);
+	*Actual = SYS_FCY / (4*div);
+	// Error in 1/1000, scaled so that the multiplication can't overflow
+	// (|err| < Fcy/4). It is within +-500 after rounding the divider.
+	err = (INT32)*Actual - (INT32)baud;
+	err = (err * 100) / (INT32)(baud / 10);
+	*Error = (INT16)err;
+
+	return (err <= BAUD_MAX_ERROR) && (err >= -BAUD_MAX_ERROR);
+}
+
+
+/********************************************************************
+* Function: 	ValidFramesReceived()
+*
+* Precondition: 
+*
+* Input: 		Void
+*
+* Output:		Number of frames received with a valid CRC, wraps around.
+*
+* Side Effects:	None.
+*
+* Overview:     Lets the transport layer tell whether the link works
+*				after a baud rate change.
+*
+*			
+* Note:		 	None.
+********************************************************************/
+UINT16 ValidFramesReceived(void)
+{
+	return RxFrames;
+}
+
 /**************************End of file**************************************************/
 
@@ -30,11 +30,48 @@
 
 #define FRAMEWORK_BUFF_SIZE					1000
 
+// Number of sequenced frames the host may send ahead of the acknowledges.
+// They wait in the UART receive ring, which must be large enough to hold them.
+#define FRAMEWORK_RX_WINDOW					4
+
+// Number of receive frame buffers. uartTask() parses what the receive ring
+// holds into a free buffer while the frame before it still waits for
+// FrameWorkTask(). Parsing and processing both run from the main loop, one
+// after the other; bytes arriving during a command wait in the ring.
+#define FRAMEWORK_RX_SLOTS					2
+
+// Compare each page against flash before erasing it, unchanged pages are
+// neither erased nor programmed. Comment out to always erase and program.
+#define SKIP_IDENTICAL_PAGES
+
+// Table driven CRC: a 256 entry table (512 bytes of program memory) that
+// handles a byte per step, instead of the 16 entry table, a nibble per step.
+// Build with CRC_NIBBLE_TABLE defined for the small table.
+#ifndef CRC_NIBBLE_TABLE
+#define CRC_BYTE_TABLE
+#endif
+
+typedef struct
+{
+	UINT32 Hits;				// Instructions stored into the already open page.
+	UINT32 Misses;				// Pages opened in the cache.
+	UINT32 CompleteRows;		// Rows flushed with every instruction sent, by NVMemWriteRow().
+	UINT32 PartialRows;			// Rows flushed pair by pair, blank pairs skipped.
+	UINT32 PagesWritten;		// Pages programmed in this session.
+	UINT32 PagesSkipped;		// Pages that already held the new data.
+	UINT32 BlankWordsSkipped;	// Instructions not programmed, 0xFFFFFF on an erased page.
+	UINT32 BlankRowsSkipped;	// Rows holding only such instructions.
+}T_PAGE_CACHE_STATS;
+
+extern T_PAGE_CACHE_STATS PageCacheStats;
+
 int FrameWorkTask(void);
-void BuildRxFrame(UINT8 *RxData, INT16 RxLen);
+UINT BuildRxFrame(UINT8 *RxData, INT16 RxLen);
 UINT GetTransmitFrame(UINT8* Buff);
 BOOL ExitFirmwareUpgradeMode(void);
 BOOL pcCommunicating(void);
+BOOL BaudRateChangeRequested(UINT16 *Brg);
+UINT16 ValidFramesReceived(void);
 
 
 #endif
@@ -60,11 +60,20 @@ typedef enum _BOOL { FALSE = 0, TRUE } BOOL;	// Undefined size
 
 typedef unsigned char		BYTE;				// 8-bit unsigned
 typedef unsigned short int	WORD;				// 16-bit unsigned
+#if defined(__LP64__)
+// 64-bit PC build (simulator, host tools), long is 64 bits there.
+typedef unsigned int		DWORD;				// 32-bit unsigned
+#else
 typedef unsigned long		DWORD;				// 32-bit unsigned
+#endif
 typedef unsigned long long	QWORD;				// 64-bit unsigned
 typedef signed char			CHAR;				// 8-bit signed
 typedef signed short int	SHORT;				// 16-bit signed
+#if defined(__LP64__)
+typedef signed int			LONG;				// 32-bit signed
+#else
 typedef signed long			LONG;				// 32-bit signed
+#endif
 typedef signed long long	LONGLONG;			// 64-bit signed
 
 /* Alternate definitions */
@@ -80,13 +89,21 @@ typedef unsigned char       UCHAR8;
 typedef signed int          INT;
 typedef signed char         INT8;
 typedef signed short int    INT16;
+#if defined(__LP64__)
+typedef signed int          INT32;
+#else
 typedef signed long int     INT32;
+#endif
 typedef signed long long    INT64;
 
 typedef unsigned int        UINT;
 typedef unsigned char       UINT8;
 typedef unsigned short int  UINT16;
+#if defined(__LP64__)
+typedef unsigned int        UINT32;  // other name for 32-bit integer
+#else
 typedef unsigned long int   UINT32;  // other name for 32-bit integer
+#endif
 typedef unsigned long long  UINT64;
 
 typedef union _BYTE_VAL
@@ -40,6 +40,8 @@
 #include "system.h"
 #include "NVMem.h"
 
+T_NVMEM_STATS NVMemStats;
+
 /*********************************************************************
  * Function:        unsigned int NVMErasePage(void* address)
  *
@@ -57,10 +59,11 @@ UINT NVMemBlockErase(void)
 	
 	NVMCON = 0x400D;				//Bulk erase on next WR
 	INTCON2bits.GIE = 0;							//Disable interrupts for next few instructions for unlock sequence
-	__builtin_write_NVM();
+	writeNVM();
+	INTCON2bits.GIE = 1;							// Re-enable the interrupts, UART reception goes on while flash is busy.
     while(NVMCONbits.WR == 1){}
-	INTCON2bits.GIE = 1;							// Re-enable the interrupts (if required).
 
+	NVMemStats.BulkErases++;
    
 	// Return WRERR state.
 	return NVMCONbits.WRERR;	
@@ -93,14 +96,15 @@ UINT NVMemErasePage(UINT32 address)
 	TBLPAG = eraseAddress.byte.UB;
 	NVMADRU = eraseAddress.word.HW;
     NVMADR = eraseAddress.word.LW;
-	__builtin_tblwtl(eraseAddress.word.LW, 0xFFFF);
+	tblWriteLow(eraseAddress.word.LW, 0xFFFF);
 	NVMCON = 0x4003;				//Erase page on next WR
 
 	INTCON2bits.GIE = 0;							//Disable interrupts for next few instructions for unlock sequence
-	__builtin_write_NVM();
+	writeNVM();
+	INTCON2bits.GIE = 1;							// Re-enable the interrupts, UART reception goes on while flash is busy.
     while(NVMCONbits.WR == 1){}
-	INTCON2bits.GIE = 1;							// Re-enable the interrupts (if required).
    
+	NVMemStats.PageErases++;
 
 	// Return WRERR state.
 	return NVMCONbits.WRERR;
@@ -109,60 +113,116 @@ UINT NVMemErasePage(UINT32 address)
 
 
 /*********************************************************************
- * Function:        unsigned int NVMWriteWord(UINT32 address, UINT32 data)
+ * Function:        unsigned int NVMemWriteDoubleWord(UINT32 address, UINT32 data0, UINT32 data1)
  *
- * Description:     The word at the location pointed to by NVMADDR is programmed.
+ * Description:     The two instruction words at the double-word aligned location
+ *                  pointed to by NVMADDR are programmed in one operation.
  *
  * PreCondition:    None
  *
- * Inputs:          address:   Destination address to write.
- *                  data:      Word to write.
+ * Inputs:          address:   Double-word aligned destination address.
+ *                  data0:     Instruction word to write at address.
+ *                  data1:     Instruction word to write at address + 2.
  *
  * Output:          '0' if operation completed successfully.
  *
- * Example:         NVMWriteWord(0xBD000000, 0x12345678)
+ * Example:         NVMemWriteDoubleWord(0x001000, 0x00040000, 0x00000000)
  ********************************************************************/
-UINT NVMemWriteWord(UINT32 address, UINT32 data)
+UINT NVMemWriteDoubleWord(UINT32 address, UINT32 data0, UINT32 data1)
 {
    	DWORD_VAL writeAddress;
-   	DWORD_VAL writeData;
+   	DWORD_VAL writeData0;
+   	DWORD_VAL writeData1;
    	
    	writeAddress.Val = address;
-   	writeData.Val = data;
+   	writeData0.Val = data0;
+   	writeData1.Val = data1;
 
-    NVMCON = 0x4001;		//Perform WORD write next time WR gets set = 1.
+    NVMCON = 0x4001;		//Perform double-word write next time WR gets set = 1.
     NVMADRU = writeAddress.word.HW;
     NVMADR = writeAddress.word.LW;
 
 	// Set the table address of "Latch". The data is programmed into the FLASH from a temporary latch. 
 	TBLPAG = 0xFA;
+	tblWriteLow(0, writeData0.word.LW);		//Write the low word of 1-st instruction into the latch
+	tblWriteHigh(1, writeData0.word.HW);		//Write the high word of 1-st instruction into the latch 
+	tblWriteLow(2, writeData1.word.LW);		//Write the low word of 2-nd instruction into the latch
+	tblWriteHigh(3, writeData1.word.HW);		//Write the high word of 2-nd instruction into the latch 
+
+	INTCON2bits.GIE = 0;							//Disable interrupts for next few instructions for unlock sequence
+	writeNVM();
+	INTCON2bits.GIE = 1;							// Re-enable the interrupts, UART reception goes on while flash is busy.
+    while(NVMCONbits.WR == 1){}
+
+	NVMemStats.DoubleWordWrites++;
+
+	// Return WRERR state.
+	return NVMCONbits.WRERR;
+}
+
+
+/*********************************************************************
+ * Function:        unsigned int NVMWriteWord(UINT32 address, UINT32 data)
+ *
+ * Description:     The word at the location pointed to by NVMADDR is programmed.
+ *
+ * PreCondition:    None
+ *
+ * Inputs:          address:   Destination address to write.
+ *                  data:      Word to write.
+ *
+ * Output:          '0' if operation completed successfully.
+ *
+ * Example:         NVMWriteWord(0xBD000000, 0x12345678)
+ ********************************************************************/
+UINT NVMemWriteWord(UINT32 address, UINT32 data)
+{
     //The smallest block of data that can be programmed in
     //a single operation is 2 instruction words (6 Bytes + 2 Phantom Bytes).
-    // Mask the high or low instruction words depending on the address and write either high or low instruction word.
+    // Mask the other instruction word of the pair with 0xFFFFFF so it is left unchanged.
 	if(address % 4)
 	{
-		__builtin_tblwtl(0, 0xFFFF);				//Mask the low word of 1-st instruction into the latch.
-		__builtin_tblwth(1, 0x00FF);				//Mask the high word of 1-st instruction into the latch. (8 bits of data + 8 bits of "phantom data" (phantom byte is always 0))
-															
-		__builtin_tblwtl(2, writeData.word.LW);		//Write the low word of 2-nd instruction into the latch
-		__builtin_tblwth(3, writeData.word.HW);		//Write the high word of 2-nd instruction into the latch 		
-		
+		return NVMemWriteDoubleWord(address - 2, 0xFFFFFFFF, data);
 	}
 	else
 	{
-		__builtin_tblwtl(0, writeData.word.LW);		//Write the low word of 1-st instruction into the latch
-		__builtin_tblwth(1, writeData.word.HW);		//Write the high word of 1-st instruction into the latch 
-		__builtin_tblwtl(2, 0xFFFF);				//Mask the low word of 2-nd instruction into the latch.
-		__builtin_tblwth(3, 0x00FF);				//Mask the high word of 2-nd instruction into the latch. (8 bits of data + 8 bits of "phantom data" (phantom byte is always 0))
-			
-	}		
+		return NVMemWriteDoubleWord(address, data, 0xFFFFFFFF);
+	}
+}
 
-	INTCON2bits.GIE = 0;							//Disable interrupts for next few instructions for unlock sequence
-	__builtin_write_NVM();
-    while(NVMCONbits.WR == 1){}
-	INTCON2bits.GIE = 1;							// Re-enable the interrupts (if required).
 
-	// Return WRERR state.
-	return NVMCONbits.WRERR;
+/*********************************************************************
+ * Function:        unsigned int NVMemWriteRow(UINT32 address, const UINT32 *data)
+ *
+ * Description:     Programs one row (NVMEM_ROW_INSTRUCTIONS instruction words)
+ *                  from a RAM row buffer. This device has only two write latches
+ *                  and no RAM sourced row program operation in user mode, so the
+ *                  row is written as back to back double-word operations, each
+ *                  carrying two instructions of the row: as many NVM operations
+ *                  as programming the row pair by pair.
+ *
+ * PreCondition:    None
+ *
+ * Inputs:          address:   Row aligned destination address.
+ *                  data:      NVMEM_ROW_INSTRUCTIONS instruction words.
+ *
+ * Output:          '0' if operation completed successfully.
+ *
+ * Example:         NVMemWriteRow(0x001000, RowBuff)
+ ********************************************************************/
+UINT NVMemWriteRow(UINT32 address, const UINT32 *data)
+{
+	UINT i;
+	UINT result = 0;
+
+	for(i = 0; i < NVMEM_ROW_INSTRUCTIONS; i += 2)
+	{
+		result |= NVMemWriteDoubleWord(address, data[i], data[i + 1]);
+		address += 4;
+	}
+
+	NVMemStats.RowBuffers++;
+
+	return result;
 }
 /***********************End of File*************************************************************/
@@ -24,10 +24,25 @@
 #ifndef __NVMEM_H__
 #define __NVMEM_H__
 
+// A row is 128 instructions, i.e. 256 program memory addresses.
+#define NVMEM_ROW_INSTRUCTIONS		128
+#define NVMEM_ROW_SIZE				(NVMEM_ROW_INSTRUCTIONS*2)
 
+typedef struct
+{
+	UINT32 DoubleWordWrites;	// Number of NVM double-word program operations.
+	UINT32 RowBuffers;			// Rows programmed by NVMemWriteRow(), NVMEM_ROW_INSTRUCTIONS/2
+								// double-word operations each, counted above as well.
+	UINT32 PageErases;
+	UINT32 BulkErases;
+}T_NVMEM_STATS;
+
+extern T_NVMEM_STATS NVMemStats;
 
 
 extern UINT NVMemWriteWord(UINT32 address, UINT32 data);
+extern UINT NVMemWriteDoubleWord(UINT32 address, UINT32 data0, UINT32 data1);
+extern UINT NVMemWriteRow(UINT32 address, const UINT32 *data);
 extern UINT NVMemErasePage(UINT32 address);
 extern UINT NVMemBlockErase(void);
 
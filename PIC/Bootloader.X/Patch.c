@@ -0,0 +1,304 @@
+/* Patch.c
+ * Description:
+ *
+ * Delta update applier and encoder, see Patch.h for the format.
+ */
+
+#include "GenericTypeDefs.h"
+#include "Patch.h"
+
+// 24-bit value, LSB first.
+#define GET24(p)    ((UINT32)(p)[0] | ((UINT32)(p)[1] << 8) | ((UINT32)(p)[2] << 16))
+
+/********************************************************************
+* Function:     PatchApply()
+*
+* Precondition: patch->Page, Read and PageDone set, Pos 0 at the start
+*               of a session.
+*
+* Input:        Patch state, patch frame data field.
+*
+* Output:       0 if the frame was applied, 1 if it is malformed or
+*               doesn't continue where the previous frame ended.
+*
+* Side Effects: PageDone is called for every page completed.
+*
+* Overview:     Rebuilds the new image in patch->Page. A frame starting
+*               on a page boundary starts over with that page, dropping
+*               an incomplete one.
+*
+* Note:         None.
+********************************************************************/
+UINT8 PatchApply(T_PATCH *patch, const UINT8 *data, UINT dataLen)
+{
+    UINT32 address;
+    UINT32 value = 0;
+    UINT8 op;
+    UINT n;
+
+    if(dataLen < 3)
+    {
+        return 1;
+    }
+
+    address = GET24(data);
+    data += 3;
+    dataLen -= 3;
+
+    if((patch->Pos == 0) || (address != patch->Address + 2*patch->Pos))
+    {
+        if(address & (2*PATCH_PAGE_INSTRUCTIONS - 1))
+        {
+            // Neither continues the page nor starts a new one.
+            return 1;
+        }
+        patch->Address = address;
+        patch->Pos = 0;
+    }
+
+    while(dataLen)
+    {
+        op = *data++;
+        dataLen--;
+        n = (op & (PATCH_MAX_RUN - 1)) + 1;
+
+        if(patch->Pos + n > PATCH_PAGE_INSTRUCTIONS)
+        {
+            // Ops never cross a page.
+            return 1;
+        }
+
+        if((op & 0xC0) == PATCH_LITERAL)
+        {
+            if(dataLen < 3*n)
+            {
+                return 1;
+            }
+        }
+        else if((op & 0xC0) != PATCH_COPY)
+        {
+            // Source address or fill value.
+            if(dataLen < 3)
+            {
+                return 1;
+            }
+            value = GET24(data);
+            data += 3;
+            dataLen -= 3;
+        }
+
+        while(n--)
+        {
+            switch(op & 0xC0)
+            {
+                case PATCH_COPY:
+                    patch->Page[patch->Pos] = patch->Read(patch->Address + 2*patch->Pos);
+                    break;
+
+                case PATCH_LITERAL:
+                    patch->Page[patch->Pos] = GET24(data);
+                    data += 3;
+                    dataLen -= 3;
+                    break;
+
+                case PATCH_MOVE:
+                    patch->Page[patch->Pos] = patch->Read(value);
+                    value += 2;
+                    break;
+
+                default:
+                    patch->Page[patch->Pos] = value;
+                    break;
+            }
+            patch->Pos++;
+        }
+
+        if(patch->Pos == PATCH_PAGE_INSTRUCTIONS)
+        {
+            // Page rebuilt, program it and go on with the next one.
+            patch->PageDone(patch->Address, patch->Page);
+            patch->Address += 2*PATCH_PAGE_INSTRUCTIONS;
+            patch->Pos = 0;
+        }
+    }
+
+    return 0;
+}
+
+
+#ifdef PATCH_ENCODER
+
+// Installed image instructions searched around the same address for PATCH_MOVE.
+#define PATCH_MOVE_REACH            1024
+
+// Number of equal instructions at a and b, at most max.
+static UINT PatchRun(const UINT32 *a, const UINT32 *b, UINT max)
+{
+    UINT n = 0;
+
+    while((n < max) && (((a[n] ^ b[n]) & 0x00FFFFFF) == 0))
+    {
+        n++;
+    }
+    return n;
+}
+
+/********************************************************************
+* Function:     PatchEncode()
+*
+* Precondition: address is page aligned for the first frame of a page,
+*               later frames continue at address + 2 * *used.
+*
+* Input:        Program address and count of the new instructions,
+*               the installed image from program address 0 on, output
+*               buffer and its size.
+*
+* Output:       Length of the frame data field written to out, header
+*               included. *used is the number of new instructions it
+*               covers.
+*
+* Side Effects: None.
+*
+* Overview:     Greedy: same address copies first, then fills and moves,
+*               literals for the rest. Move sources never lie below the
+*               page being built, see Patch.h.
+*
+* Note:         None.
+********************************************************************/
+UINT PatchEncode(UINT32 address, const UINT32 *newImage, UINT count,
+                 const UINT32 *oldImage, UINT32 oldCount,
+                 UINT8 *out, UINT outMax, UINT *used)
+{
+    UINT32 idx = address / 2;
+    UINT32 pageStart;
+    UINT32 s;
+    UINT32 from;
+    UINT32 to;
+    UINT32 source = 0;
+    UINT i = 0;
+    UINT len = 0;
+    UINT lit = 0;           // Index of the open literal op + 1, 0 if none.
+    UINT limit;
+    UINT copy;
+    UINT fill;
+    UINT move;
+    UINT n;
+
+    *used = 0;
+    if(outMax < 3 + 4)
+    {
+        return 0;
+    }
+
+    out[len++] = (UINT8)address;
+    out[len++] = (UINT8)(address >> 8);
+    out[len++] = (UINT8)(address >> 16);
+
+    while(i < count)
+    {
+        pageStart = idx - (idx % PATCH_PAGE_INSTRUCTIONS);
+        limit = PATCH_PAGE_INSTRUCTIONS - (UINT)(idx - pageStart);
+        if(limit > PATCH_MAX_RUN)
+        {
+            limit = PATCH_MAX_RUN;
+        }
+        if(limit > count - i)
+        {
+            limit = count - i;
+        }
+
+        copy = 0;
+        if(idx < oldCount)
+        {
+            copy = PatchRun(&oldImage[idx], &newImage[i], (oldCount - idx < limit) ? (UINT)(oldCount - idx) : limit);
+        }
+        fill = 1 + PatchRun(&newImage[i], &newImage[i + 1], limit - 1);
+
+        move = 0;
+        if(copy < 2)
+        {
+            from = (idx > pageStart + PATCH_MOVE_REACH) ? idx - PATCH_MOVE_REACH : pageStart;
+            to = (idx + PATCH_MOVE_REACH < oldCount) ? idx + PATCH_MOVE_REACH : oldCount;
+            for(s = from; s < to; s++)
+            {
+                n = PatchRun(&oldImage[s], &newImage[i], (oldCount - s < limit) ? (UINT)(oldCount - s) : limit);
+                if((n > move) && (s != idx))
+                {
+                    move = n;
+                    source = s;
+                }
+            }
+        }
+
+        if((copy >= 2) || ((copy == 1) && (fill < 2) && (move < 2)))
+        {
+            if(len + 1 > outMax)
+            {
+                break;
+            }
+            out[len++] = PATCH_COPY | (UINT8)(copy - 1);
+            n = copy;
+            lit = 0;
+        }
+        else if((fill >= 2) && (fill >= move))
+        {
+            if(len + 4 > outMax)
+            {
+                break;
+            }
+            out[len++] = PATCH_FILL | (UINT8)(fill - 1);
+            out[len++] = (UINT8)newImage[i];
+            out[len++] = (UINT8)(newImage[i] >> 8);
+            out[len++] = (UINT8)(newImage[i] >> 16);
+            n = fill;
+            lit = 0;
+        }
+        else if(move >= 2)
+        {
+            if(len + 4 > outMax)
+            {
+                break;
+            }
+            out[len++] = PATCH_MOVE | (UINT8)(move - 1);
+            out[len++] = (UINT8)(2*source);
+            out[len++] = (UINT8)((2*source) >> 8);
+            out[len++] = (UINT8)((2*source) >> 16);
+            n = move;
+            lit = 0;
+        }
+        else
+        {
+            // Append to the open literal op if it has room and stays in the page.
+            if(lit && ((out[lit - 1] & (PATCH_MAX_RUN - 1)) < PATCH_MAX_RUN - 1)
+               && ((idx % PATCH_PAGE_INSTRUCTIONS) != 0))
+            {
+                if(len + 3 > outMax)
+                {
+                    break;
+                }
+                out[lit - 1]++;
+            }
+            else
+            {
+                if(len + 4 > outMax)
+                {
+                    break;
+                }
+                out[len++] = PATCH_LITERAL;
+                lit = len;
+            }
+            out[len++] = (UINT8)newImage[i];
+            out[len++] = (UINT8)(newImage[i] >> 8);
+            out[len++] = (UINT8)(newImage[i] >> 16);
+            n = 1;
+        }
+
+        i += n;
+        idx += n;
+    }
+
+    *used = i;
+    return len;
+}
+
+#endif
@@ -0,0 +1,53 @@
+/* Patch.h
+ * Description:
+ *
+ * Delta update of the installed image, one flash page at a time. The
+ * applier is used by the boot loader (PROGRAM_PATCH), the encoder by the
+ * host tools (build Patch.c with PATCH_ENCODER defined). Both only use
+ * plain C, so they build and run on the PC as well.
+ *
+ * A patch frame is a 24-bit program address (LSB first), followed by ops
+ * that rebuild the new page from there on. An op byte holds the op in its
+ * upper 2 bits and n - 1 in the lower 6, for n = 1..PATCH_MAX_RUN
+ * instructions:
+ *
+ *  PATCH_COPY      n instructions of the installed image, same address.
+ *  PATCH_LITERAL   n instructions follow, 3 bytes each (LSB first).
+ *  PATCH_MOVE      n instructions of the installed image, from the
+ *                  24-bit program address that follows.
+ *  PATCH_FILL      n times the 3-byte instruction that follows.
+ *
+ * A page may span frames, the next frame starts where the previous one
+ * ended. Pages are rewritten when complete, so sources of PATCH_COPY and
+ * PATCH_MOVE must not lie below the page being built.
+ */
+
+#ifndef __PATCH_H__
+#define __PATCH_H__
+
+#define PATCH_PAGE_INSTRUCTIONS     1024
+#define PATCH_MAX_RUN               64
+
+#define PATCH_COPY                  0x00
+#define PATCH_LITERAL               0x40
+#define PATCH_MOVE                  0x80
+#define PATCH_FILL                  0xC0
+
+typedef struct
+{
+    UINT32 Address;         // Program address of Page[0], page aligned.
+    UINT Pos;               // Next instruction of the page to build.
+    UINT32 *Page;           // PATCH_PAGE_INSTRUCTIONS instructions.
+    UINT32 (*Read)(UINT32 progAddress);             // Installed image.
+    void (*PageDone)(UINT32 progAddress, UINT32 *page);
+}T_PATCH;
+
+UINT8 PatchApply(T_PATCH *patch, const UINT8 *data, UINT dataLen);
+
+#ifdef PATCH_ENCODER
+UINT PatchEncode(UINT32 address, const UINT32 *newImage, UINT count,
+                 const UINT32 *oldImage, UINT32 oldCount,
+                 UINT8 *out, UINT outMax, UINT *used);
+#endif
+
+#endif
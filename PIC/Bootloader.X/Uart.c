@@ -43,21 +43,60 @@
 #include "Framework.h"
 
 
-static UINT8 TxBuff[255];
+// Largest frame GetTransmitFrame() can produce: every byte escaped + SOH/EOT
+static FAR UINT8 TxBuff[2*(FRAMEWORK_BUFF_SIZE + 2) + 2];
+
+// Receive ring buffer, filled by the UART1 receive interrupt
+static FAR UINT8 RxRing[UART_RX_BUFF_SIZE];
+static volatile UINT16 rx_head = 0;       // written by the interrupt only
+static volatile UINT16 rx_tail = 0;       // written by the main loop only
+
+volatile UINT16 uart_rx_overruns = 0;     // bytes lost in hardware or ring
+
+// Transmit ring buffer, drained by the UART1 transmit interrupt
+static FAR UINT8 TxRing[UART_TX_BUFF_SIZE];
+static volatile UINT16 tx_head = 0;       // written by the main loop only
+static volatile UINT16 tx_tail = 0;       // written with the transmit interrupt disabled
+
+// Baud rate change on trial until a valid frame arrives at the new rate
+static BOOL baud_trial = FALSE;
+static UINT16 baud_frames;                // valid frames when the trial started
+static UINT8 baud_periods;                // Timer2 periods since then
+
+// INTTREG vector numbers (IRQ + 8) of the interrupts the boot loader uses
+#define U1RX_VECNUM     (8 + 11)
+#define U1TX_VECNUM     (8 + 12)
+
+static void txFill(void);
+static void uartSetBrg(UINT16 brg);
 
 /********************************************************************
 * Function: 	UartTasks()
 ********************************************************************/
 void uartTask(void)
 {
-   unsigned char TxLen;
-   unsigned char Rx;
+   UINT TxLen;
    unsigned char *ptr;
-   // Check any character is received.
-   if(getChar(&Rx))
+   UINT16 head;
+   UINT16 len;
+   UINT16 brg;
+
+   // Pass everything received so far to the frame work, one contiguous
+   // block of the ring at a time. The frame work may take less than
+   // offered (frame pending), the rest stays in the ring.
+   head = rx_head;
+   while(head != rx_tail)
    {
-      // Pass the bytes to frame work.
-      BuildRxFrame(&Rx, 1);
+      if(head > rx_tail)
+         len = head - rx_tail;
+      else
+         len = UART_RX_BUFF_SIZE - rx_tail;
+
+      len = BuildRxFrame(&RxRing[rx_tail], len);
+      if(len == 0)
+         break;
+
+      rx_tail = (rx_tail + len) & (UART_RX_BUFF_SIZE - 1);
    }
 
    ptr = TxBuff;
@@ -66,11 +105,40 @@ void uartTask(void)
 
    if(TxLen)
    {
-      // There is something to transmit.
+      // There is something to transmit. Queue it, the transmit
+      // interrupt sends it out while we go on parsing and programming.
       while(TxLen--)
          putChar(*(ptr++));
    } 
 
+   if(BaudRateChangeRequested(&brg))
+   {
+      // CHANGE_BAUD response is queued, switch once it is out
+      uartSetBrg(brg);
+      baud_trial = TRUE;
+      baud_frames = ValidFramesReceived();
+      baud_periods = 0;
+      TMR2 = 0;
+      IFS0bits.T2IF = 0;
+   }
+   else if(baud_trial)
+   {
+      if(ValidFramesReceived() != baud_frames)
+      {
+         baud_trial = FALSE;                   // host got through, keep the rate
+      }
+      else if(IFS0bits.T2IF)
+      {
+         IFS0bits.T2IF = 0;
+         if(++baud_periods >= UART_BAUD_TIMEOUT)
+         {
+            // Nothing valid at the new rate, go back to where the host
+            // started
+            uartSetBrg(UART_BOOT_BRG);
+            baud_trial = FALSE;
+         }
+      }
+   }
 
 }
 
@@ -79,14 +147,10 @@ void uartTask(void)
 ********************************************************************/
 BOOL getChar(UINT8 *byte)
 {
-	if(U1STAbits.URXDA)
+	if(rx_head != rx_tail)
 	{
-		*byte = (UINT8)U1RXREG;		        // get data from UART RX FIFO
-		// Clear error flag
-    	if(U1STAbits.OERR)
-    	{
-        	U1STAbits.OERR = 0;
-    	} 
+		*byte = RxRing[rx_tail];		        // get data from the receive ring
+		rx_tail = (rx_tail + 1) & (UART_RX_BUFF_SIZE - 1);
 		return TRUE;
 	}
 	
@@ -94,12 +158,121 @@ BOOL getChar(UINT8 *byte)
 }
 
 /********************************************************************
-* Function: 	putChar(), blocking
+* Function: 	_DefaultInterrupt()
+*
+* The boot loader runs from aux flash, which has a single interrupt
+* vector (see the .ivt section of the linker script), so the UART1
+* receive and transmit interrupts are served here. Flash erase/write
+* busy-waits run with interrupts enabled, so nothing is lost while
+* flash is busy. Traps and any other interrupt land here too; they
+* reset the device, as the compiler's default handler did.
+********************************************************************/
+void INTERRUPT _DefaultInterrupt(void)
+{
+   UINT16 next;
+
+   if((INTTREGbits.VECNUM != U1RX_VECNUM) && (INTTREGbits.VECNUM != U1TX_VECNUM))
+   {
+      reset();
+   }
+
+   if(IFS0bits.U1RXIF)
+   {
+      IFS0bits.U1RXIF = 0;
+
+      while(U1STAbits.URXDA)
+      {
+         next = (rx_head + 1) & (UART_RX_BUFF_SIZE - 1);
+         if(next != rx_tail)
+         {
+            RxRing[rx_head] = (UINT8)U1RXREG;
+            rx_head = next;
+         }
+         else
+         {
+            (void)U1RXREG;                     // ring full, drop it
+            uart_rx_overruns++;
+         }
+      }
+
+      // Clear error flag, otherwise reception stops
+      if(U1STAbits.OERR)
+      {
+         U1STAbits.OERR = 0;
+         uart_rx_overruns++;
+      }
+   }
+
+   if(IFS0bits.U1TXIF && IEC0bits.U1TXIE)
+   {
+      IFS0bits.U1TXIF = 0;
+      txFill();
+      if(tx_tail == tx_head)
+         IEC0bits.U1TXIE = 0;                  // all sent
+   }
+}
+
+/********************************************************************
+* Function: 	txFill()
+*
+* Moves bytes from the transmit ring into the hardware FIFO until one
+* of them is full/empty. Called with the transmit interrupt disabled
+* or from the interrupt itself.
+********************************************************************/
+static void txFill(void)
+{
+   while((tx_tail != tx_head) && !U1STAbits.UTXBF)
+   {
+      U1TXREG = TxRing[tx_tail];
+      tx_tail = (tx_tail + 1) & (UART_TX_BUFF_SIZE - 1);
+   }
+}
+
+/********************************************************************
+* Function: 	putChar(), blocks only while the transmit ring is full
 ********************************************************************/
 void putChar(UINT8 tx_char)
 {
-    while(U1STAbits.UTXBF); // wait for TX buffer to be empty
-    U1TXREG = tx_char;
+    UINT16 next;
+
+    next = (tx_head + 1) & (UART_TX_BUFF_SIZE - 1);
+    while(next == tx_tail); // ring full, the interrupt makes room
+
+    TxRing[tx_head] = tx_char;
+
+    IEC0bits.U1TXIE = 0;
+    tx_head = next;
+    txFill();               // start sending if the FIFO has room
+    if(tx_tail != tx_head)
+        IEC0bits.U1TXIE = 1;
+}
+
+/********************************************************************
+* Function: 	uartClose()
+*
+* Waits until everything queued is sent and disables the UART
+* interrupts, so the application starts with them off.
+********************************************************************/
+void uartClose(void)
+{
+    while(tx_tail != tx_head);
+    while(!U1STAbits.TRMT);
+
+    IEC0bits.U1TXIE = 0;
+    IEC0bits.U1RXIE = 0;
+}
+
+/********************************************************************
+* Function: 	uartSetBrg()
+*
+* Waits until everything queued is sent, then changes the baud rate.
+********************************************************************/
+static void uartSetBrg(UINT16 brg)
+{
+    while(tx_tail != tx_head);
+    while(!U1STAbits.TRMT);
+
+    U1BRG = brg;
 }
 
 /********************************************************************
@@ -23,10 +23,28 @@
 // OF THESE TERMS.
 #ifndef __UART_H__
 #define __UART_H__
+
+// Receive ring buffer size, must be a power of 2. Holds the whole
+// receive window of FRAMEWORK_RX_WINDOW completely escaped frames of
+// FRAMEWORK_BUFF_SIZE bytes.
+#define UART_RX_BUFF_SIZE           8192
+
+// Transmit ring buffer size, must be a power of 2.
+#define UART_TX_BUFF_SIZE           2048
+
+// Baud rate generator value at reset, BRGH = 1: SYS_FCY/(4*(32+1)), ~460800
+#define UART_BOOT_BRG               32
+
+// Timer2 periods (~280ms each) to wait for a valid frame after a baud
+// rate change before falling back to UART_BOOT_BRG.
+#define UART_BAUD_TIMEOUT           4
+
+extern volatile UINT16 uart_rx_overruns;
 						
 void uartTask(void);
 BOOL getChar(unsigned char *byte);
 void putChar(UINT8 tx_char);
 void printString(char *s);
+void uartClose(void);
 
 #endif
@@ -6,6 +6,7 @@
  */
 
 #include "system.h"
+#include "Uart.h"
 
 void initIO(void)
 {
@@ -42,9 +43,18 @@ void initIO(void)
    T1CONbits.TCS = 0;
    PR1 = 14000;
    T1CONbits.TON = 1;
+
+   // Free running timer for the baud rate change timeout, polled via T2IF
+   T2CONbits.TON = 0;
+   T2CONbits.TGATE = 0;
+   T2CONbits.TCKPS = 3;
+   T2CONbits.TCS = 0;
+   PR2 = 0xFFFF;
+   IFS0bits.T2IF = 0;
+   T2CONbits.TON = 1;
    
    // Initialize UART1
-   U1BRG = 32;              // 460800
+   U1BRG = UART_BOOT_BRG;   // 460800
    U1MODE = 0;
    U1STA = 0;
    U1MODEbits.BRGH = 1;
@@ -53,4 +63,17 @@ void initIO(void)
    U1STAbits.UTXEN = 1;
    U1STAbits.OERR = 0;
 
+   // UART1 receive interrupt on every character, feeds the receive ring
+   U1STAbits.URXISEL = 0;
+   IPC2bits.U1RXIP = 5;
+   IFS0bits.U1RXIF = 0;
+   IEC0bits.U1RXIE = 1;
+
+   // UART1 transmit interrupt when the FIFO has room, drains the transmit
+   // ring. Enabled by putChar() while there is something queued.
+   U1STAbits.UTXISEL0 = 0;
+   U1STAbits.UTXISEL1 = 0;
+   IPC3bits.U1TXIP = 5;
+   IEC0bits.U1TXIE = 0;
+
 }
\ No newline at end of file
@@ -14,12 +14,26 @@
 #ifndef SYSTEM_H
 #define	SYSTEM_H
 
-// Include the microcontroller
+// Include the microcontroller, or the model of it when the sources are
+// built for the simulator on the PC (see PC/sim)
+#ifdef SIMULATOR
+#include "SimDevice.h"
+#else
 #include "p33EP512MC806.h"
+#endif
 
 // Generic typedefs
 #include "GenericTypeDefs.h"
 
+/** Oscillator *****************************************************/
+// FRC with PLL, set up in main(): Fosc = FRC * M / (N1 * N2)
+#define FRC_FREQ                7370000UL
+#define PLL_M                   65            // PLLFBD = M - 2
+#define PLL_N1                  2             // PLLPRE = N1 - 2
+#define PLL_N2                  2             // PLLPOST = N2/2 - 1
+#define SYS_FOSC                (FRC_FREQ * PLL_M / (PLL_N1 * PLL_N2))
+#define SYS_FCY                 (SYS_FOSC / 2)  // also the peripheral clock
+
 /** LEDs ***********************************************************/
 #define LED1                    LATBbits.LATB14
 #define LED2                    LATBbits.LATB13
@@ -51,7 +65,36 @@
 #define YES                     1
 #define NO                      0
 
+/** Built-ins ******************************************************/
+// Table reads/writes and the NVM unlock sequence, the few things the
+// boot loader does beyond plain SFR accesses. The simulator models them.
+#ifdef SIMULATOR
+#define tblReadLow(offset)              simTblReadLow(offset)
+#define tblReadHigh(offset)             simTblReadHigh(offset)
+#define tblWriteLow(offset, data)       simTblWriteLow(offset, data)
+#define tblWriteHigh(offset, data)      simTblWriteHigh(offset, data)
+#define writeNVM()                      simWriteNVM()
+#define INTERRUPT                                       // called by the model
+#define FAR
+#else
+#define tblReadLow(offset)              __builtin_tblrdl(offset)
+#define tblReadHigh(offset)             __builtin_tblrdh(offset)
+#define tblWriteLow(offset, data)       __builtin_tblwtl(offset, data)
+#define tblWriteHigh(offset, data)      __builtin_tblwth(offset, data)
+#define writeNVM()                      __builtin_write_NVM()
+#define INTERRUPT                       __attribute__((__interrupt__,no_auto_psv))
+// The small data model puts every variable in near data, the 4 KB of RAM
+// between the SFRs and 0x2000. The frame, ring and page buffers (~24 KB,
+// see README.md) do not fit there and are placed in far data instead.
+// They all still end below 0x8000, so plain 16-bit pointers reach them.
+#define FAR                             __attribute__((far))
+#endif
+
+#ifdef SIMULATOR
+#define reset()			simDeviceReset()
+#else
 #define reset()			__asm__ volatile("reset")
+#endif
 #define disiOn()                __asm__ volatile("disi #0x3FFF")
 #define disiOff()               __asm__ volatile("disi #0x0000")
 #define disableInterrupts()     INTCON2bits.GIE = 0